@@ -22,9 +22,12 @@ class IndexBenchDB:
                 raw_reads_time INTEGER,
                 mixed_time INTEGER,
                 updates_time INTEGER,
+                deletes_time INTEGER,
                 short_range_time INTEGER,
                 mid_range_time INTEGER,
                 long_range_time INTEGER,
+                startup_time INTEGER,
+                peak_rss INTEGER,
                 size INTEGER,
                 height INTEGER,
                 internal INTEGER,
@@ -46,6 +49,7 @@ class IndexBenchDB:
                 mixed_writes_perc REAL,
                 mixed_reads_perc REAL,
                 updates_perc REAL,
+                deletes_perc REAL,
                 short_range REAL,
                 mid_range REAL,
                 long_range REAL,
@@ -62,6 +66,16 @@ class IndexBenchDB:
                 FOREIGN KEY (id) REFERENCES index_bench (id)
             );
         """)
+        # databases created before these columns existed
+        for table, column, sql_type in (
+            ("index_bench", "deletes_time", "INTEGER"),
+            ("index_bench", "startup_time", "INTEGER"),
+            ("index_bench", "peak_rss", "INTEGER"),
+            ("execution_args", "deletes_perc", "REAL"),
+        ):
+            columns = [row[1] for row in cursor.execute(f"PRAGMA table_info({table})")]
+            if column not in columns:
+                cursor.execute(f"ALTER TABLE {table} ADD COLUMN {column} {sql_type}")
         self.db_con.commit()
 
     def insert_row(self, index_type: str, workload_file: str, 
@@ -72,21 +86,23 @@ class IndexBenchDB:
             INSERT INTO index_bench (
                 timestamp, index_type, workload_file, N, K, L, threads,
                 preload_time, raw_writes_time, raw_reads_time,
-                mixed_time, updates_time, short_range_time,
-                mid_range_time, long_range_time,
+                mixed_time, updates_time, deletes_time, short_range_time,
+                mid_range_time, long_range_time, startup_time, peak_rss,
                 size, height, internal, leaves,
                 fast_inserts, redistribute,
                 soft_resets, hard_resets,
                 fast_inserts_fail, sort
             ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?,
-                    ?, ?, ?, ?, ?, ?, ?, ?);
+                    ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);
         """, (
             timestamp, index_type, workload_file,
             tree_analysis_results.N, tree_analysis_results.K, tree_analysis_results.L,
             tree_analysis_results.threads, tree_analysis_results.preload_time, tree_analysis_results.raw_writes_time,
             tree_analysis_results.raw_reads_time, tree_analysis_results.mixed_time,
-            tree_analysis_results.updates_time, tree_analysis_results.short_range_time,
+            tree_analysis_results.updates_time, tree_analysis_results.deletes_time,
+            tree_analysis_results.short_range_time,
             tree_analysis_results.mid_range_time, tree_analysis_results.long_range_time,
+            tree_analysis_results.startup_time, tree_analysis_results.peak_rss,
             tree_analysis_results.size, tree_analysis_results.height,
             tree_analysis_results.internal, tree_analysis_results.leaves,
             tree_analysis_results.fast_inserts, tree_analysis_results.redistribute,
@@ -101,17 +117,18 @@ class IndexBenchDB:
             INSERT INTO execution_args (
                 id, blocks_in_memory, raw_read_perc, raw_write_perc,
                 mixed_writes_perc, mixed_reads_perc, updates_perc,
-                short_range, mid_range, long_range,
+                deletes_perc, short_range, mid_range, long_range,
                 runs, repeat, seed,
                 num_threads, results_csv, results_log,
                 binary_input, validate, verbose,
                 input_file
-            ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ? , ?);
+            ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);
         """, (
             last_id, tree_analysis_args.blocks_in_memory,
             tree_analysis_args.raw_read_perc, tree_analysis_args.raw_write_perc,
             tree_analysis_args.mixed_writes_perc, tree_analysis_args.mixed_reads_perc,
-            tree_analysis_args.updates_perc, tree_analysis_args.short_range,
+            tree_analysis_args.updates_perc, tree_analysis_args.deletes_perc,
+            tree_analysis_args.short_range,
             tree_analysis_args.mid_range, tree_analysis_args.long_range,
             tree_analysis_args.runs, tree_analysis_args.repeat,
             tree_analysis_args.seed, tree_analysis_args.num_threads,
@@ -14,6 +14,7 @@ class TreeAnalysisArgs:
     mixed_writes_perc: float = 0
     mixed_reads_perc: float = 0
     updates_perc: float = 0
+    deletes_perc: float = 0
     short_range: float = 0
     mid_range: float = 0
     long_range: float = 0
@@ -36,9 +37,12 @@ class TreeAnalysisResults:
     raw_reads_time: int = 0
     mixed_time: int= 0
     updates_time: int = 0
+    deletes_time: int = 0
     short_range_time: int = 0
     mid_range_time: int = 0
     long_range_time: int = 0
+    startup_time: int = 0
+    peak_rss: int = 0
 
     # index stats
     size: int = 0
@@ -68,9 +72,12 @@ class TreeAnalysisRegex:
         self.raw_reads_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Raw Reads: (\d+)", flags)
         self.mixed_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Mixed: (\d+)", flags)
         self.updates_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Updates: (\d+)", flags)
+        self.deletes_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Deletes: (\d+)", flags)
         self.short_range_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Short Range: (\d+)", flags)
         self.mid_range_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Mid Range: (\d+)", flags)
         self.long_range_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Long Range: (\d+)", flags)
+        self.startup_time_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Startup: (\d+)", flags)
+        self.peak_rss_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] Peak RSS: (\d+)", flags)
 
         # index stats regex
         self.size_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] size: (\d+)", flags)
@@ -94,6 +101,7 @@ class TreeAnalysisRegex:
         self.mixed_writes_perc_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] mixed_writes_perc: (\d+)", flags)
         self.mixed_reads_perc_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] mixed_reads_perc: (\d+)", flags)
         self.updates_perc_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] updates_perc: (\d+)", flags)
+        self.deletes_perc_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] deletes_perc: (\d+)", flags)
         self.short_range_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] short_range: (\d+)", flags)
         self.mid_range_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] mid_range: (\d+)", flags)
         self.long_range_regex = re.compile(r"\[[0-9 :.-]+\] \[.*?\] \[info\] long_range: (\d+)", flags)
@@ -127,6 +135,8 @@ class PyTreeAnalysis:
         args.mixed_reads_perc = int(mixed_reads_perc.group(1)) if mixed_reads_perc else 0
         updates_perc = self.tree_analysis_regex.updates_perc_regex.search(process_results)
         args.updates_perc = int(updates_perc.group(1)) if updates_perc else 0
+        deletes_perc = self.tree_analysis_regex.deletes_perc_regex.search(process_results)
+        args.deletes_perc = int(deletes_perc.group(1)) if deletes_perc else 0
         short_range = self.tree_analysis_regex.short_range_regex.search(process_results)
         args.short_range = int(short_range.group(1)) if short_range else 0
         mid_range = self.tree_analysis_regex.mid_range_regex.search(process_results)
@@ -169,6 +179,9 @@ class PyTreeAnalysis:
         updates_time = self.tree_analysis_regex.updates_time_regex.search(process_results)
         results.updates_time = int(updates_time.group(1)) if updates_time else 0
 
+        deletes_time = self.tree_analysis_regex.deletes_time_regex.search(process_results)
+        results.deletes_time = int(deletes_time.group(1)) if deletes_time else 0
+
         short_range_time = self.tree_analysis_regex.short_range_time_regex.search(process_results)
         results.short_range_time = int(short_range_time.group(1)) if short_range_time else 0
 
@@ -178,6 +191,12 @@ class PyTreeAnalysis:
         long_range_time = self.tree_analysis_regex.long_range_time_regex.search(process_results)
         results.long_range_time = int(long_range_time.group(1)) if long_range_time else 0
 
+        startup_time = self.tree_analysis_regex.startup_time_regex.search(process_results)
+        results.startup_time = int(startup_time.group(1)) if startup_time else 0
+
+        peak_rss = self.tree_analysis_regex.peak_rss_regex.search(process_results)
+        results.peak_rss = int(peak_rss.group(1)) if peak_rss else 0
+
         # index stats
         size = self.tree_analysis_regex.size_regex.search(process_results)
         results.size = int(size.group(1)) if size else 0
@@ -229,6 +248,7 @@ class PyTreeAnalysis:
                 config.mixed_writes_perc = config_data["MIXED_WRITES_PERCENTAGE"]
                 config.mixed_reads_perc = config_data["MIXED_READ_PERCENTAGE"]
                 config.updates_perc = config_data["UPDATES_PERCENTAGE"]
+                config.deletes_perc = config_data.get("DELETES_PERCENTAGE", 0)
                 config.short_range = config_data["SHORT_RANGE_QUERIES"]
                 config.mid_range = config_data["MID_RANGE_QUERIES"]
                 config.long_range = config_data["LONG_RANGE_QUERIES"]
@@ -278,6 +298,7 @@ class PyTreeAnalysis:
         logging.info(f"Raw reads time: {results.raw_reads_time}")
         logging.info(f"Mixed time: {results.mixed_time}")
         logging.info(f"Updates time: {results.updates_time}")
+        logging.info(f"Deletes time: {results.deletes_time}")
         logging.info(f"Short range time: {results.short_range_time}")
         logging.info(f"Mid range time: {results.mid_range_time}")
         logging.info(f"Long range time: {results.long_range_time}") 
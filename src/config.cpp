@@ -44,6 +44,8 @@ void Config::parse(const char *file) {
             mixed_reads_perc = std::stoi(knob_value);
         } else if (knob_name == "UPDATES_PERCENTAGE") {
             updates_perc = std::stoi(knob_value);
+        } else if (knob_name == "DELETES_PERCENTAGE") {
+            deletes_perc = std::stoi(knob_value);
         } else if (knob_name == "SHORT_RANGE_QUERIES") {
             short_range = std::stoi(knob_value);
         } else if (knob_name == "MID_RANGE_QUERIES") {
@@ -58,6 +60,12 @@ void Config::parse(const char *file) {
             seed = std::stoi(knob_value);
         } else if (knob_name == "NUM_THREADS") {
             num_threads = std::stoi(knob_value);
+        } else if (knob_name == "MULTI_GET_BATCH") {
+            multi_get_batch = std::stoi(knob_value);
+        } else if (knob_name == "BULK_LOAD_FILL") {
+            bulk_load_fill = std::stoi(knob_value);
+        } else if (knob_name == "INSERT_BATCH") {
+            insert_batch = std::stoi(knob_value);
         } else if (knob_name == "RESULTS_FILE") {
             results_csv = str_val(knob_value);
         } else if (knob_name == "RESULTS_LOG") {
@@ -95,6 +103,10 @@ void Config::parse(int argc, char **argv) {
         {"txt_input", no_argument, nullptr, i++},
         {"validate", no_argument, nullptr, i++},
         {"verbose", no_argument, nullptr, i++},
+        {"deletes_perc", required_argument, nullptr, i++},
+        {"multi_get_batch", required_argument, nullptr, i++},
+        {"bulk_load_fill", required_argument, nullptr, i++},
+        {"insert_batch", required_argument, nullptr, i++},
         {nullptr, 0, nullptr, 0},
     };
     // static struct option long_options[] = {
@@ -178,6 +190,18 @@ void Config::parse(int argc, char **argv) {
             case 18:
                 verbose = true;
                 break;
+            case 19:
+                deletes_perc = std::stoi(optarg);
+                break;
+            case 20:
+                multi_get_batch = std::stoi(optarg);
+                break;
+            case 21:
+                bulk_load_fill = std::stoi(optarg);
+                break;
+            case 22:
+                insert_batch = std::stoi(optarg);
+                break;
             default:
                 printf("?? getopt returned character code 0%o ??\n", c);
         }
@@ -193,10 +217,14 @@ void Config::print() {
               << "\nmixed_writes_perc: " << mixed_writes_perc
               << "\nmixed_reads_perc: " << mixed_reads_perc
               << "\nupdates_perc: " << updates_perc
+              << "\ndeletes_perc: " << deletes_perc
               << "\nshort_range: " << short_range
               << "\nmid_range: " << mid_range << "\nlong_range: " << long_range
               << "\nruns: " << runs << "\nrepeat: " << repeat
               << "\nseed: " << seed << "\nnum_threads: " << num_threads
+              << "\nmulti_get_batch: " << multi_get_batch
+              << "\nbulk_load_fill: " << bulk_load_fill
+              << "\ninsert_batch: " << insert_batch
               << "\nresults_csv: " << results_csv
               << "\nresults_log: " << results_log
               << "\nbinary_input: " << binary_input
@@ -216,6 +244,7 @@ void Config::print(utils::logging::Logger &log) {
     log.info("mixed_writes_perc: {}", mixed_writes_perc);
     log.info("mixed_reads_perc: {}", mixed_reads_perc);
     log.info("updates_perc: {}", updates_perc);
+    log.info("deletes_perc: {}", deletes_perc);
     log.info("short_range: {}", short_range);
     log.info("mid_range: {}", mid_range);
     log.info("long_range: {}", long_range);
@@ -223,6 +252,9 @@ void Config::print(utils::logging::Logger &log) {
     log.info("repeat: {}", repeat);
     log.info("seed: {}", seed);
     log.info("num_threads: {}", num_threads);
+    log.info("multi_get_batch: {}", multi_get_batch);
+    log.info("bulk_load_fill: {}", bulk_load_fill);
+    log.info("insert_batch: {}", insert_batch);
     log.info("results_csv: {}", results_csv);
     log.info("results_log: {}", results_log);
     log.info("binary_input: {}", binary_input);
@@ -3,26 +3,55 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include "search.hpp"
 
 enum bp_node_type { LEAF, INTERNAL };
 
+// latch kept in the header of each node, if any
+template <typename latch_type>
+struct node_latch {
+    latch_type latch;
+};
+
+template <>
+struct node_latch<void> {};
+
+// bytes an internal node keeps per child for its count, if any
+template <typename count_type>
+inline constexpr size_t count_size = sizeof(count_type);
+
+template <>
+inline constexpr size_t count_size<void> = 0;
+
+/*
+    With a count_type, internal nodes keep the number of entries below each of
+    their children, in an array after the children, for order statistics.
+*/
 template <typename node_id_type, typename key_type, typename value_type,
-          size_t block_size>
+          size_t block_size, typename latch_type = void,
+          typename count_type = void>
 class BTreeNode {
-    struct node_info {
+    struct node_info : node_latch<latch_type> {
         node_id_type id;
         node_id_type next_id;
+        // left sibling of a leaf, the first leaf has none
+        node_id_type prev_id;
         uint16_t size;
         uint16_t type;
     };
 
    public:
+    static constexpr bool counted = count_size<count_type> != 0;
     static constexpr uint16_t leaf_capacity =
         (block_size - sizeof(node_info)) /
         (sizeof(key_type) + sizeof(value_type));
     static constexpr uint16_t internal_capacity =
-        (block_size - sizeof(node_info) - sizeof(node_id_type)) /
-        (sizeof(key_type) + sizeof(node_id_type));
+        (block_size - sizeof(node_info) - sizeof(node_id_type) -
+         count_size<count_type>) /
+        (sizeof(key_type) + sizeof(node_id_type) + count_size<count_type>);
 
     node_info *info;
     key_type *keys;
@@ -58,18 +87,181 @@ class BTreeNode {
         }
     }
 
+    /*
+        Hints the cache lines a search of the node in buf reads first: the
+        header and the middle key of a node that is two thirds full.
+    */
+    static void prefetch(const void *buf) {
+        const char *block = static_cast<const char *>(buf);
+        __builtin_prefetch(block);
+        __builtin_prefetch(block + sizeof(node_info) +
+                           internal_capacity / 3 * sizeof(key_type));
+    }
+
+    // entries below each child of an internal node
+    count_type *counts() const
+        requires counted
+    {
+        return reinterpret_cast<count_type *>(children + internal_capacity + 1);
+    }
+
+    // entries in the subtree of this node
+    size_t entries() const
+        requires counted
+    {
+        if (info->type == bp_node_type::LEAF) {
+            return info->size;
+        }
+        return std::accumulate(counts(), counts() + info->size + 1, size_t{0});
+    }
+
     uint16_t value_slot(const key_type &key) const {
-        auto it = std::lower_bound(keys, keys + info->size, key);
-        return std::distance(keys, it);
+        return utils::search::lower_bound(keys, info->size, key);
     }
 
     uint16_t value_slot2(const key_type &key) const {
-        auto it = std::upper_bound(keys, keys + info->size, key);
-        return std::distance(keys, it);
+        return utils::search::upper_bound(keys, info->size, key);
     }
 
     uint16_t child_slot(const key_type &key) const {
-        auto it = std::upper_bound(keys, keys + info->size, key);
-        return std::distance(keys, it);
+        return utils::search::upper_bound(keys, info->size, key);
+    }
+
+    // removes the entry at index of a leaf
+    void erase_value(uint16_t index) {
+        std::memmove(keys + index, keys + index + 1,
+                     (info->size - index - 1) * sizeof(key_type));
+        std::memmove(values + index, values + index + 1,
+                     (info->size - index - 1) * sizeof(value_type));
+        --info->size;
+    }
+
+    // removes children[slot] of an internal node with the key left of it
+    void erase_child(uint16_t slot) {
+        std::memmove(keys + slot - 1, keys + slot,
+                     (info->size - slot) * sizeof(key_type));
+        std::memmove(children + slot, children + slot + 1,
+                     (info->size - slot) * sizeof(node_id_type));
+        if constexpr (counted) {
+            std::memmove(counts() + slot, counts() + slot + 1,
+                         (info->size - slot) * sizeof(count_type));
+        }
+        --info->size;
+    }
+
+    // true if the entries of this node and its right sibling fit one node
+    bool fits(const BTreeNode &right) const {
+        if (info->type == bp_node_type::LEAF) {
+            return info->size + right.info->size <= leaf_capacity;
+        }
+        return info->size + right.info->size + 1 <= internal_capacity;
+    }
+
+    /*
+        Appends all entries of right, the right sibling of this node, and
+        takes over its next_id. separator is the parent key between the two,
+        it moves down into internal nodes. Requires fits(right).
+    */
+    void merge(const BTreeNode &right, const key_type &separator) {
+        const uint16_t size = info->size;
+        const uint16_t right_size = right.info->size;
+        if (info->type == bp_node_type::LEAF) {
+            std::memcpy(keys + size, right.keys, right_size * sizeof(key_type));
+            std::memcpy(values + size, right.values,
+                        right_size * sizeof(value_type));
+            info->size = size + right_size;
+        } else {
+            keys[size] = separator;
+            std::memcpy(keys + size + 1, right.keys,
+                        right_size * sizeof(key_type));
+            std::memcpy(children + size + 1, right.children,
+                        (right_size + 1) * sizeof(node_id_type));
+            if constexpr (counted) {
+                std::memcpy(counts() + size + 1, right.counts(),
+                            (right_size + 1) * sizeof(count_type));
+            }
+            info->size = size + right_size + 1;
+        }
+        info->next_id = right.info->next_id;
+    }
+
+    /*
+        Moves entries between this node and its right sibling until both hold
+        about the same number. separator is the parent key between the two;
+        returns the key that replaces it.
+    */
+    key_type redistribute(BTreeNode &right, const key_type &separator) {
+        const uint16_t size = info->size;
+        const uint16_t right_size = right.info->size;
+        if (info->type == bp_node_type::LEAF) {
+            if (size < right_size) {
+                const uint16_t k = (right_size - size) / 2;
+                std::memcpy(keys + size, right.keys, k * sizeof(key_type));
+                std::memcpy(values + size, right.values,
+                            k * sizeof(value_type));
+                std::memmove(right.keys, right.keys + k,
+                             (right_size - k) * sizeof(key_type));
+                std::memmove(right.values, right.values + k,
+                             (right_size - k) * sizeof(value_type));
+                info->size = size + k;
+                right.info->size = right_size - k;
+            } else {
+                const uint16_t k = (size - right_size) / 2;
+                std::memmove(right.keys + k, right.keys,
+                             right_size * sizeof(key_type));
+                std::memmove(right.values + k, right.values,
+                             right_size * sizeof(value_type));
+                std::memcpy(right.keys, keys + size - k, k * sizeof(key_type));
+                std::memcpy(right.values, values + size - k,
+                            k * sizeof(value_type));
+                info->size = size - k;
+                right.info->size = right_size + k;
+            }
+            return right.keys[0];
+        }
+        // internal nodes rotate k children through the separator
+        key_type new_separator;
+        if (size < right_size) {
+            const uint16_t k = (right_size - size) / 2;
+            keys[size] = separator;
+            std::memcpy(keys + size + 1, right.keys,
+                        (k - 1) * sizeof(key_type));
+            std::memcpy(children + size + 1, right.children,
+                        k * sizeof(node_id_type));
+            new_separator = right.keys[k - 1];
+            std::memmove(right.keys, right.keys + k,
+                         (right_size - k) * sizeof(key_type));
+            std::memmove(right.children, right.children + k,
+                         (right_size - k + 1) * sizeof(node_id_type));
+            if constexpr (counted) {
+                std::memcpy(counts() + size + 1, right.counts(),
+                            k * sizeof(count_type));
+                std::memmove(right.counts(), right.counts() + k,
+                             (right_size - k + 1) * sizeof(count_type));
+            }
+            info->size = size + k;
+            right.info->size = right_size - k;
+        } else {
+            const uint16_t k = (size - right_size) / 2;
+            std::memmove(right.keys + k, right.keys,
+                         right_size * sizeof(key_type));
+            std::memmove(right.children + k, right.children,
+                         (right_size + 1) * sizeof(node_id_type));
+            right.keys[k - 1] = separator;
+            std::memcpy(right.keys, keys + size - k + 1,
+                        (k - 1) * sizeof(key_type));
+            std::memcpy(right.children, children + size - k + 1,
+                        k * sizeof(node_id_type));
+            if constexpr (counted) {
+                std::memmove(right.counts() + k, right.counts(),
+                             (right_size + 1) * sizeof(count_type));
+                std::memcpy(right.counts(), counts() + size - k + 1,
+                            k * sizeof(count_type));
+            }
+            new_separator = keys[size - k];
+            info->size = size - k;
+            right.info->size = right_size + k;
+        }
+        return new_separator;
     }
 };
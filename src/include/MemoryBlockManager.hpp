@@ -1,35 +1,189 @@
 #pragma once
 
-#include <array>
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
 #include <vector>
 
+#include "arena.hpp"
+#include "epoch.hpp"
+
 #ifndef BLOCK_SIZE_BYTES
 #define BLOCK_SIZE_BYTES 4096
 #endif
 
+// thrown by allocate() once all blocks up to the hard limit are in use
+class block_limit_exceeded : public std::bad_alloc {
+   public:
+    const char *what() const noexcept override {
+        return "InMemoryBlockManager: block limit exceeded";
+    }
+};
+
+/*
+    Blocks live in one arena mapping of cap blocks that is only backed by
+    memory as blocks are first written, so startup cost and resident memory
+    follow the blocks actually used. cap is a hard limit. Blocks handed back
+    through free() are reused before any untouched block.
+
+    Concurrent trees retire() blocks instead, from inside pin(): a retired
+    block is only reused once every thread that was pinned when it was
+    retired has left, so optimistic readers never see it change under them.
+    Each thread keeps its own free and retired blocks and only shares
+    blocks beyond CACHE_LIMIT.
+*/
 template <typename node_id_t>
 class InMemoryBlockManager {
    public:
     static constexpr size_t block_size = BLOCK_SIZE_BYTES;
+    // retired blocks are collected in batches of this size
+    static constexpr size_t RECLAIM_BATCH = 64;
+    static constexpr size_t CACHE_LIMIT = 1024;
 
-    explicit InMemoryBlockManager(const uint32_t cap) : internal_memory(cap) {}
+    explicit InMemoryBlockManager(const uint32_t cap)
+        : capacity(cap),
+          blocks(static_cast<uint8_t *>(arena::map(cap * block_size))) {}
 
-    void reset() { next_block_id = 0; }
+    InMemoryBlockManager(const InMemoryBlockManager &) = delete;
+    InMemoryBlockManager &operator=(const InMemoryBlockManager &) = delete;
+
+    ~InMemoryBlockManager() { arena::unmap(blocks, capacity * block_size); }
+
+    // keeps the touched blocks around for the next run, requires that no
+    // thread uses the manager
+    void reset() {
+        std::lock_guard lock(free_mutex);
+        free_ids.clear();
+        num_free.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < epoch::MAX_THREADS; ++i) {
+            caches[i].free_ids.clear();
+            caches[i].retired.clear();
+            caches[i].num_free.store(0, std::memory_order_relaxed);
+        }
+        next_block_id = 0;
+    }
 
     node_id_t allocate() {
-        return next_block_id.fetch_add(1, std::memory_order_acq_rel);
+        thread_cache &cache = caches[epoch::thread_slot::get()];
+        if (cache.free_ids.empty() && !cache.retired.empty()) {
+            reclaim(cache);
+        }
+        if (!cache.free_ids.empty()) {
+            const node_id_t id = cache.free_ids.back();
+            cache.free_ids.pop_back();
+            cache.num_free.store(cache.free_ids.size(),
+                                 std::memory_order_relaxed);
+            return id;
+        }
+        // the shared list is only locked once something was spilled there
+        if (num_free.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard lock(free_mutex);
+            if (!free_ids.empty()) {
+                const node_id_t id = free_ids.back();
+                free_ids.pop_back();
+                num_free.store(free_ids.size(), std::memory_order_relaxed);
+                return id;
+            }
+        }
+        const node_id_t id =
+            next_block_id.fetch_add(1, std::memory_order_relaxed);
+        if (id >= capacity) {
+            throw block_limit_exceeded();
+        }
+        return id;
+    }
+
+    /*
+        Returns id to the manager for immediate reuse. The caller has to make
+        sure no one can reach the block anymore.
+    */
+    void free(const node_id_t id) {
+        thread_cache &cache = caches[epoch::thread_slot::get()];
+        cache.free_ids.push_back(id);
+        spill(cache);
+    }
+
+    // keeps the calling thread pinned in the current epoch while alive
+    [[nodiscard]] epoch::domain::guard pin() {
+        return epoch::domain::guard(epochs);
+    }
+
+    /*
+        Returns id to the manager once no thread that is pinned now can reach
+        it anymore. Requires the caller to be pinned and the block to be
+        unreachable for threads that pin later on.
+    */
+    void retire(const node_id_t id) {
+        thread_cache &cache = caches[epoch::thread_slot::get()];
+        cache.retired.emplace_back(epochs.current(), id);
+        if (cache.retired.size() % RECLAIM_BATCH == 0) {
+            reclaim(cache);
+        }
     }
 
     void mark_dirty(node_id_t) {}
 
-    void *open_block(const node_id_t id) { return internal_memory[id].data(); }
+    void *open_block(const node_id_t id) { return blocks + id * block_size; }
 
-    node_id_t get_capacity() const { return internal_memory.size(); }
+    node_id_t get_capacity() const { return capacity; }
+
+    // number of blocks in use, handed out since the last reset and not freed
+    size_t get_allocated() const {
+        size_t free = num_free.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < epoch::thread_slot::used(); ++i) {
+            free += caches[i].num_free.load(std::memory_order_relaxed);
+        }
+        return std::min<size_t>(next_block_id.load(std::memory_order_relaxed),
+                                capacity) -
+               free;
+    }
 
    private:
-    using Block = std::array<uint8_t, block_size>;
-    std::vector<Block> internal_memory;
+    // only touched by the thread of its slot, except for num_free
+    struct alignas(64) thread_cache {
+        std::vector<node_id_t> free_ids;
+        std::vector<std::pair<uint64_t, node_id_t>> retired;
+        std::atomic<size_t> num_free{};
+    };
+
+    // moves the retired blocks no pinned thread can reach to the free list
+    void reclaim(thread_cache &cache) {
+        epochs.try_advance();
+        auto it = cache.retired.begin();
+        // stamps only grow, the safe blocks form a prefix
+        while (it != cache.retired.end() && epochs.safe(it->first)) {
+            cache.free_ids.push_back(it->second);
+            ++it;
+        }
+        cache.retired.erase(cache.retired.begin(), it);
+        spill(cache);
+    }
+
+    // hands half of an overfull free list to the other threads
+    void spill(thread_cache &cache) {
+        if (cache.free_ids.size() > CACHE_LIMIT) {
+            std::lock_guard lock(free_mutex);
+            const auto half = cache.free_ids.begin() + CACHE_LIMIT / 2;
+            free_ids.insert(free_ids.end(), half, cache.free_ids.end());
+            cache.free_ids.erase(half, cache.free_ids.end());
+            num_free.store(free_ids.size(), std::memory_order_relaxed);
+        }
+        cache.num_free.store(cache.free_ids.size(), std::memory_order_relaxed);
+    }
+
+    const node_id_t capacity;
+    uint8_t *const blocks;
     std::atomic<node_id_t> next_block_id{};
+
+    std::mutex free_mutex;
+    std::vector<node_id_t> free_ids;
+    std::atomic<size_t> num_free{};
+
+    epoch::domain epochs;
+    std::unique_ptr<thread_cache[]> caches{
+        new thread_cache[epoch::MAX_THREADS]};
 };
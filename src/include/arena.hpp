@@ -0,0 +1,73 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace arena {
+/*
+    Reserves bytes of zero-filled anonymous memory without committing swap
+    for it. Pages are only backed by memory once they are touched, so the
+    cost of a mapping is proportional to the part actually used. With
+    HUGE_PAGES the range is also advised to use transparent huge pages.
+*/
+inline void *map(const size_t bytes) {
+    void *addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#ifdef HUGE_PAGES
+    madvise(addr, bytes, MADV_HUGEPAGE);
+#endif
+    return addr;
+}
+
+inline void unmap(void *addr, const size_t bytes) { munmap(addr, bytes); }
+
+// true if all-zero bytes are a valid, constructed T that need not be
+// destroyed; specialized next to the types that guarantee it
+template <typename T>
+struct zero_initialized
+    : std::bool_constant<std::is_trivially_default_constructible_v<T> &&
+                         std::is_trivially_destructible_v<T>> {};
+
+/*
+    Fixed-size array backed by map(). Elements of zero_initialized types
+    are never written on construction, so untouched elements cost no
+    memory; other types are constructed eagerly.
+*/
+template <typename T>
+class lazy_array {
+    T *data;
+    size_t n;
+
+   public:
+    explicit lazy_array(const size_t n)
+        : data(static_cast<T *>(map(n * sizeof(T)))), n(n) {
+        if constexpr (!zero_initialized<T>::value) {
+            for (size_t i = 0; i < n; ++i) {
+                new (data + i) T();
+            }
+        }
+    }
+
+    lazy_array(const lazy_array &) = delete;
+    lazy_array &operator=(const lazy_array &) = delete;
+
+    ~lazy_array() {
+        if constexpr (!zero_initialized<T>::value) {
+            for (size_t i = 0; i < n; ++i) {
+                data[i].~T();
+            }
+        }
+        unmap(data, n * sizeof(T));
+    }
+
+    T &operator[](const size_t i) const { return data[i]; }
+
+    size_t size() const { return n; }
+};
+}  // namespace arena
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BTreeNode.hpp"
+
+namespace utils::bulk {
+
+// each thread of a bulk load gets at least this many nodes of a level
+static constexpr size_t MIN_NODES_PER_THREAD = 64;
+
+/*
+    An entry of a bulk load, either a key/value pair or a plain key that gets
+    a default value.
+*/
+template <typename key_type, typename value_type, typename T>
+std::pair<key_type, value_type> entry(const T &e) {
+    if constexpr (std::is_convertible_v<const T &, key_type>) {
+        return {e, value_type{}};
+    } else {
+        return {e.first, e.second};
+    }
+}
+
+/*
+    Lays out a B+-tree bottom-up from entries in ascending key order, one
+    level at a time. A level packs its entries evenly into as few nodes as
+    the fill factor allows, so none of them ends up much below it. The nodes
+    of a level are split between threads that each allocate and fill their
+    own run, which are linked once all of them are done.
+*/
+template <typename node_t, typename BlockManager>
+class loader {
+    using node_id_t = std::remove_pointer_t<decltype(node_t::children)>;
+    using key_type = std::remove_pointer_t<decltype(node_t::keys)>;
+    using value_type = std::remove_pointer_t<decltype(node_t::values)>;
+
+    static constexpr node_id_t INVALID_NODE_ID =
+        std::numeric_limits<node_id_t>::max();
+
+    BlockManager &manager;
+    const unsigned num_threads;
+    const bool high_keys;
+
+    // entries per node out of capacity, a fill factor in [0.5, 1]
+    static uint16_t per_node(uint16_t capacity, double fill_factor) {
+        const double fill = std::clamp(fill_factor, 0.5, 1.0);
+        return std::max<uint16_t>(1, capacity * fill);
+    }
+
+    /*
+        Calls fill(node, i, begin, end) for the nodes i of a level of count
+        nodes, node i getting entries [begin, end) out of n, after setting up
+        its header. Threads take runs of consecutive nodes.
+    */
+    template <typename F>
+    void build(size_t n, size_t count, bp_node_type type, node_id_t first_id,
+               F &&fill) {
+        std::vector<node_id_t> level(count);
+        const size_t threads = std::clamp<size_t>(
+            count / MIN_NODES_PER_THREAD, 1, std::max(num_threads, 1u));
+        auto run = [&](size_t first, size_t last) {
+            node_id_t prev_id = INVALID_NODE_ID;
+            node_t prev;
+            for (size_t i = first; i < last; ++i) {
+                const node_id_t id = i == 0 && first_id != INVALID_NODE_ID
+                                         ? first_id
+                                         : manager.allocate();
+                node_t node(manager.open_block(id), type);
+                manager.mark_dirty(id);
+                node.info->id = id;
+                node.info->next_id = INVALID_NODE_ID;
+                node.info->prev_id = prev_id;
+                fill(node, i, i * n / count, (i + 1) * n / count);
+                if (prev_id != INVALID_NODE_ID) {
+                    prev.info->next_id = id;
+                }
+                level[i] = id;
+                prev_id = id;
+                prev = node;
+            }
+        };
+        {
+            std::vector<std::jthread> workers;
+            for (size_t t = 1; t < threads; ++t) {
+                workers.emplace_back(run, t * count / threads,
+                                     (t + 1) * count / threads);
+            }
+            run(0, count / threads);
+        }
+        for (size_t t = 1; t < threads; ++t) {
+            const size_t first = t * count / threads;
+            node_t left(manager.open_block(level[first - 1]));
+            node_t right(manager.open_block(level[first]));
+            left.info->next_id = level[first];
+            right.info->prev_id = level[first - 1];
+        }
+        ids = std::move(level);
+    }
+
+   public:
+    // ids and smallest keys of the nodes of the level built last
+    std::vector<node_id_t> ids;
+    std::vector<key_type> mins;
+
+    /*
+        With high_keys, every node but the last of a level keeps the smallest
+        key of its right sibling in the key slot right after capacity.
+    */
+    loader(BlockManager &m, unsigned threads, bool high_keys = false)
+        : manager(m), num_threads(threads), high_keys(high_keys) {}
+
+    /*
+        Packs the entries of [begin, end) into leaves of capacity entries.
+        The first leaf reuses the block of first_id, if given.
+    */
+    template <std::random_access_iterator It>
+    void leaves(It begin, It end, uint16_t capacity, double fill_factor,
+                node_id_t first_id = INVALID_NODE_ID) {
+        const size_t n = end - begin;
+        const uint16_t per = per_node(capacity, fill_factor);
+        const size_t count = std::max<size_t>(1, (n + per - 1) / per);
+        std::vector<key_type> level_mins(count);
+        build(n, count, LEAF, first_id,
+              [&](node_t &leaf, size_t i, size_t first, size_t last) {
+                  leaf.info->size = last - first;
+                  for (size_t j = first; j < last; ++j) {
+                      const auto [key, value] =
+                          entry<key_type, value_type>(begin[j]);
+                      leaf.keys[j - first] = key;
+                      leaf.values[j - first] = value;
+                  }
+                  level_mins[i] = first < last ? leaf.keys[0] : key_type{};
+                  if (high_keys && i + 1 < count) {
+                      leaf.keys[capacity] =
+                          entry<key_type, value_type>(begin[last]).first;
+                  }
+              });
+        mins = std::move(level_mins);
+    }
+
+    /*
+        Builds the level above the one built last out of internal nodes of
+        capacity keys. Counted nodes get the sizes of the subtrees below.
+    */
+    void internal(uint16_t capacity, double fill_factor) {
+        const size_t n = ids.size();
+        const size_t per = per_node(capacity, fill_factor) + 1;
+        const size_t count = (n + per - 1) / per;
+        std::vector<key_type> level_mins(count);
+        const std::vector<node_id_t> children = std::move(ids);
+        build(n, count, INTERNAL, INVALID_NODE_ID,
+              [&](node_t &node, size_t i, size_t first, size_t last) {
+                  node.info->size = last - first - 1;
+                  std::memcpy(node.keys, mins.data() + first + 1,
+                              node.info->size * sizeof(key_type));
+                  std::memcpy(node.children, children.data() + first,
+                              (last - first) * sizeof(node_id_t));
+                  if constexpr (node_t::counted) {
+                      for (size_t j = first; j < last; ++j) {
+                          node.counts()[j - first] =
+                              node_t(manager.open_block(children[j]))
+                                  .entries();
+                      }
+                  }
+                  level_mins[i] = mins[first];
+                  if (high_keys && i + 1 < count) {
+                      node.keys[capacity] = mins[last];
+                  }
+              });
+        mins = std::move(level_mins);
+    }
+
+    /*
+        Moves the only node of the level built last into the block of
+        root_id, leaving the header of the root but its size and type alone.
+    */
+    void move_to(node_id_t root_id) {
+        node_t top(manager.open_block(ids[0]));
+        node_t root(manager.open_block(root_id),
+                    static_cast<bp_node_type>(top.info->type));
+        manager.mark_dirty(root_id);
+        root.info->size = top.info->size;
+        if (top.info->type == LEAF) {
+            std::memcpy(root.keys, top.keys, top.info->size * sizeof(key_type));
+            std::memcpy(root.values, top.values,
+                        top.info->size * sizeof(value_type));
+        } else {
+            std::memcpy(root.keys, top.keys, top.info->size * sizeof(key_type));
+            std::memcpy(root.children, top.children,
+                        (top.info->size + 1) * sizeof(node_id_t));
+            if constexpr (node_t::counted) {
+                std::memcpy(root.counts(), top.counts(),
+                            (top.info->size + 1) * sizeof(*top.counts()));
+            }
+        }
+        manager.free(ids[0]);
+        ids[0] = root_id;
+    }
+};
+
+/*
+    Sorts a batch of key/value pairs by key and moves the last of the entries
+    of each key, in the order they came in, to the front. Returns how many
+    entries that leaves.
+*/
+template <typename key_type, typename value_type>
+size_t prepare(std::span<std::pair<key_type, value_type>> batch) {
+    auto by_key = [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    };
+    if (!std::is_sorted(batch.begin(), batch.end(), by_key)) {
+        std::stable_sort(batch.begin(), batch.end(), by_key);
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (i + 1 == batch.size() || batch[i].first != batch[i + 1].first) {
+            batch[n++] = batch[i];
+        }
+    }
+    return n;
+}
+
+// the entries at the front of sorted entries with keys below bound, if any
+template <typename E, typename key_type>
+std::span<E> run(std::span<E> entries, const key_type *bound) {
+    if (bound == nullptr) {
+        return entries;
+    }
+    const auto end = std::partition_point(
+        entries.begin(), entries.end(),
+        [&](const auto &e) { return e.first < *bound; });
+    return entries.first(end - entries.begin());
+}
+
+/*
+    Counts the entries at the front of the sorted run that fit into a node
+    holding the size sorted keys without it growing past limit entries, and
+    the size the node ends up with. Entries with keys it holds take no room.
+*/
+template <typename key_type, typename E>
+std::pair<size_t, size_t> fitting(const key_type *keys, size_t size,
+                                  std::span<E> run, size_t limit) {
+    size_t total = size;
+    size_t j = 0;
+    size_t i = 0;
+    for (; i < run.size(); ++i) {
+        while (j < size && keys[j] < run[i].first) {
+            ++j;
+        }
+        if (j < size && keys[j] == run[i].first) {
+            continue;
+        }
+        if (total >= limit) {
+            break;
+        }
+        ++total;
+    }
+    return {i, total};
+}
+
+/*
+    Merges the sorted run into the size sorted entries of keys and values in
+    a single pass from the back, where entries of run replace those with the
+    same key. total is the size that leaves, as counted by fitting.
+*/
+template <typename key_type, typename value_type, typename E>
+void merge(key_type *keys, value_type *values, size_t size, std::span<E> run,
+           size_t total) {
+    size_t i = size;
+    size_t r = run.size();
+    size_t w = total;
+    while (r > 0) {
+        --w;
+        if (i > 0 && run[r - 1].first < keys[i - 1]) {
+            --i;
+            keys[w] = keys[i];
+            values[w] = values[i];
+            continue;
+        }
+        if (i > 0 && keys[i - 1] == run[r - 1].first) {
+            --i;
+        }
+        --r;
+        keys[w] = run[r].first;
+        values[w] = run[r].second;
+    }
+}
+
+/*
+    Merges the sorted run into leaf like merge, but lays the total entries
+    out evenly over leaf and as few new leaves after it as can hold them.
+    Returns the ids of the new leaves, which are linked in after leaf; the
+    prev link of the leaf that used to follow it is left to the caller.
+*/
+template <typename node_t, typename BlockManager, typename E>
+auto spread(BlockManager &manager, node_t &leaf, std::span<E> run,
+            size_t total) {
+    using node_id_t = std::remove_pointer_t<decltype(node_t::children)>;
+    using key_type = std::remove_pointer_t<decltype(node_t::keys)>;
+    using value_type = std::remove_pointer_t<decltype(node_t::values)>;
+
+    std::vector<key_type> keys(total);
+    std::vector<value_type> values(total);
+    std::copy_n(leaf.keys, leaf.info->size, keys.begin());
+    std::copy_n(leaf.values, leaf.info->size, values.begin());
+    merge(keys.data(), values.data(), leaf.info->size, run, total);
+    const size_t count =
+        (total + node_t::leaf_capacity - 1) / node_t::leaf_capacity;
+    std::vector<node_id_t> ids;
+    ids.reserve(count - 1);
+    manager.mark_dirty(leaf.info->id);
+    node_t node = leaf;
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            const node_id_t id = manager.allocate();
+            node_t next(manager.open_block(id), LEAF);
+            manager.mark_dirty(id);
+            next.info->id = id;
+            next.info->prev_id = node.info->id;
+            next.info->next_id = node.info->next_id;
+            node.info->next_id = id;
+            ids.push_back(id);
+            node = next;
+        }
+        const size_t first = i * total / count;
+        const size_t last = (i + 1) * total / count;
+        node.info->size = last - first;
+        std::memcpy(node.keys, keys.data() + first,
+                    (last - first) * sizeof(key_type));
+        std::memcpy(node.values, values.data() + first,
+                    (last - first) * sizeof(value_type));
+    }
+    return ids;
+}
+
+}  // namespace utils::bulk
@@ -12,6 +12,7 @@ struct Config {
     unsigned mixed_writes_perc = 0;
     unsigned mixed_reads_perc = 0;
     unsigned updates_perc = 0;
+    unsigned deletes_perc = 0;
     unsigned short_range = 0;
     unsigned mid_range = 0;
     unsigned long_range = 0;
@@ -19,6 +20,14 @@ struct Config {
     unsigned repeat = 1;
     unsigned seed = 1234;
     unsigned num_threads = 1;
+    // raw reads go through multi_get in batches of this many keys, 0 for get
+    unsigned multi_get_batch = 0;
+    // sorted preloads are bulk loaded with nodes this full in percent, 0 for
+    // inserts
+    unsigned bulk_load_fill = 0;
+    // preloads and raw writes go through insert_batch in batches of this
+    // many keys, 0 for insert
+    unsigned insert_batch = 0;
     std::string results_csv = "results.csv";
     std::string results_log = "results.log";
     bool binary_input = true;
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace epoch {
+// threads that may use a domain at the same time
+constexpr size_t MAX_THREADS = 256;
+
+/*
+    Small, dense index of the calling thread. Indices of threads that
+    exited are handed out again, so per-thread state indexed by them stays
+    bounded when threads come and go between runs.
+*/
+class thread_slot {
+    static std::mutex &pool_mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::vector<size_t> &pool() {
+        static std::vector<size_t> ids;
+        return ids;
+    }
+
+    static std::atomic<size_t> &next() {
+        static std::atomic<size_t> n{};
+        return n;
+    }
+
+    size_t id;
+
+    thread_slot() {
+        std::lock_guard lock(pool_mutex());
+        if (!pool().empty()) {
+            id = pool().back();
+            pool().pop_back();
+            return;
+        }
+        id = next().fetch_add(1, std::memory_order_relaxed);
+        if (id >= MAX_THREADS) {
+            throw std::length_error("epoch: too many threads");
+        }
+    }
+
+    ~thread_slot() {
+        std::lock_guard lock(pool_mutex());
+        pool().push_back(id);
+    }
+
+   public:
+    static size_t get() {
+        static thread_local thread_slot slot;
+        return slot.id;
+    }
+
+    // upper bound of the indices handed out so far
+    static size_t used() {
+        return std::min(next().load(std::memory_order_acquire), MAX_THREADS);
+    }
+};
+
+/*
+    Epoch-based reclamation. A thread announces the global epoch while it is
+    inside a domain (between enter() and exit(), or for the lifetime of a
+    guard) and 0 otherwise. The global epoch only moves on once every
+    thread inside has announced it, so something unlinked from a shared
+    structure by a thread inside, and stamped with current() afterwards,
+    cannot be reached by anyone once safe(stamp) holds. Entering nests,
+    only the outermost enter() announces an epoch.
+*/
+class domain {
+    struct alignas(64) participant {
+        std::atomic<uint64_t> epoch{};
+        uint32_t depth = 0;
+    };
+
+    std::atomic<uint64_t> global{1};
+    std::unique_ptr<participant[]> participants{new participant[MAX_THREADS]};
+
+   public:
+    class guard {
+        domain &d;
+
+       public:
+        explicit guard(domain &d) : d(d) { d.enter(); }
+        guard(const guard &) = delete;
+        guard &operator=(const guard &) = delete;
+        ~guard() { d.exit(); }
+    };
+
+    void enter() {
+        participant &p = participants[thread_slot::get()];
+        if (p.depth++ == 0) {
+            p.epoch.store(global.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+            // the announcement has to be visible before we read any node
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void exit() {
+        participant &p = participants[thread_slot::get()];
+        if (--p.depth == 0) {
+            p.epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    uint64_t current() const { return global.load(std::memory_order_relaxed); }
+
+    bool safe(const uint64_t stamp) const { return stamp + 2 <= current(); }
+
+    // moves the global epoch on if all threads inside have caught up with it
+    void try_advance() {
+        uint64_t g = global.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const size_t used = thread_slot::used();
+        for (size_t i = 0; i < used; ++i) {
+            const uint64_t e =
+                participants[i].epoch.load(std::memory_order_relaxed);
+            if (e != 0 && e != g) {
+                return;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        global.compare_exchange_strong(g, g + 1, std::memory_order_release,
+                                       std::memory_order_relaxed);
+    }
+};
+}  // namespace epoch
@@ -4,15 +4,24 @@
 #include <cstring>
 
 namespace IKR {
+// widening of max_distance over the key range of the leaf
+constexpr double max_distance_factor = 1.5;
+// bound of lower_bound and upper_bound for a sorted stream
+constexpr double sorted_bound = .7;
+
 size_t max_distance(size_t dq, uint16_t n1, uint16_t n2) {
-    return (dq + dq / 2) * n2 / n1;
+    return static_cast<size_t>(dq * max_distance_factor) * n2 / n1;
 }
 
-size_t lower_bound(size_t dq, uint16_t n1, uint16_t n2) {
-    return (dq * .7) * n2 / n1;
+// trees that estimate the sortedness of their inserts lower the bound as
+// the stream gets more scrambled
+size_t lower_bound(size_t dq, uint16_t n1, uint16_t n2,
+                   double bound = sorted_bound) {
+    return (dq * bound) * n2 / n1;
 }
 
-size_t upper_bound(size_t dq, uint16_t n1, uint16_t n2) {
-    return (dq / .7) * n2 / n1;
+size_t upper_bound(size_t dq, uint16_t n1, uint16_t n2,
+                   double bound = sorted_bound) {
+    return (dq / bound) * n2 / n1;
 }
 }  // namespace IKR
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include "arena.hpp"
+
+/*
+    Maps node ids to their latches. latch_table keeps the latches in a side
+    table indexed by id; embedded_latch_table uses the latch in the header of
+    the node itself, so latching a node also brings its header into cache.
+*/
+template <typename latch_t, typename BlockManager>
+class latch_table {
+    arena::lazy_array<latch_t> latches;
+
+   public:
+    explicit latch_table(BlockManager &m) : latches(m.get_capacity()) {}
+
+    latch_t &operator[](const size_t id) const { return latches[id]; }
+
+    void prefetch(const size_t id) const { __builtin_prefetch(&latches[id]); }
+
+    // called after a latched node was copied into the block of id
+    void reset(size_t) {}
+};
+
+template <typename node_t, typename BlockManager>
+class embedded_latch_table {
+    using node_info_t = decltype(node_t::info);
+    using latch_t = decltype(node_info_t{}->latch);
+
+    // nodes are never constructed, so all-zero must be an unlocked latch
+    static_assert(arena::zero_initialized<latch_t>::value);
+
+    BlockManager &manager;
+
+   public:
+    explicit embedded_latch_table(BlockManager &m) : manager(m) {}
+
+    latch_t &operator[](const size_t id) const {
+        return static_cast<node_info_t>(manager.open_block(id))->latch;
+    }
+
+    // the latch shares its cache line with the header of the node
+    void prefetch(const size_t) const {}
+
+    // called after a latched node was copied into the block of id
+    void reset(const size_t id) { new (&(*this)[id]) latch_t(); }
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+namespace utils::lookup {
+
+/*
+    Lookups a multi_get takes down the tree together. Each of them prefetches
+    the child it moves to and only reads it one round later, once the others
+    issued theirs, so the group should be about as large as the misses a core
+    keeps in flight.
+*/
+static constexpr size_t group_size = 16;
+
+}  // namespace utils::lookup
@@ -9,6 +9,8 @@
 #include <shared_mutex>
 #include <thread>
 
+#include "arena.hpp"
+
 namespace atm {
 class shared_mutex {
     using numeric_type = uint32_t;
@@ -32,6 +34,13 @@ class shared_mutex {
         }
     }
 
+    bool try_lock_shared() {
+        numeric_type expected = state.load(std::memory_order_acquire);
+        return expected != LOCKED &&
+               state.compare_exchange_strong(expected, expected + 1,
+                                             std::memory_order_acquire);
+    }
+
     void unlock_shared() { state.fetch_sub(1, std::memory_order_release); }
 
     void lock() {
@@ -47,6 +56,12 @@ class shared_mutex {
         }
     }
 
+    bool try_lock() {
+        numeric_type expected = 0;
+        return state.compare_exchange_strong(expected, LOCKED,
+                                             std::memory_order_acquire);
+    }
+
     void unlock() { state.store(0, std::memory_order_release); }
 };
 
@@ -65,6 +80,101 @@ class mutex {
 };
 }  // namespace atm
 
+namespace olc {
+/*
+    atm::shared_mutex extended with a version counter for optimistic lock
+    coupling. The version is odd while the latch is held exclusively, so an
+    optimistic reader that observes the same even version before and after
+    reading a node has seen a consistent node. Shared holders do not change
+    the version: they must not modify the node.
+*/
+class shared_mutex {
+    using numeric_type = uint32_t;
+    static constexpr auto LOCKED = std::numeric_limits<numeric_type>::max();
+
+    std::atomic<numeric_type> state{0};
+    std::atomic<numeric_type> version{0};
+
+    void begin_write() {
+        version.store(version.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+   public:
+    void lock_shared() {
+        while (true) {
+            numeric_type expected = state.load(std::memory_order_acquire);
+            if (expected != LOCKED &&
+                state.compare_exchange_weak(expected, expected + 1,
+                                            std::memory_order_acquire)) {
+                break;
+            }
+#ifdef YIELD
+            std::this_thread::yield();
+#endif
+        }
+    }
+
+    bool try_lock_shared() {
+        numeric_type expected = state.load(std::memory_order_acquire);
+        return expected != LOCKED &&
+               state.compare_exchange_strong(expected, expected + 1,
+                                             std::memory_order_acquire);
+    }
+
+    void unlock_shared() { state.fetch_sub(1, std::memory_order_release); }
+
+    void lock() {
+        while (true) {
+            numeric_type expected = 0;
+            if (state.compare_exchange_weak(expected, LOCKED,
+                                            std::memory_order_acquire)) {
+                break;
+            }
+#ifdef YIELD
+            std::this_thread::yield();
+#endif
+        }
+        begin_write();
+    }
+
+    bool try_lock() {
+        numeric_type expected = 0;
+        if (!state.compare_exchange_strong(expected, LOCKED,
+                                           std::memory_order_acquire)) {
+            return false;
+        }
+        begin_write();
+        return true;
+    }
+
+    void unlock() {
+        version.store(version.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+        state.store(0, std::memory_order_release);
+    }
+
+    // waits until no writer holds the latch, returns the version to validate
+    numeric_type read_lock() const {
+        while (true) {
+            const numeric_type v = version.load(std::memory_order_acquire);
+            if (!(v & 1)) {
+                return v;
+            }
+#ifdef YIELD
+            std::this_thread::yield();
+#endif
+        }
+    }
+
+    bool validate(numeric_type v) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version.load(std::memory_order_relaxed) == v;
+    }
+};
+}  // namespace olc
+
 namespace srv {
 class shared_mutex {
     using numeric_type = unsigned;
@@ -90,6 +200,14 @@ class shared_mutex {
         }
     }
 
+    bool try_lock_shared() {
+        numeric_type expected = active_reads.load(std::memory_order_acquire);
+        return expected != LOCKED &&
+               pending_writes.load(std::memory_order_acquire) == 0 &&
+               active_reads.compare_exchange_strong(expected, expected + 1,
+                                                    std::memory_order_acquire);
+    }
+
     void unlock_shared() {
         active_reads.fetch_sub(1, std::memory_order_release);
     }
@@ -109,6 +227,12 @@ class shared_mutex {
         pending_writes.fetch_sub(1, std::memory_order_release);
     }
 
+    bool try_lock() {
+        numeric_type expected = 0;
+        return active_reads.compare_exchange_strong(expected, LOCKED,
+                                                    std::memory_order_acquire);
+    }
+
     void unlock() { active_reads.store(0, std::memory_order_release); }
 };
 }  // namespace srv
@@ -125,6 +249,8 @@ class shared_mutex {
         }
     }
 
+    bool try_lock_shared() { return try_lock(); }
+
     void unlock_shared() { _lock.clear(std::memory_order_release); }
 
     void lock() {
@@ -134,6 +260,8 @@ class shared_mutex {
         }
     }
 
+    bool try_lock() { return !_lock.test_and_set(std::memory_order_acquire); }
+
     void unlock() { _lock.clear(std::memory_order_release); }
 };
 }  // namespace flg
@@ -152,6 +280,8 @@ class shared_mutex {
         };
     }
 
+    bool try_lock() { return pthread_spin_trylock(&lk) == 0; }
+
     void unlock() { pthread_spin_unlock(&lk); }
 
     void lock_shared() {
@@ -159,6 +289,8 @@ class shared_mutex {
         };
     }
 
+    bool try_lock_shared() { return try_lock(); }
+
     void unlock_shared() { pthread_spin_unlock(&lk); }
 };
 }  // namespace spn
@@ -172,10 +304,14 @@ class shared_mutex {
 
     void lock() { pthread_rwlock_wrlock(&lk); }
 
+    bool try_lock() { return pthread_rwlock_trywrlock(&lk) == 0; }
+
     void unlock() { pthread_rwlock_unlock(&lk); }
 
     void lock_shared() { pthread_rwlock_rdlock(&lk); }
 
+    bool try_lock_shared() { return pthread_rwlock_tryrdlock(&lk) == 0; }
+
     void unlock_shared() { pthread_rwlock_unlock(&lk); }
 };
 }  // namespace rwl
@@ -187,10 +323,216 @@ class shared_mutex {
    public:
     void lock() { mtx.lock(); }
 
+    bool try_lock() { return mtx.try_lock(); }
+
     void unlock() { mtx.unlock(); }
 
     void lock_shared() { mtx.lock(); }
 
+    bool try_lock_shared() { return mtx.try_lock(); }
+
     void unlock_shared() { mtx.unlock(); }
 };
 }  // namespace mtx
+
+namespace mcs {
+/*
+    Reader-writer latch with an MCS queue of waiters. An uncontended latch
+    is taken with a single CAS on the state word as in atm. Otherwise the
+    thread joins a FIFO queue and spins on its own queue node; only the head
+    of the queue polls the state word. The head leaves the queue as soon as
+    it holds the latch, so a thread needs a single, thread-local queue node
+    no matter how many latches it holds. Consecutive readers at the head are
+    admitted together. Waiters yield after SPINS polls, otherwise a FIFO
+    queue convoys behind waiters that are not running once threads outnumber
+    cores.
+*/
+class shared_mutex {
+    using numeric_type = uint32_t;
+    static constexpr auto LOCKED = std::numeric_limits<numeric_type>::max();
+    static constexpr unsigned SPINS = 1024;
+
+    struct qnode {
+        std::atomic<qnode *> next;
+        std::atomic<bool> waiting;
+    };
+
+    std::atomic<numeric_type> state{0};
+    std::atomic<qnode *> tail{nullptr};
+
+    static qnode &local_node() {
+        static thread_local qnode node;
+        return node;
+    }
+
+    static void pause(unsigned &spins) {
+        if (++spins == SPINS) {
+            spins = 0;
+            std::this_thread::yield();
+        }
+    }
+
+    template <typename F>
+    void acquire(F &&try_acquire) {
+        // waiters are not overtaken by newcomers
+        if (tail.load(std::memory_order_relaxed) == nullptr && try_acquire()) {
+            return;
+        }
+        qnode &node = local_node();
+        node.next.store(nullptr, std::memory_order_relaxed);
+        node.waiting.store(true, std::memory_order_relaxed);
+        qnode *prev = tail.exchange(&node, std::memory_order_acq_rel);
+        unsigned spins = 0;
+        if (prev) {
+            prev->next.store(&node, std::memory_order_release);
+            while (node.waiting.load(std::memory_order_acquire)) {
+                pause(spins);
+            }
+        }
+        while (!try_acquire()) {
+            pause(spins);
+        }
+        // leave the queue, the next waiter becomes its head
+        qnode *expected = &node;
+        if (!tail.compare_exchange_strong(expected, nullptr,
+                                          std::memory_order_acq_rel)) {
+            qnode *next;
+            while (!(next = node.next.load(std::memory_order_acquire))) {
+                pause(spins);
+            }
+            next->waiting.store(false, std::memory_order_release);
+        }
+    }
+
+    bool acquire_shared() {
+        numeric_type expected = state.load(std::memory_order_acquire);
+        return expected != LOCKED &&
+               state.compare_exchange_weak(expected, expected + 1,
+                                           std::memory_order_acquire);
+    }
+
+    bool acquire_exclusive() {
+        numeric_type expected = 0;
+        return state.compare_exchange_weak(expected, LOCKED,
+                                           std::memory_order_acquire);
+    }
+
+   public:
+    void lock_shared() { acquire([this] { return acquire_shared(); }); }
+
+    bool try_lock_shared() {
+        return tail.load(std::memory_order_relaxed) == nullptr &&
+               acquire_shared();
+    }
+
+    void unlock_shared() { state.fetch_sub(1, std::memory_order_release); }
+
+    void lock() { acquire([this] { return acquire_exclusive(); }); }
+
+    bool try_lock() {
+        return tail.load(std::memory_order_relaxed) == nullptr &&
+               acquire_exclusive();
+    }
+
+    void unlock() { state.store(0, std::memory_order_release); }
+};
+}  // namespace mcs
+
+namespace ftx {
+/*
+    Reader-writer latch that spins for a bounded number of attempts and then
+    parks on the state word through std::atomic::wait, a futex on Linux.
+    Spinning keeps hand-overs cheap on dedicated cores, while parking stops
+    waiters from burning the time slices of the holder once threads
+    outnumber cores. PARKED tells the releasing thread that it has to wake
+    the parked threads.
+*/
+class shared_mutex {
+    using numeric_type = uint32_t;
+    static constexpr numeric_type WRITER = numeric_type{1} << 31;
+    static constexpr numeric_type PARKED = numeric_type{1} << 30;
+    static constexpr unsigned SPINS = 128;
+
+    std::atomic<numeric_type> state{0};
+
+    template <typename F, typename G>
+    void acquire(F &&try_acquire, G &&blocked) {
+        for (unsigned i = 0; i < SPINS; ++i) {
+            if (try_acquire()) {
+                return;
+            }
+        }
+        while (!try_acquire()) {
+            numeric_type expected = state.load(std::memory_order_relaxed);
+            if (!blocked(expected)) {
+                continue;
+            }
+            if (!(expected & PARKED) &&
+                !state.compare_exchange_weak(expected, expected | PARKED,
+                                             std::memory_order_relaxed)) {
+                continue;
+            }
+            state.wait(expected | PARKED, std::memory_order_relaxed);
+        }
+    }
+
+    static bool writer(numeric_type s) { return s & WRITER; }
+
+    static bool taken(numeric_type s) { return s & ~PARKED; }
+
+   public:
+    void lock_shared() {
+        acquire([this] { return try_lock_shared(); }, writer);
+    }
+
+    bool try_lock_shared() {
+        numeric_type expected = state.load(std::memory_order_relaxed);
+        return !writer(expected) &&
+               state.compare_exchange_weak(expected, expected + 1,
+                                           std::memory_order_acquire);
+    }
+
+    void unlock_shared() {
+        numeric_type expected = PARKED;
+        if (state.fetch_sub(1, std::memory_order_release) == (PARKED | 1) &&
+            state.compare_exchange_strong(expected, 0,
+                                          std::memory_order_relaxed)) {
+            state.notify_all();
+        }
+    }
+
+    void lock() { acquire([this] { return try_lock(); }, taken); }
+
+    bool try_lock() {
+        numeric_type expected = state.load(std::memory_order_relaxed);
+        return !taken(expected) &&
+               state.compare_exchange_weak(expected, expected | WRITER,
+                                           std::memory_order_acquire);
+    }
+
+    void unlock() {
+        if (state.exchange(0, std::memory_order_release) & PARKED) {
+            state.notify_all();
+        }
+    }
+};
+}  // namespace ftx
+
+// the atomic latches are unlocked when all their fields are zero
+template <>
+struct arena::zero_initialized<atm::shared_mutex> : std::true_type {};
+template <>
+struct arena::zero_initialized<olc::shared_mutex> : std::true_type {};
+template <>
+struct arena::zero_initialized<srv::shared_mutex> : std::true_type {};
+template <>
+struct arena::zero_initialized<mcs::shared_mutex> : std::true_type {};
+template <>
+struct arena::zero_initialized<ftx::shared_mutex> : std::true_type {};
+
+#if defined(__GLIBC__) && defined(_GLIBCXX_USE_PTHREAD_RWLOCK_T)
+// libstdc++ wraps a pthread_rwlock_t, and glibc's PTHREAD_RWLOCK_INITIALIZER
+// is all zeros; pthread_rwlock_destroy does not release anything
+template <>
+struct arena::zero_initialized<std::shared_mutex> : std::true_type {};
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+
+#include "BTreeNode.hpp"
+
+namespace utils::order {
+
+/*
+    Order statistics over the per-child counts of counted nodes, see
+    BTreeNode. Changes to a tree call adjust() for the entries they add or
+    remove before they move entries between nodes, which then only fix the
+    counts of the nodes they touched. All of it compiles to nothing for nodes
+    without counts.
+*/
+
+// adds delta to the counts on the way from root_id down to the leaf of key
+template <typename node_t, typename BlockManager, typename node_id_t,
+          typename key_type>
+void adjust(BlockManager &manager, node_id_t root_id, const key_type &key,
+            std::ptrdiff_t delta) {
+    if constexpr (node_t::counted) {
+        node_id_t node_id = root_id;
+        node_t node(manager.open_block(node_id));
+        while (node.info->type == bp_node_type::INTERNAL) {
+            const uint16_t slot = node.child_slot(key);
+            manager.mark_dirty(node_id);
+            node.counts()[slot] += delta;
+            node_id = node.children[slot];
+            node.load(manager.open_block(node_id));
+        }
+    }
+}
+
+// sets the count of children[slot] of the internal node from the child
+template <typename node_t, typename BlockManager>
+void recount(BlockManager &manager, const node_t &node, uint16_t slot) {
+    if constexpr (node_t::counted) {
+        node.counts()[slot] =
+            node_t(manager.open_block(node.children[slot])).entries();
+    }
+}
+
+// sets all counts of the internal node from its children
+template <typename node_t, typename BlockManager>
+void recount(BlockManager &manager, const node_t &node) {
+    for (uint16_t slot = 0; slot <= node.info->size; ++slot) {
+        recount(manager, node, slot);
+    }
+}
+
+/*
+    Fixes the counts of the internal node after children[index] was split
+    and the new node inserted right after it, the other children moved up.
+*/
+template <typename node_t, typename BlockManager>
+void split(BlockManager &manager, const node_t &node, uint16_t index) {
+    if constexpr (node_t::counted) {
+        std::memmove(node.counts() + index + 2, node.counts() + index + 1,
+                     (node.info->size - index - 1) * sizeof(*node.counts()));
+        recount(manager, node, index);
+        recount(manager, node, index + 1);
+    }
+}
+
+// number of keys below key in the tree under root_id
+template <typename node_t, typename BlockManager, typename node_id_t,
+          typename key_type>
+size_t rank(BlockManager &manager, node_id_t root_id, const key_type &key) {
+    size_t rank = 0;
+    node_t node(manager.open_block(root_id));
+    while (node.info->type == bp_node_type::INTERNAL) {
+        const uint16_t slot = node.child_slot(key);
+        rank = std::accumulate(node.counts(), node.counts() + slot, rank);
+        node.load(manager.open_block(node.children[slot]));
+    }
+    return rank + node.value_slot(key);
+}
+
+/*
+    Loads the leaf with the entry that has position keys below it in the
+    tree under root_id into leaf and returns its index there. position must
+    be below the size of the tree.
+*/
+template <typename node_t, typename BlockManager, typename node_id_t>
+uint16_t select(BlockManager &manager, node_id_t root_id, size_t position,
+                node_t &leaf) {
+    leaf.load(manager.open_block(root_id));
+    while (leaf.info->type == bp_node_type::INTERNAL) {
+        uint16_t slot = 0;
+        while (slot < leaf.info->size && position >= leaf.counts()[slot]) {
+            position -= leaf.counts()[slot];
+            ++slot;
+        }
+        leaf.load(manager.open_block(leaf.children[slot]));
+    }
+    return position;
+}
+
+}  // namespace utils::order
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "search.hpp"
+#include "sort.hpp"
+
+namespace utils::scan {
+
+/*
+    Entries a concurrent scan copies out of a leaf, so that the leaf's latch
+    can be dropped before they are handed to the caller.
+*/
+template <typename key_type, typename value_type, uint16_t capacity>
+struct batch {
+    key_type keys[capacity];
+    value_type values[capacity];
+    uint16_t begin = 0;
+    uint16_t end = 0;
+
+    /*
+        Copies the first n entries of a leaf. Unless sorted they are sorted,
+        and only the last write of a key that was appended again is kept.
+    */
+    void copy(const key_type *leaf_keys, const value_type *leaf_values,
+              uint16_t n, bool sorted) {
+        std::memcpy(keys, leaf_keys, n * sizeof(key_type));
+        std::memcpy(values, leaf_values, n * sizeof(value_type));
+        begin = 0;
+        end = n;
+        if (!sorted) {
+            end = utils::sort::leaf_unique<capacity>(keys, values, n);
+        }
+    }
+
+    // skips the entries below bound, or up to bound if after is set
+    void seek(const key_type &bound, bool after) {
+        begin = after ? utils::search::upper_bound(keys, end, bound)
+                      : utils::search::lower_bound(keys, end, bound);
+    }
+
+    // keeps the entries up to bound, or below bound if after is set
+    void seek_back(const key_type &bound, bool after) {
+        begin = 0;
+        end = after ? utils::search::lower_bound(keys, end, bound)
+                    : utils::search::upper_bound(keys, end, bound);
+    }
+
+    bool empty() const { return begin == end; }
+
+    const key_type &first() const { return keys[begin]; }
+
+    const key_type &last() const { return keys[end - 1]; }
+
+    template <typename F>
+    bool emit(F &f) const {
+        const size_t n = end - begin;
+        return f(std::span<const key_type>(keys + begin, n),
+                 std::span<const value_type>(values + begin, n));
+    }
+};
+
+// next moves on to the following leaf in the direction of the scan
+enum class step { descend, reread, next };
+
+/*
+    Where a scan goes on after it emitted the keys of a leaf up to bound and
+    latched the leaf again. A leaf that was merged away (its size is set to
+    0) or that lost its smallest keys to its left sibling may no longer hold
+    the keys after bound, they have to be found from the root again.
+    Otherwise they are in the leaf, if it got larger keys meanwhile, or to
+    its right. keys may only be unsorted if sorted is false.
+*/
+template <typename key_type>
+step resume(const key_type *keys, uint16_t n, const key_type &bound,
+            bool sorted) {
+    if (n == 0) {
+        return step::descend;
+    }
+    if (sorted) {
+        if (bound < keys[0]) {
+            return step::descend;
+        }
+        return bound < keys[n - 1] ? step::reread : step::next;
+    }
+    const auto [min, max] = std::minmax_element(keys, keys + n);
+    if (bound < *min) {
+        return step::descend;
+    }
+    return bound < *max ? step::reread : step::next;
+}
+
+/*
+    resume for a reverse scan, which emitted the keys of a leaf from bound
+    on. Keys below bound stay in the leaf or to its left unless it was
+    merged away; the leaf has to be read again if it got some meanwhile.
+*/
+template <typename key_type>
+step resume_back(const key_type *keys, uint16_t n, const key_type &bound,
+                 bool sorted) {
+    if (n == 0) {
+        return step::descend;
+    }
+    const key_type &min = sorted ? keys[0] : *std::min_element(keys, keys + n);
+    return min < bound ? step::reread : step::next;
+}
+
+}  // namespace utils::scan
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace utils::search {
+
+#if defined(__AVX512F__)
+static constexpr const char *kernel = "avx512";
+static constexpr size_t vector_bytes = 64;
+#elif defined(__AVX2__)
+static constexpr const char *kernel = "avx2";
+static constexpr size_t vector_bytes = 32;
+#else
+static constexpr const char *kernel = "scalar";
+static constexpr size_t vector_bytes = 0;
+#endif
+
+template <typename key_type>
+static constexpr bool vectorized =
+    vector_bytes > 0 &&
+    (std::is_same_v<key_type, uint32_t> || std::is_same_v<key_type, uint64_t>);
+
+// The binary search stops once the candidate range fits in two vector
+// registers; the remaining keys are resolved with a single counting pass.
+template <typename key_type>
+static constexpr uint16_t window =
+    vectorized<key_type> ? 2 * vector_bytes / sizeof(key_type) : 1;
+
+/*
+    Counts the keys in [keys, keys + n) that are less than (or, for upper,
+    less than or equal to) key. Only the first n keys are ever loaded.
+*/
+template <bool upper, typename key_type>
+uint16_t count_scalar(const key_type *keys, uint16_t n, const key_type &key) {
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < n; ++i) {
+        if constexpr (upper) {
+            count += !(key < keys[i]);
+        } else {
+            count += keys[i] < key;
+        }
+    }
+    return count;
+}
+
+#if defined(__AVX512F__)
+template <bool upper, typename key_type>
+uint16_t count_vector(const key_type *keys, uint16_t n, const key_type &key) {
+    uint16_t count = 0;
+    if constexpr (sizeof(key_type) == 4) {
+        const __m512i needle = _mm512_set1_epi32(key);
+        for (uint16_t i = 0; i < n; i += 16) {
+            const __mmask16 live =
+                n - i >= 16 ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+            const __m512i v = _mm512_maskz_loadu_epi32(live, keys + i);
+            __mmask16 hits;
+            if constexpr (upper) {
+                hits = _mm512_mask_cmple_epu32_mask(live, v, needle);
+            } else {
+                hits = _mm512_mask_cmplt_epu32_mask(live, v, needle);
+            }
+            count += std::popcount((uint32_t)hits);
+        }
+    } else {
+        const __m512i needle = _mm512_set1_epi64(key);
+        for (uint16_t i = 0; i < n; i += 8) {
+            const __mmask8 live =
+                n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+            const __m512i v = _mm512_maskz_loadu_epi64(live, keys + i);
+            __mmask8 hits;
+            if constexpr (upper) {
+                hits = _mm512_mask_cmple_epu64_mask(live, v, needle);
+            } else {
+                hits = _mm512_mask_cmplt_epu64_mask(live, v, needle);
+            }
+            count += std::popcount((uint32_t)hits);
+        }
+    }
+    return count;
+}
+#elif defined(__AVX2__)
+template <bool upper, typename key_type>
+uint16_t count_vector(const key_type *keys, uint16_t n, const key_type &key) {
+    // AVX2 only has signed compares, flip the sign bit of both operands
+    constexpr uint16_t lanes = 32 / sizeof(key_type);
+    uint16_t count = 0;
+    uint16_t i = 0;
+    if constexpr (sizeof(key_type) == 4) {
+        const __m256i flip = _mm256_set1_epi32(INT32_MIN);
+        const __m256i needle =
+            _mm256_xor_si256(_mm256_set1_epi32(key), flip);
+        for (; i + lanes <= n; i += lanes) {
+            const __m256i v = _mm256_xor_si256(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)),
+                flip);
+            // upper: key >= v <=> !(v > key), lower: v < key <=> key > v
+            const __m256i gt = upper ? _mm256_cmpgt_epi32(v, needle)
+                                     : _mm256_cmpgt_epi32(needle, v);
+            const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(gt));
+            count += upper ? lanes - std::popcount((uint32_t)mask)
+                           : std::popcount((uint32_t)mask);
+        }
+    } else {
+        const __m256i flip = _mm256_set1_epi64x(INT64_MIN);
+        const __m256i needle =
+            _mm256_xor_si256(_mm256_set1_epi64x(key), flip);
+        for (; i + lanes <= n; i += lanes) {
+            const __m256i v = _mm256_xor_si256(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)),
+                flip);
+            const __m256i gt = upper ? _mm256_cmpgt_epi64(v, needle)
+                                     : _mm256_cmpgt_epi64(needle, v);
+            const int mask = _mm256_movemask_pd(_mm256_castsi256_pd(gt));
+            count += upper ? lanes - std::popcount((uint32_t)mask)
+                           : std::popcount((uint32_t)mask);
+        }
+    }
+    return count + count_scalar<upper>(keys + i, n - i, key);
+}
+#endif
+
+/*
+    Branchless search: the comparison only selects the next base, so the
+    compiler emits a cmov instead of an unpredictable branch. Returns the
+    first position whose key is not less than (upper: greater than) key.
+*/
+template <bool upper, typename key_type>
+uint16_t bound_scalar(const key_type *keys, uint16_t n, const key_type &key) {
+    const key_type *base = keys;
+    while (n > 1) {
+        const uint16_t half = n / 2;
+        if constexpr (upper) {
+            base = key < base[half] ? base : base + half;
+        } else {
+            base = base[half] < key ? base + half : base;
+        }
+        n -= half;
+    }
+    if (n == 1) {
+        if constexpr (upper) {
+            base += !(key < *base);
+        } else {
+            base += *base < key;
+        }
+    }
+    return base - keys;
+}
+
+template <bool upper, typename key_type>
+uint16_t bound(const key_type *keys, uint16_t n, const key_type &key) {
+    if constexpr (vectorized<key_type>) {
+        const key_type *base = keys;
+        while (n > window<key_type>) {
+            const uint16_t half = n / 2;
+            if constexpr (upper) {
+                base = key < base[half] ? base : base + half;
+            } else {
+                base = base[half] < key ? base + half : base;
+            }
+            n -= half;
+        }
+        return (base - keys) + count_vector<upper>(base, n, key);
+    } else {
+        return bound_scalar<upper>(keys, n, key);
+    }
+}
+
+template <typename key_type>
+uint16_t lower_bound(const key_type *keys, uint16_t n, const key_type &key) {
+    return bound<false>(keys, n, key);
+}
+
+template <typename key_type>
+uint16_t upper_bound(const key_type *keys, uint16_t n, const key_type &key) {
+    return bound<true>(keys, n, key);
+}
+
+/*
+    One byte fingerprint of key for the unsorted part of a leaf. The hash is
+    spread by a multiplicative step so integer keys do not all share their
+    low byte.
+*/
+template <typename key_type>
+uint8_t tag(const key_type &key) {
+    return (std::hash<key_type>{}(key) * 0x9E3779B97F4A7C15ull) >> 56;
+}
+
+/*
+    Position of key in the unordered keys [keys, keys + n), or n. tags[i] is
+    tag(keys[i]); the tags are compared a vector at a time and only keys
+    behind a matching tag are read.
+*/
+template <typename key_type>
+uint16_t find_tagged(const uint8_t *tags, const key_type *keys, uint16_t n,
+                     const key_type &key) {
+    const uint8_t needle = tag(key);
+    uint16_t i = 0;
+#if defined(__AVX512BW__)
+    const __m512i probe = _mm512_set1_epi8(needle);
+    for (; i < n; i += 64) {
+        const __mmask64 live =
+            n - i >= 64 ? ~0ull : (__mmask64)((1ull << (n - i)) - 1);
+        uint64_t hits = _mm512_mask_cmpeq_epi8_mask(
+            live, _mm512_maskz_loadu_epi8(live, tags + i), probe);
+        for (; hits != 0; hits &= hits - 1) {
+            const uint16_t j = i + std::countr_zero(hits);
+            if (keys[j] == key) {
+                return j;
+            }
+        }
+    }
+    return n;
+#elif defined(__AVX2__)
+    const __m256i probe = _mm256_set1_epi8(needle);
+    for (; i + 32 <= n; i += 32) {
+        uint32_t hits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i)),
+            probe));
+        for (; hits != 0; hits &= hits - 1) {
+            const uint16_t j = i + std::countr_zero(hits);
+            if (keys[j] == key) {
+                return j;
+            }
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (tags[i] == needle && keys[i] == key) {
+            return i;
+        }
+    }
+    return n;
+}
+
+}  // namespace utils::search
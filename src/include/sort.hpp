@@ -1,5 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
 namespace utils::sort {
 
 template <typename key_type, typename value_type>
@@ -42,12 +50,23 @@ int partition(key_type *keys, value_type *values, int left, int right) {
     int mid = left + (right - left) / 2;
 
     // Median-of-three pivot selection - helps with nearly sorted data.
-    if (keys[mid] < keys[left]) std::swap(keys[left], keys[mid]);
-    if (keys[right] < keys[left]) std::swap(keys[left], keys[right]);
-    if (keys[right] < keys[mid]) std::swap(keys[mid], keys[right]);
+    // Values have to move along with their keys.
+    if (keys[mid] < keys[left]) {
+        std::swap(keys[left], keys[mid]);
+        std::swap(values[left], values[mid]);
+    }
+    if (keys[right] < keys[left]) {
+        std::swap(keys[left], keys[right]);
+        std::swap(values[left], values[right]);
+    }
+    if (keys[right] < keys[mid]) {
+        std::swap(keys[mid], keys[right]);
+        std::swap(values[mid], values[right]);
+    }
 
     key_type pivot = keys[mid];
     std::swap(keys[mid], keys[right]);  // Move pivot to the end
+    std::swap(values[mid], values[right]);
 
     int i = left - 1;
     for (int j = left; j < right; ++j) {
@@ -78,4 +97,254 @@ void introsort(key_type *keys, value_type *values, int left, int right,
     introsort(keys, values, partition_index + 1, right, depth_limit - 1);
 }
 
-}  // namespace utils::sort
\ No newline at end of file
+/*
+    Merges the neighbouring sorted runs [first, mid) and [mid, last) of keys
+    and values into the same positions of out_keys and out_values.
+*/
+template <typename key_type, typename value_type>
+void merge(const key_type *keys, const value_type *values, uint16_t first,
+           uint16_t mid, uint16_t last, key_type *out_keys,
+           value_type *out_values) {
+    uint16_t i = first;
+    uint16_t j = mid;
+    for (uint16_t w = first; w < last; ++w) {
+        const uint16_t from =
+            j == last || (i < mid && !(keys[j] < keys[i])) ? i++ : j++;
+        out_keys[w] = keys[from];
+        out_values[w] = values[from];
+    }
+}
+
+/*
+    LSD radix sort of integral keys a byte at a time, moving keys and values
+    between the leaf and the scratch space. Bytes that all keys share are
+    skipped, which leaves only a pass or two for the narrow key ranges of a
+    leaf.
+*/
+template <typename key_type, typename value_type>
+void radix(key_type *keys, value_type *values, uint16_t n,
+           key_type *scratch_keys, value_type *scratch_values) {
+    using bits_type = std::make_unsigned_t<key_type>;
+    // flipping the sign bit orders signed keys like unsigned ones
+    constexpr bits_type flip =
+        std::is_signed_v<key_type>
+            ? bits_type(1) << (sizeof(key_type) * CHAR_BIT - 1)
+            : 0;
+
+    bits_type differ = 0;
+    for (uint16_t i = 1; i < n; ++i) {
+        differ |= static_cast<bits_type>(keys[i] ^ keys[0]);
+    }
+    key_type *from_keys = keys;
+    value_type *from_values = values;
+    key_type *to_keys = scratch_keys;
+    value_type *to_values = scratch_values;
+    for (size_t shift = 0; differ >> shift != 0; shift += CHAR_BIT) {
+        if (static_cast<uint8_t>(differ >> shift) == 0) {
+            continue;
+        }
+        auto digit = [shift](const key_type &key) {
+            return static_cast<uint8_t>((static_cast<bits_type>(key) ^ flip) >>
+                                        shift);
+        };
+        uint16_t offsets[256] = {};
+        for (uint16_t i = 0; i < n; ++i) {
+            ++offsets[digit(from_keys[i])];
+        }
+        uint16_t offset = 0;
+        for (auto &o : offsets) {
+            offset += std::exchange(o, offset);
+        }
+        for (uint16_t i = 0; i < n; ++i) {
+            const uint16_t w = offsets[digit(from_keys[i])]++;
+            to_keys[w] = from_keys[i];
+            to_values[w] = from_values[i];
+        }
+        std::swap(from_keys, to_keys);
+        std::swap(from_values, to_values);
+        if (shift + CHAR_BIT >= sizeof(key_type) * CHAR_BIT) {
+            break;
+        }
+    }
+    if (from_keys != keys) {
+        std::memcpy(keys, from_keys, n * sizeof(key_type));
+        std::memcpy(values, from_values, n * sizeof(value_type));
+    }
+}
+
+// insertion sort of the n entries, for short or almost sorted ones
+template <typename key_type, typename value_type>
+void insertion(key_type *keys, value_type *values, uint16_t n) {
+    for (uint16_t i = 1; i < n; ++i) {
+        key_type key = keys[i];
+        value_type value = values[i];
+        uint16_t j = i;
+        for (; j > 0 && key < keys[j - 1]; --j) {
+            keys[j] = keys[j - 1];
+            values[j] = values[j - 1];
+        }
+        keys[j] = key;
+        values[j] = value;
+    }
+}
+
+/*
+    Sorts the n entries if all but at most limit of them are in order. The
+    entries that break the order, either smaller than the last one kept or
+    bigger than the next when that one fits, move to the scratch space and
+    the others close up. The few moved ones are sorted on their own and
+    merged back from the end. Returns false, with the entries permuted but
+    all still there, if more than limit would have to move.
+*/
+template <typename key_type, typename value_type>
+bool outliers(key_type *keys, value_type *values, uint16_t n, uint16_t limit,
+              key_type *scratch_keys, value_type *scratch_values) {
+    uint16_t kept = 0;
+    uint16_t moved = 0;
+    for (uint16_t i = 0; i < n; ++i) {
+        const bool fits = kept == 0 || !(keys[i] < keys[kept - 1]);
+        const bool spike = i + 1 < n && keys[i + 1] < keys[i] &&
+                           (kept == 0 || !(keys[i + 1] < keys[kept - 1]));
+        if (fits && !spike) {
+            keys[kept] = keys[i];
+            values[kept] = values[i];
+            ++kept;
+            continue;
+        }
+        if (moved == limit) {
+            std::memcpy(keys + kept, scratch_keys, moved * sizeof(key_type));
+            std::memcpy(values + kept, scratch_values,
+                        moved * sizeof(value_type));
+            return false;
+        }
+        scratch_keys[moved] = keys[i];
+        scratch_values[moved] = values[i];
+        ++moved;
+    }
+    if (moved <= 32) {
+        insertion(scratch_keys, scratch_values, moved);
+    } else {
+        introsort(scratch_keys, scratch_values, 0, moved - 1,
+                  2 * std::bit_width(moved));
+    }
+    for (uint16_t w = n; moved > 0;) {
+        --w;
+        if (kept > 0 && scratch_keys[moved - 1] < keys[kept - 1]) {
+            --kept;
+            keys[w] = keys[kept];
+            values[w] = values[kept];
+        } else {
+            --moved;
+            keys[w] = scratch_keys[moved];
+            values[w] = scratch_values[moved];
+        }
+    }
+    return true;
+}
+
+/*
+    Sorts the n <= capacity entries of a leaf by key, the values along with
+    them, without recursion and with the scratch space on the stack. A leaf
+    with appends is a sorted prefix followed by whatever came in since, so
+    for few ascending runs they are merged pairwise, a pass per halving of
+    the runs. Beyond max_runs, if only a few entries are out of order they
+    are taken out, sorted and merged back. Otherwise integral keys get a
+    radix sort and others introsort.
+*/
+template <uint16_t capacity, typename key_type, typename value_type>
+void leaf(key_type *keys, value_type *values, uint16_t n) {
+    constexpr uint16_t max_runs = 8;
+
+    uint16_t bounds[max_runs + 1];
+    uint16_t runs = 0;
+    bounds[0] = 0;
+    for (uint16_t i = 1; i <= n && runs < max_runs; ++i) {
+        if (i == n || keys[i] < keys[i - 1]) {
+            bounds[++runs] = i;
+        }
+    }
+    if (runs <= 1) {
+        return;
+    }
+
+    key_type scratch_keys[capacity];
+    value_type scratch_values[capacity];
+    if (bounds[runs] < n) {
+        if (outliers(keys, values, n, n / 16, scratch_keys, scratch_values)) {
+            return;
+        }
+        if constexpr (std::is_integral_v<key_type>) {
+            radix(keys, values, n, scratch_keys, scratch_values);
+        } else {
+            introsort(keys, values, 0, n - 1, 2 * std::bit_width(n));
+        }
+        return;
+    }
+
+    key_type *from_keys = keys;
+    value_type *from_values = values;
+    key_type *to_keys = scratch_keys;
+    value_type *to_values = scratch_values;
+    while (runs > 1) {
+        uint16_t merged = 0;
+        for (uint16_t r = 0; r < runs; r += 2) {
+            const uint16_t last = bounds[std::min<uint16_t>(r + 2, runs)];
+            if (r + 1 < runs) {
+                merge(from_keys, from_values, bounds[r], bounds[r + 1], last,
+                      to_keys, to_values);
+            } else {
+                std::memcpy(to_keys + bounds[r], from_keys + bounds[r],
+                            (last - bounds[r]) * sizeof(key_type));
+                std::memcpy(to_values + bounds[r], from_values + bounds[r],
+                            (last - bounds[r]) * sizeof(value_type));
+            }
+            bounds[++merged] = last;
+        }
+        runs = merged;
+        std::swap(from_keys, to_keys);
+        std::swap(from_values, to_values);
+    }
+    if (from_keys != keys) {
+        std::memcpy(keys, from_keys, n * sizeof(key_type));
+        std::memcpy(values, from_values, n * sizeof(value_type));
+    }
+}
+
+/*
+    Sorts the n entries of a leaf with appends like leaf and keeps only the
+    last of the entries with equal keys, which is the latest write: appends
+    do not look for an earlier copy of their key. The sort does not keep
+    equal keys in order, so the entries are set aside to look up the last
+    copy of the keys that turn up twice. Returns the number of entries left.
+*/
+template <uint16_t capacity, typename key_type, typename value_type>
+uint16_t leaf_unique(key_type *keys, value_type *values, uint16_t n) {
+    key_type written_keys[capacity];
+    value_type written_values[capacity];
+    std::memcpy(written_keys, keys, n * sizeof(key_type));
+    std::memcpy(written_values, values, n * sizeof(value_type));
+    leaf<capacity>(keys, values, n);
+
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < n;) {
+        const key_type key = keys[i];
+        uint16_t next = i + 1;
+        while (next < n && !(key < keys[next])) {
+            ++next;
+        }
+        keys[kept] = key;
+        values[kept] = values[i];
+        if (next - i > 1) {
+            uint16_t last = n - 1;
+            while (written_keys[last] != key) {
+                --last;
+            }
+            values[kept] = written_values[last];
+        }
+        ++kept;
+        i = next;
+    }
+    return kept;
+}
+
+}  // namespace utils::sort
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "ikr.h"
+
+namespace utils::sortedness {
+
+/*
+    Online (K, L) estimate of the sortedness of an insert stream, in the
+    spirit of the K-L metric: K is the fraction of inserts that arrive out
+    of order and L how far, in entries, a late insert lands behind the
+    position it would have had in a sorted stream.
+
+    The tree reports misses of its fast-paths, and the displacement of the
+    ones that fall just below a fast-path, from its slow path only. Every
+    window inserts one caller folds the counts into exponentially weighted
+    averages and derives the fast-path reset threshold and the IKR bound
+    from them, so fast inserts never touch the estimator.
+*/
+class estimator {
+    // inserts per estimate, and weight of the newest estimate
+    static constexpr uint64_t window = 1024;
+    static constexpr double weight = 0.125;
+    static constexpr uint8_t min_threshold = 2;
+    static constexpr uint8_t max_threshold = UINT8_MAX;
+
+    const uint16_t capacity;
+
+    std::atomic<uint32_t> misses{};
+    std::atomic<uint32_t> late{};
+    std::atomic<uint64_t> displaced{};
+
+    std::mutex fold_mutex;
+    // only written under fold_mutex, read without it to skip early
+    std::atomic<uint64_t> folded{};
+
+    std::atomic<double> k{};
+    std::atomic<double> l{};
+    std::atomic<uint8_t> threshold;
+    std::atomic<double> bound{IKR::sorted_bound};
+
+   public:
+    // starts from the fixed sqrt(capacity) reset threshold of the QuIT trees
+    explicit estimator(uint16_t leaf_capacity)
+        : capacity(leaf_capacity),
+          threshold(static_cast<uint8_t>(std::sqrt(leaf_capacity))) {}
+
+    // an insert that no fast-path took
+    void miss() { misses.fetch_add(1, std::memory_order_relaxed); }
+
+    // a miss that landed displacement entries behind a fast-path, counted
+    // up to one leaf
+    void miss(size_t displacement) {
+        miss();
+        late.fetch_add(1, std::memory_order_relaxed);
+        displaced.fetch_add(std::min<size_t>(displacement, capacity),
+                            std::memory_order_relaxed);
+    }
+
+    /*
+        Folds the misses since the last estimate into K and L once inserts,
+        the number of inserts so far, has moved a window past it. Returns
+        false if it is too early or another thread is folding.
+    */
+    bool fold(uint64_t inserts) {
+        if (inserts < folded.load(std::memory_order_relaxed) + window) {
+            return false;
+        }
+        std::unique_lock lock(fold_mutex, std::try_to_lock);
+        if (!lock.owns_lock() ||
+            inserts < folded.load(std::memory_order_relaxed) + window) {
+            return false;
+        }
+        const uint64_t n = inserts - folded.load(std::memory_order_relaxed);
+        folded.store(inserts, std::memory_order_relaxed);
+        const uint32_t m = misses.exchange(0, std::memory_order_relaxed);
+        const uint32_t n_late = late.exchange(0, std::memory_order_relaxed);
+        const uint64_t d = displaced.exchange(0, std::memory_order_relaxed);
+
+        const double k_sample = std::min(1.0, static_cast<double>(m) / n);
+        const double k_new =
+            k.load(std::memory_order_relaxed) * (1 - weight) +
+            k_sample * weight;
+        k.store(k_new, std::memory_order_relaxed);
+        double l_new = l.load(std::memory_order_relaxed);
+        if (n_late) {
+            l_new = l_new * (1 - weight) +
+                    static_cast<double>(d) / n_late * weight;
+            l.store(l_new, std::memory_order_relaxed);
+        }
+
+        // a fast-path that is still right misses t inserts in a row with
+        // probability K^t, reset once that drops below one in a leaf
+        uint8_t t = max_threshold;
+        if (k_new < 1) {
+            const double runs =
+                std::ceil(std::log(1.0 / capacity) / std::log(k_new));
+            t = static_cast<uint8_t>(std::clamp<double>(
+                runs, min_threshold, max_threshold));
+        }
+        threshold.store(t, std::memory_order_relaxed);
+        // late keys widen the key range of a leaf by up to their
+        // displacement, so IKR tolerates K times that share of a leaf
+        const double spread = k_new * std::min(1.0, l_new / capacity);
+        bound.store(IKR::sorted_bound / (1 + spread),
+                    std::memory_order_relaxed);
+        return true;
+    }
+
+    // fraction of out of order inserts
+    double out_of_order() const { return k.load(std::memory_order_relaxed); }
+
+    // entries a late insert lands behind its fast-path
+    double displacement() const { return l.load(std::memory_order_relaxed); }
+
+    // consecutive misses before a fast-path moves
+    uint8_t reset_threshold() const {
+        return threshold.load(std::memory_order_relaxed);
+    }
+
+    // bound of IKR::lower_bound and IKR::upper_bound
+    double ikr_bound() const { return bound.load(std::memory_order_relaxed); }
+};
+
+}  // namespace utils::sortedness
@@ -1,4 +1,5 @@
 #pragma once
+#include "trees/ConcurrentBLinkBTree.hpp"
 #include "trees/ConcurrentQuITBTree.hpp"
 #include "trees/ConcurrentQuITBTreeAppends.hpp"
 #include "trees/ConcurrentQuITBTreeAtomic.hpp"
@@ -0,0 +1,768 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "BTreeNode.hpp"
+#include "MemoryBlockManager.hpp"
+#include "bulk.hpp"
+#include "latch_table.hpp"
+#include "lookup.hpp"
+#include "mtx.hpp"
+#include "scan.hpp"
+
+/*
+    Lehman-Yao B-link tree. Every node carries a high key and links to its
+    right sibling through next_id, for internal nodes as well as leaves. A
+    split only latches the node being split and afterwards its parent; until
+    the parent knows about the new node, it is reachable through the right
+    link of its left sibling. Lookups and inserts latch one node at a time
+    (two while moving right) and move right whenever the key is not below
+    the high key of the node they arrived at. Erase only removes the key and
+    leaves underfull nodes in place: a descent may reach a node through a
+    right link at any time, so nodes are never merged or freed.
+*/
+namespace ConcurrentBLinkBTree {
+using latch_t = atm::shared_mutex;
+
+template <typename key_type, typename value_type,
+          typename latch_type = latch_t>
+class BTree {
+   public:
+    using node_id_t = uint32_t;
+    using BlockManager = InMemoryBlockManager<node_id_t>;
+#ifdef EMBEDDED_LATCHES
+    using node_t = BTreeNode<node_id_t, key_type, value_type,
+                             BlockManager::block_size, latch_type>;
+    using latches_t = embedded_latch_table<node_t, BlockManager>;
+#else
+    using node_t =
+        BTreeNode<node_id_t, key_type, value_type, BlockManager::block_size>;
+    using latches_t = latch_table<latch_type, BlockManager>;
+#endif
+    using step = node_id_t;
+    using path_t = std::vector<step>;
+
+    static constexpr const char *name = "ConcurrentBLinkBTree";
+    static constexpr const bool concurrent = true;
+    static constexpr node_id_t INVALID_NODE_ID =
+        std::numeric_limits<node_id_t>::max();
+
+    // the last key slot of every node holds its high key, the high key of the
+    // rightmost node of a level (next_id == INVALID_NODE_ID) is infinite
+    static constexpr uint16_t leaf_capacity = node_t::leaf_capacity - 1;
+    static constexpr uint16_t internal_capacity =
+        node_t::internal_capacity - 1;
+    static constexpr uint16_t SPLIT_INTERNAL_POS = internal_capacity / 2;
+    static constexpr uint16_t SPLIT_LEAF_POS = (leaf_capacity + 1) / 2;
+
+    // not necessary but good to have
+    std::atomic<uint32_t> size;
+
+    // stats for benchmarking purposes
+    mutable std::atomic<uint32_t> ctr_root_shared{};
+    std::atomic<uint32_t> ctr_root_exclusive{};
+    uint32_t ctr_root{};
+    mutable std::atomic<uint32_t> ctr_move_right{};
+
+    void reset_ctr() {
+        ctr_root_shared = 0;
+        ctr_root_exclusive = 0;
+        ctr_root = 0;
+        ctr_move_right = 0;
+    }
+
+    explicit BTree(BlockManager &m)
+        : manager(m),
+          mutexes(m),
+          root_id(m.allocate()),
+          head_id(m.allocate()),
+          height(1) {
+        node_t leaf(manager.open_block(head_id), bp_node_type::LEAF);
+        manager.mark_dirty(head_id);
+        leaves = 1;
+        internal = 0;
+        leaf.info->id = head_id;
+        leaf.info->next_id = INVALID_NODE_ID;
+        leaf.info->prev_id = INVALID_NODE_ID;
+        leaf.info->size = 0;
+        node_t root(manager.open_block(root_id), bp_node_type::INTERNAL);
+        manager.mark_dirty(root_id);
+        root.info->id = root_id;
+        root.info->next_id = INVALID_NODE_ID;
+        root.info->size = 0;
+        root.children[0] = head_id;
+    }
+
+    /*
+        Builds the tree bottom-up out of [begin, end), keys or key/value pairs
+        in strictly ascending key order, instead of inserting them one by one.
+        Nodes are filled to fill_factor, in [0.5, 1], of their capacity and
+        num_threads share the work on each level. Requires a tree that was
+        just constructed and that no other thread uses yet.
+    */
+    template <std::random_access_iterator It>
+    void bulk_load(It begin, It end, double fill_factor = 1.0,
+                   unsigned num_threads = 1) {
+        utils::bulk::loader<node_t, BlockManager> loader(manager, num_threads,
+                                                         true);
+        loader.leaves(begin, end, leaf_capacity, fill_factor, head_id);
+        leaves = loader.ids.size();
+        while (loader.ids.size() > 1) {
+            loader.internal(internal_capacity, fill_factor);
+            internal += loader.ids.size();
+            ++height;
+        }
+        // the single node on top takes the place of the root
+        if (height > 1) {
+            loader.move_to(root_id);
+            --internal;
+            --height;
+        }
+        size = end - begin;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const BTree &tree) {
+        os << tree.size << ", " << +tree.height << ", " << tree.internal << ", "
+           << tree.leaves;
+        return os;
+    }
+
+    std::unordered_map<std::string, uint64_t> get_stats() const {
+        return {{"size", size},
+                {"height", height},
+                {"internal", internal},
+                {"leaves", leaves},
+                {"move_right", ctr_move_right}};
+    }
+
+    bool update(const key_type &key, const value_type &value) {
+        node_t leaf;
+        find_leaf_exclusive(leaf, key, nullptr);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            mutexes[leaf.info->id].unlock();
+            return false;
+        }
+        manager.mark_dirty(leaf.info->id);
+        leaf.values[index] = value;
+        mutexes[leaf.info->id].unlock();
+        return true;
+    }
+
+    void insert(const key_type &key, const value_type &value) {
+        node_t leaf;
+        path_t path;
+        find_leaf_exclusive(leaf, key, &path);
+        uint16_t index = leaf.value_slot(key);
+        if (index < leaf.info->size && leaf.keys[index] == key) {
+            manager.mark_dirty(leaf.info->id);
+            leaf.values[index] = value;
+            mutexes[leaf.info->id].unlock();
+            return;
+        }
+        size.fetch_add(1, std::memory_order_relaxed);
+        if (leaf.info->size < leaf_capacity) {
+            leaf_insert(leaf, index, key, value);
+            mutexes[leaf.info->id].unlock();
+            return;
+        }
+        key_type separator;
+        node_id_t new_leaf_id =
+            split_insert(leaf, index, key, value, separator);
+        mutexes[leaf.info->id].unlock();
+        internal_insert(path, 1, separator, new_leaf_id);
+    }
+
+    /*
+        Inserts the entries of batch, which it sorts by key, like insert one
+        by one would; the last of the entries with equal keys wins. Each run
+        of entries below the high key of a leaf is merged into it in a single
+        pass under one latch, as far as it fits. The entry that finds the leaf
+        full goes through insert, which splits it.
+    */
+    void insert_batch(std::span<std::pair<key_type, value_type>> batch) {
+        const size_t n = utils::bulk::prepare(batch);
+        node_t leaf;
+        for (size_t i = 0; i < n;) {
+            const auto &[key, value] = batch[i];
+            find_leaf_exclusive(leaf, key, nullptr);
+            const size_t taken = leaf_merge(
+                leaf,
+                utils::bulk::run(batch.subspan(i, n - i),
+                                 leaf.info->next_id == INVALID_NODE_ID
+                                     ? nullptr
+                                     : &high_key(leaf)));
+            mutexes[leaf.info->id].unlock();
+            if (taken == 0) {
+                insert(key, value);
+                ++i;
+            }
+            i += taken;
+        }
+    }
+
+    bool erase(const key_type &key) {
+        node_t leaf;
+        find_leaf_exclusive(leaf, key, nullptr);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            mutexes[leaf.info->id].unlock();
+            return false;
+        }
+        size.fetch_sub(1, std::memory_order_relaxed);
+        manager.mark_dirty(leaf.info->id);
+        leaf.erase_value(index);
+        mutexes[leaf.info->id].unlock();
+        return true;
+    }
+
+    uint32_t select_k(size_t count, const key_type &min_key) const {
+        node_t leaf;
+        find_leaf_shared(leaf, min_key);
+        uint16_t index = leaf.value_slot(min_key);
+        uint32_t loads = 1;
+        uint16_t curr_size = leaf.info->size - index;
+        while (count > curr_size) {
+            count -= curr_size;
+            node_id_t next_id = leaf.info->next_id;
+            if (next_id == INVALID_NODE_ID) {
+                break;
+            }
+            mutexes[next_id].lock_shared();
+            mutexes[leaf.info->id].unlock_shared();
+            leaf.load(manager.open_block(next_id));
+            curr_size = leaf.info->size;
+            ++loads;
+        }
+        mutexes[leaf.info->id].unlock_shared();
+        return loads;
+    }
+
+    uint32_t range(const key_type &min_key, const key_type &max_key) const {
+        uint32_t loads = 1;
+        node_t leaf;
+        find_leaf_shared(leaf, min_key);
+        while (leaf.info->size == 0 ||
+               leaf.keys[leaf.info->size - 1] < max_key) {
+            node_id_t next_id = leaf.info->next_id;
+            if (next_id == INVALID_NODE_ID) {
+                break;
+            }
+            mutexes[next_id].lock_shared();
+            mutexes[leaf.info->id].unlock_shared();
+            leaf.load(manager.open_block(next_id));
+            ++loads;
+        }
+        mutexes[leaf.info->id].unlock_shared();
+        return loads;
+    }
+
+    /*
+        Hands the entries with keys >= min_key to emit in key order, one leaf
+        at a time, as emit(keys, values) with two std::span of equal length.
+        Stops once emit returns false or the last leaf was read; returns the
+        number of leaves read. Each batch is copied out of its leaf, so emit
+        runs without a latch held. The scan then goes on after the last key
+        it emitted, in the same leaf unless erases emptied it or removed its
+        smallest keys meanwhile; nodes are never merged, so it then descends
+        from the root again to find where the following keys are.
+    */
+    template <typename F>
+    uint32_t scan(const key_type &min_key, F &&emit) const {
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = min_key;
+        // set once the entries up to bound were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            batch.copy(leaf.keys, leaf.values, leaf.info->size, true);
+            batch.seek(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.last();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                const utils::scan::step step = utils::scan::resume(
+                    leaf.keys, leaf.info->size, bound, true);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+                if (step == utils::scan::step::descend) {
+                    mutexes[leaf_id].unlock_shared();
+                    find_leaf_shared(leaf, bound);
+                    ++loads;
+                    continue;
+                }
+            }
+            const node_id_t next_id = leaf.info->next_id;
+            if (next_id == INVALID_NODE_ID) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            mutexes[next_id].lock_shared();
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(next_id));
+            ++loads;
+        }
+    }
+
+    /*
+        Hands the entries with keys <= max_key to emit like scan, but one leaf
+        at a time from right to left: the batches come in descending order,
+        while the keys within each batch ascend. Leaves are only latched
+        right to left with try_lock_shared; a scan that does not get the left
+        sibling drops its latch and descends from the root again, so it
+        cannot deadlock with writers or forward scans.
+    */
+    template <typename F>
+    uint32_t reverse_scan(const key_type &max_key, F &&emit) const {
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = max_key;
+        // set once the entries from bound on were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            batch.copy(leaf.keys, leaf.values, leaf.info->size, true);
+            batch.seek_back(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.first();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                const utils::scan::step step = utils::scan::resume_back(
+                    leaf.keys, leaf.info->size, bound, true);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+            }
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (prev_id == INVALID_NODE_ID) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            if (!mutexes[prev_id].try_lock_shared()) {
+                mutexes[leaf_id].unlock_shared();
+                find_leaf_shared(leaf, bound);
+                ++loads;
+                continue;
+            }
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(prev_id));
+            ++loads;
+        }
+    }
+
+    // reads the count largest entries with keys <= max_key
+    uint32_t select_k_desc(size_t count, const key_type &max_key) const {
+        return reverse_scan(max_key, [&](auto keys, auto) {
+            count -= std::min(count, keys.size());
+            return count > 0;
+        });
+    }
+
+    std::optional<value_type> get(const key_type &key) const {
+        node_t leaf;
+        find_leaf_shared(leaf, key);
+        uint16_t index = leaf.value_slot(key);
+        std::optional<value_type> result;
+        if (index < leaf.info->size && leaf.keys[index] == key) {
+            result = leaf.values[index];
+        }
+        mutexes[leaf.info->id].unlock_shared();
+        return result;
+    }
+
+    bool contains(const key_type &key) const {
+        node_t leaf;
+        find_leaf_shared(leaf, key);
+        uint16_t index = leaf.value_slot(key);
+        bool result = index < leaf.info->size && (leaf.keys[index] == key);
+        mutexes[leaf.info->id].unlock_shared();
+        return result;
+    }
+
+    /*
+        Looks up every key of keys into the same position of out, like get.
+        The lookups go down the tree in groups, one node per round. Each
+        prefetches the node it moves to, a child or a right sibling, and only
+        latches it in the next round, so the cache misses of a group overlap.
+        Right links make up for the node splitting in between, so no latch is
+        held across rounds.
+    */
+    void multi_get(std::span<const key_type> keys,
+                   std::span<std::optional<value_type>> out) const {
+        constexpr size_t group_size = utils::lookup::group_size;
+        node_id_t ids[group_size];
+        node_t node;
+        for (size_t begin = 0; begin < keys.size(); begin += group_size) {
+            const size_t n = std::min(group_size, keys.size() - begin);
+            std::fill_n(ids, n, root_id);
+            ctr_root_shared.fetch_add(n, std::memory_order_relaxed);
+            size_t pending = n;
+            while (pending > 0) {
+                for (size_t i = 0; i < n; ++i) {
+                    const node_id_t node_id = ids[i];
+                    if (node_id == INVALID_NODE_ID) {
+                        continue;
+                    }
+                    const key_type &key = keys[begin + i];
+                    mutexes[node_id].lock_shared();
+                    node.load(manager.open_block(node_id));
+                    if (beyond(node, key)) {
+                        ids[i] = node.info->next_id;
+                    } else if (node.info->type == bp_node_type::INTERNAL) {
+                        ids[i] = node.children[node.child_slot(key)];
+                    } else {
+                        const uint16_t leaf_size = node.info->size;
+                        const uint16_t index = node.value_slot(key);
+                        out[begin + i] = std::nullopt;
+                        if (index < leaf_size && node.keys[index] == key) {
+                            out[begin + i] = node.values[index];
+                        }
+                        ids[i] = INVALID_NODE_ID;
+                        --pending;
+                    }
+                    mutexes[node_id].unlock_shared();
+                    if (ids[i] != INVALID_NODE_ID) {
+                        mutexes.prefetch(ids[i]);
+                        node_t::prefetch(manager.open_block(ids[i]));
+                    }
+                }
+            }
+        }
+    }
+
+   private:
+    static key_type &high_key(const node_t &node) {
+        return node.keys[node.info->type == bp_node_type::LEAF
+                             ? leaf_capacity
+                             : internal_capacity];
+    }
+
+    static bool beyond(const node_t &node, const key_type &key) {
+        return node.info->next_id != INVALID_NODE_ID &&
+               !(key < high_key(node));
+    }
+
+    /*
+        Moves right from node (latched in shared mode if shared, exclusively
+        otherwise) until key is below its high key; the latch is handed over
+        to the node we end up at.
+    */
+    void move_right(node_t &node, const key_type &key, bool shared) const {
+        while (beyond(node, key)) {
+            const node_id_t next_id = node.info->next_id;
+            if (shared) {
+                mutexes[next_id].lock_shared();
+                mutexes[node.info->id].unlock_shared();
+            } else {
+                mutexes[next_id].lock();
+                mutexes[node.info->id].unlock();
+            }
+            node.load(manager.open_block(next_id));
+            ctr_move_right.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /*
+        Descends to the node of the given level (0 being the leaves) that is
+        responsible for key. Internal nodes are latched one at a time and the
+        node we arrive at is returned latched in shared mode. Each internal
+        node we pass is recorded in path if given, from the root downwards.
+    */
+    void find_node_shared(node_t &node, const key_type &key, uint8_t level,
+                          path_t *path) const {
+        node_id_t node_id = root_id;
+        mutexes[node_id].lock_shared();
+        ctr_root_shared.fetch_add(1, std::memory_order_relaxed);
+        node.load(manager.open_block(node_id));
+        // the root is the only node at level height
+        uint8_t node_level = height;
+        if (path != nullptr) {
+            path->reserve(node_level);
+        }
+        while (node_level > level) {
+            move_right(node, key, true);
+            if (path != nullptr) {
+                path->push_back(node.info->id);
+            }
+            // B-link: the right links make up for the child splitting before
+            // we latch it, so the parent can be released first
+            node_id = node.children[node.child_slot(key)];
+            mutexes[node.info->id].unlock_shared();
+            mutexes[node_id].lock_shared();
+            node.load(manager.open_block(node_id));
+            --node_level;
+        }
+        move_right(node, key, true);
+    }
+
+    void find_leaf_shared(node_t &node, const key_type &key) const {
+        find_node_shared(node, key, 0, nullptr);
+    }
+
+    /*
+        Returns the leaf responsible for key latched exclusively. The parent
+        latch is released before the leaf is latched, so the leaf may have
+        been split in between and we may have to move right.
+    */
+    void find_leaf_exclusive(node_t &node, const key_type &key,
+                             path_t *path) const {
+        find_node_shared(node, key, 1, path);
+        if (path != nullptr) {
+            path->push_back(node.info->id);
+        }
+        const node_id_t leaf_id = node.children[node.child_slot(key)];
+        mutexes[node.info->id].unlock_shared();
+        mutexes[leaf_id].lock();
+        node.load(manager.open_block(leaf_id));
+        move_right(node, key, false);
+    }
+
+    /*
+        Latches the node of the given level that the separator for a split
+        of its child has to go to exclusively. The node recorded on the way
+        down is tried first; only the root can change its level (when it
+        splits), in which case the parent is looked up again.
+    */
+    void find_parent_exclusive(node_t &node, path_t &path, uint8_t level,
+                               const key_type &key) {
+        node_id_t node_id = root_id;
+        if (!path.empty()) {
+            node_id = path.back();
+            path.pop_back();
+        }
+        mutexes[node_id].lock();
+        if (node_id == root_id) {
+            ++ctr_root_exclusive;
+            if (height != level) {
+                mutexes[node_id].unlock();
+                find_node_shared(node, key, level, nullptr);
+                node_id = node.info->id;
+                mutexes[node_id].unlock_shared();
+                mutexes[node_id].lock();
+            }
+        }
+        node.load(manager.open_block(node_id));
+        move_right(node, key, false);
+    }
+
+    void create_new_root(node_t &root, const key_type &key,
+                         node_id_t right_node_id) {
+        ++ctr_root;
+        node_id_t left_node_id = manager.allocate();
+        node_t left_node(manager.open_block(left_node_id));
+        ++internal;
+        // a raw copy of the block, so an embedded latch comes along held and
+        // is reset below
+        std::memcpy(static_cast<void *>(left_node.info), root.info,
+                    BlockManager::block_size);
+        left_node.info->id = left_node_id;
+        mutexes.reset(left_node_id);
+        manager.mark_dirty(left_node_id);
+        manager.mark_dirty(root_id);
+        root.info->next_id = INVALID_NODE_ID;
+        root.info->size = 1;
+        root.keys[0] = key;
+        root.children[0] = left_node_id;
+        root.children[1] = right_node_id;
+        ++height;
+    }
+
+    /*
+        Inserts the separator key for child_id into the node of the given
+        level, splitting it and continuing with its parent as required. Only
+        one node is latched at any time; a root split completes while the
+        root is latched so that the root id never denotes anything else than
+        the topmost node.
+    */
+    void internal_insert(path_t &path, uint8_t level, key_type key,
+                         node_id_t child_id) {
+        node_t node;
+        while (true) {
+            find_parent_exclusive(node, path, level, key);
+            const node_id_t node_id = node.info->id;
+            uint16_t index = node.child_slot(key);
+            manager.mark_dirty(node_id);
+            if (node.info->size < internal_capacity) {
+                std::memmove(node.keys + index + 1, node.keys + index,
+                             (node.info->size - index) * sizeof(key_type));
+                std::memmove(node.children + index + 2,
+                             node.children + index + 1,
+                             (node.info->size - index) * sizeof(node_id_t));
+                node.keys[index] = key;
+                node.children[index + 1] = child_id;
+                ++node.info->size;
+                mutexes[node_id].unlock();
+                return;
+            }
+
+            // gather the internal_capacity + 1 keys and the children of the
+            // overfull node, the middle key moves up to the parent
+            std::array<key_type, internal_capacity + 1> keys;
+            std::array<node_id_t, internal_capacity + 2> children;
+            std::memcpy(keys.data(), node.keys, index * sizeof(key_type));
+            keys[index] = key;
+            std::memcpy(keys.data() + index + 1, node.keys + index,
+                        (internal_capacity - index) * sizeof(key_type));
+            std::memcpy(children.data(), node.children,
+                        (index + 1) * sizeof(node_id_t));
+            children[index + 1] = child_id;
+            std::memcpy(children.data() + index + 2, node.children + index + 1,
+                        (internal_capacity - index) * sizeof(node_id_t));
+
+            node_id_t new_node_id = manager.allocate();
+            node_t new_node(manager.open_block(new_node_id),
+                            bp_node_type::INTERNAL);
+            manager.mark_dirty(new_node_id);
+            ++internal;
+            new_node.info->id = new_node_id;
+            new_node.info->next_id = node.info->next_id;
+            new_node.info->size = internal_capacity - SPLIT_INTERNAL_POS;
+            high_key(new_node) = high_key(node);
+            std::memcpy(new_node.keys, keys.data() + SPLIT_INTERNAL_POS + 1,
+                        new_node.info->size * sizeof(key_type));
+            std::memcpy(new_node.children,
+                        children.data() + SPLIT_INTERNAL_POS + 1,
+                        (new_node.info->size + 1) * sizeof(node_id_t));
+
+            node.info->size = SPLIT_INTERNAL_POS;
+            std::memcpy(node.keys, keys.data(),
+                        node.info->size * sizeof(key_type));
+            std::memcpy(node.children, children.data(),
+                        (node.info->size + 1) * sizeof(node_id_t));
+            key = keys[SPLIT_INTERNAL_POS];
+            high_key(node) = key;
+            node.info->next_id = new_node_id;
+            child_id = new_node_id;
+
+            if (node_id == root_id) {
+                create_new_root(node, key, child_id);
+                mutexes[root_id].unlock();
+                return;
+            }
+            mutexes[node_id].unlock();
+            ++level;
+        }
+    }
+
+    /*
+        Merges as many entries from the front of run, whose keys all belong to
+        the exclusively latched leaf, into it as fit. Returns how many.
+    */
+    size_t leaf_merge(node_t &leaf,
+                      std::span<std::pair<key_type, value_type>> run) {
+        const auto [taken, total] = utils::bulk::fitting(
+            leaf.keys, leaf.info->size, run, leaf_capacity);
+        if (taken == 0) {
+            return 0;
+        }
+        size.fetch_add(total - leaf.info->size, std::memory_order_relaxed);
+        manager.mark_dirty(leaf.info->id);
+        utils::bulk::merge(leaf.keys, leaf.values, leaf.info->size,
+                           run.first(taken), total);
+        leaf.info->size = total;
+        return taken;
+    }
+
+    void leaf_insert(node_t &leaf, uint16_t index, const key_type &key,
+                     const value_type &value) {
+        manager.mark_dirty(leaf.info->id);
+        std::memmove(leaf.keys + index + 1, leaf.keys + index,
+                     (leaf.info->size - index) * sizeof(key_type));
+        std::memmove(leaf.values + index + 1, leaf.values + index,
+                     (leaf.info->size - index) * sizeof(value_type));
+        leaf.keys[index] = key;
+        leaf.values[index] = value;
+        ++leaf.info->size;
+    }
+
+    /*
+        Splits the full leaf and inserts key; the new right sibling is linked
+        before the leaf is released. Returns the new leaf id and its
+        separator, which becomes the high key of leaf.
+    */
+    node_id_t split_insert(node_t &leaf, uint16_t index, const key_type &key,
+                           const value_type &value, key_type &separator) {
+        node_id_t new_leaf_id = manager.allocate();
+        node_t new_leaf(manager.open_block(new_leaf_id), bp_node_type::LEAF);
+        ++leaves;
+        manager.mark_dirty(new_leaf_id);
+        new_leaf.info->id = new_leaf_id;
+        new_leaf.info->next_id = leaf.info->next_id;
+        new_leaf.info->prev_id = leaf.info->id;
+        new_leaf.info->size = leaf_capacity + 1 - SPLIT_LEAF_POS;
+        high_key(new_leaf) = high_key(leaf);
+        leaf.info->size = SPLIT_LEAF_POS;
+        if (index < leaf.info->size) {
+            std::memcpy(new_leaf.keys, leaf.keys + leaf.info->size - 1,
+                        new_leaf.info->size * sizeof(key_type));
+            std::memmove(leaf.keys + index + 1, leaf.keys + index,
+                         (leaf.info->size - index - 1) * sizeof(key_type));
+            leaf.keys[index] = key;
+            std::memcpy(new_leaf.values, leaf.values + leaf.info->size - 1,
+                        new_leaf.info->size * sizeof(value_type));
+            std::memmove(leaf.values + index + 1, leaf.values + index,
+                         (leaf.info->size - index - 1) * sizeof(value_type));
+            leaf.values[index] = value;
+        } else {
+            uint16_t new_index = index - leaf.info->size;
+            std::memcpy(new_leaf.keys, leaf.keys + leaf.info->size,
+                        new_index * sizeof(key_type));
+            new_leaf.keys[new_index] = key;
+            std::memcpy(new_leaf.keys + new_index + 1, leaf.keys + index,
+                        (leaf_capacity - index) * sizeof(key_type));
+            std::memcpy(new_leaf.values, leaf.values + leaf.info->size,
+                        new_index * sizeof(value_type));
+            new_leaf.values[new_index] = value;
+            std::memcpy(new_leaf.values + new_index + 1, leaf.values + index,
+                        (leaf_capacity - index) * sizeof(value_type));
+        }
+        separator = new_leaf.keys[0];
+        high_key(leaf) = separator;
+        leaf.info->next_id = new_leaf_id;
+        if (new_leaf.info->next_id != INVALID_NODE_ID) {
+            // latches are taken left to right, as move_right does
+            mutexes[new_leaf.info->next_id].lock();
+            node_t next(manager.open_block(new_leaf.info->next_id));
+            manager.mark_dirty(next.info->id);
+            next.info->prev_id = new_leaf_id;
+            mutexes[next.info->id].unlock();
+        }
+        return new_leaf_id;
+    }
+
+    BlockManager &manager;
+    mutable latches_t mutexes;
+    const node_id_t root_id;
+    node_id_t head_id;
+    uint8_t height;
+    // splits of different nodes run concurrently and all bump these
+    std::atomic<uint32_t> leaves{};
+    std::atomic<uint32_t> internal{};
+};
+}  // namespace ConcurrentBLinkBTree
@@ -1,23 +1,37 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstring>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <mutex>
 #include <optional>
 #include <ranges>
 #include <shared_mutex>
+#include <span>
 #include <unordered_map>
 #include <vector>
 
 #include "../MemoryBlockManager.hpp"
 #include "BTreeNode.hpp"
+#include "bulk.hpp"
 #include "ikr.h"
+#include "latch_table.hpp"
+#include "lookup.hpp"
+#include "mtx.hpp"
+#include "scan.hpp"
 #include "sort.hpp"
 
 namespace ConcurrentQuITBTreeAppends {
+#ifdef OPTIMISTIC_READS
+using latch_t = olc::shared_mutex;
+#else
+using latch_t = std::shared_mutex;
+#endif
+
 struct reset_stats {
     uint8_t fails;
     uint8_t threshold;
@@ -41,13 +55,20 @@ struct reset_stats {
 };
 
 template <typename key_type, typename value_type,
-          bool LEAF_APPENDS_ENABLED = false>
+          bool LEAF_APPENDS_ENABLED = false, typename latch_type = latch_t>
 class BTree {
    public:
     using node_id_t = uint32_t;
     using BlockManager = InMemoryBlockManager<node_id_t>;
+#ifdef EMBEDDED_LATCHES
+    using node_t = BTreeNode<node_id_t, key_type, value_type,
+                             BlockManager::block_size, latch_type>;
+    using latches_t = embedded_latch_table<node_t, BlockManager>;
+#else
     using node_t =
         BTreeNode<node_id_t, key_type, value_type, BlockManager::block_size>;
+    using latches_t = latch_table<latch_type, BlockManager>;
+#endif
     using step = node_id_t;
     using path_t = std::vector<step>;
 
@@ -77,7 +98,8 @@ class BTree {
                 {"soft_resets", ctr_soft},
                 {"hard_resets", ctr_hard},
                 {"fast_inserts_fail", ctr_fast_fail},
-                {"sort", ctr_sort}};
+                {"sort", ctr_sort},
+                {"cached_path_splits", ctr_cached_path}};
     }
 
     std::unordered_map<std::string, uint64_t> get_profiling_times() {
@@ -93,13 +115,16 @@ class BTree {
     static constexpr uint16_t SPLIT_INTERNAL_POS =
         node_t::internal_capacity / 2;
     static constexpr uint16_t SPLIT_LEAF_POS = (node_t::leaf_capacity + 1) / 2;
+    // nodes below these sizes borrow from or merge with a sibling
+    static constexpr uint16_t MIN_LEAF_SIZE = node_t::leaf_capacity / 4;
+    static constexpr uint16_t MIN_INTERNAL_SIZE = node_t::internal_capacity / 4;
     static constexpr uint16_t IQR_SIZE_THRESH = SPLIT_LEAF_POS;
     static constexpr node_id_t INVALID_NODE_ID = -1;
 
     dist_f dist;
 
     BlockManager &manager;
-    mutable std::vector<std::shared_mutex> mutexes;
+    mutable latches_t mutexes;
     const node_id_t root_id;
     node_id_t head_id;
     node_id_t tail_id;
@@ -119,6 +144,10 @@ class BTree {
 
     mutable std::shared_mutex fp_mutex;
     fast_path_metadata fp_metadata;
+    // the internal nodes from the root down to the fast-path leaf, as of
+    // fp_path_version of internal_retired. Guarded by fp_mutex
+    path_t fp_path;
+    uint32_t fp_path_version{};
 
     mutable std::shared_mutex fp_meta_mutex;
     fast_path_helper_metadata fp_prev_metadata;
@@ -142,6 +171,11 @@ class BTree {
     std::atomic<uint32_t> internal{};
     std::atomic<uint32_t> ctr_redistribute{};
     std::atomic<uint32_t> ctr_soft{};
+    std::atomic<uint32_t> ctr_cached_path{};
+
+    // bumped while a retired internal node is still latched, so that cached
+    // paths through it fail validation before it can be reused
+    std::atomic<uint32_t> internal_retired{};
 
     // timers for profiling
     long long find_leaf_slot_time = 0;
@@ -154,8 +188,12 @@ class BTree {
         node_t root(manager.open_block(root_id));
         node_t left_node(manager.open_block(left_node_id));
         ++internal;
-        std::memcpy(left_node.info, root.info, 4096);
+        // a raw copy of the block, so an embedded latch comes along held and
+        // is reset below
+        std::memcpy(static_cast<void *>(left_node.info), root.info,
+                    BlockManager::block_size);
         left_node.info->id = left_node_id;
+        mutexes.reset(left_node_id);
         manager.mark_dirty(left_node_id);
 
         manager.mark_dirty(root_id);
@@ -181,8 +219,89 @@ class BTree {
         } while (node.info->type == INTERNAL);
     }
 
+    // requires leaf to be latched, or its version to be validated after
+    std::optional<value_type> leaf_get(const node_t &leaf, const key_type &key,
+                                       uint16_t n) const {
+        if (LEAF_APPENDS_ENABLED && leaf.info->id == fp_metadata.fp_id) {
+            // the fast-path may be unsorted, do a linear scan of node from
+            // the back, where the latest write of a key appended again is
+            for (uint16_t i = n; i-- > 0;) {
+                if (leaf.keys[i] == key) {
+                    return leaf.values[i];
+                }
+            }
+            return std::nullopt;
+        }
+        uint16_t index = utils::search::lower_bound(leaf.keys, n, key);
+        if (index < n && leaf.keys[index] == key) {
+            return leaf.values[index];
+        }
+        return std::nullopt;
+    }
+
+#ifdef OPTIMISTIC_READS
+    // sizes read optimistically may be garbage, keep searches inside the node
+    static uint16_t clamped_size(const node_t &node, uint16_t capacity) {
+        return std::min(node.info->size, capacity);
+    }
+
+    /*
+        Optimistic lock coupling: descends to the leaf responsible for key
+        without writing to any latch. A child is only entered once the
+        parent's version validated after reading the child id, and again after
+        reading the child's version. Returns false on a conflict with a writer;
+        otherwise version has to be validated once the caller is done reading
+        the leaf.
+    */
+    bool find_leaf_optimistic(node_t &node, const key_type &key,
+                              uint32_t &version) const {
+        node_id_t node_id = root_id;
+        version = mutexes[node_id].read_lock();
+        node.load(manager.open_block(node_id));
+        do {
+            const uint16_t slot = utils::search::upper_bound(
+                node.keys, clamped_size(node, node_t::internal_capacity), key);
+            const node_id_t child_id = node.children[slot];
+            if (!mutexes[node_id].validate(version)) {
+                return false;
+            }
+            const uint32_t child_version = mutexes[child_id].read_lock();
+            if (!mutexes[node_id].validate(version)) {
+                return false;
+            }
+            node_id = child_id;
+            version = child_version;
+            node.load(manager.open_block(node_id));
+        } while (node.info->type == INTERNAL);
+        return true;
+    }
+
+    /*
+        Moves an optimistic reader from leaf to its sibling next_id, on
+        either side. Returns false if leaf changed since version was taken.
+    */
+    bool next_leaf_optimistic(node_t &leaf, uint32_t &version,
+                              node_id_t next_id) const {
+        if (!mutexes[leaf.info->id].validate(version)) {
+            return false;
+        }
+        const uint32_t next_version = mutexes[next_id].read_lock();
+        if (!mutexes[leaf.info->id].validate(version)) {
+            return false;
+        }
+        version = next_version;
+        leaf.load(manager.open_block(next_id));
+        return true;
+    }
+#endif
+
+    /*
+        Descends to the leaf of key, latching the unsafe part of the path
+        exclusively. trail, if given, gets every internal node on the way.
+    */
     void find_leaf_exclusive(node_t &node, path_t &path, const key_type &key,
-                             key_type &leaf_max) const {
+                             key_type &leaf_max,
+                             path_t *trail = nullptr) const {
         node_id_t node_id = root_id;
 
         mutexes[node_id].lock();
@@ -198,6 +317,9 @@ class BTree {
                 path.clear();
             }
             path.push_back(node_id);
+            if (trail != nullptr) {
+                trail->push_back(node_id);
+            }
             uint16_t slot = node.child_slot(key);
 
             if (slot != node.info->size) {
@@ -319,7 +441,8 @@ class BTree {
                             (index - node.info->size) * sizeof(uint32_t));
                 std::memcpy(new_node.children + 1 + index - node.info->size,
                             node.children + 1 + index,
-                            new_node.info->size * sizeof(uint32_t));
+                            (node_t::internal_capacity - index) *
+                                sizeof(uint32_t));
                 new_node.children[index - node.info->size] = child_id;
 
                 key = node.keys[node.info->size];
@@ -367,7 +490,8 @@ class BTree {
         }
 
         if (fast && fp_sorted) {
-            if (leaf.keys[index - 1] > key) {
+            // an equal key is a second copy, which only the sort drops
+            if (leaf.keys[index - 1] >= key) {
                 fp_sorted = false;
             }
         }
@@ -412,6 +536,31 @@ class BTree {
         return true;
     }
 
+    /*
+        Merges as many entries from the front of run, whose keys all belong to
+        the exclusively latched and sorted leaf, into it as fit. Requires
+        fp_mutex and fp_meta_mutex. Returns how many entries it took.
+    */
+    size_t leaf_merge(node_t &leaf,
+                      std::span<std::pair<key_type, value_type>> run) {
+        const auto [taken, total] = utils::bulk::fitting(
+            leaf.keys, leaf.info->size, run, node_t::leaf_capacity);
+        if (taken == 0) {
+            return 0;
+        }
+        size += total - leaf.info->size;
+        manager.mark_dirty(leaf.info->id);
+        utils::bulk::merge(leaf.keys, leaf.values, leaf.info->size,
+                           run.first(taken), total);
+        leaf.info->size = total;
+        if (leaf.info->id == fp_metadata.fp_id) {
+            fp_metadata.fp_size = total;
+        } else if (leaf.info->id != tail_id) {
+            update_fp_metadata_with_leaf_insert(leaf);
+        }
+        return taken;
+    }
+
     void std_sort_leaf(node_t &leaf) {
         std::array<std::pair<key_type, value_type>, node_t::leaf_capacity> kvs;
         for (uint16_t i = 0; i < leaf.info->size; i++) {
@@ -426,12 +575,21 @@ class BTree {
         }
     }
 
+    /*
+        Sorts the fast-path leaf after appends. Appends do not look for an
+        earlier copy of their key, so the sort keeps only the last write of
+        each key. Requires the leaf to be locked exclusively.
+    */
     void sort_leaf(node_t &leaf) {
         auto start = std::chrono::high_resolution_clock::now();
 
-        int depth_limit = 2 * std::log2(leaf.info->size);
-        utils::sort::introsort(leaf.keys, leaf.values, 0, leaf.info->size - 1,
-                               depth_limit);
+        const uint16_t n = leaf.info->size;
+        leaf.info->size = utils::sort::leaf_unique<node_t::leaf_capacity>(
+            leaf.keys, leaf.values, n);
+        size -= n - leaf.info->size;
+        if (leaf.info->id == fp_metadata.fp_id) {
+            fp_metadata.fp_size = leaf.info->size;
+        }
 
         auto end = std::chrono::high_resolution_clock::now();
         sort_time +=
@@ -507,6 +665,162 @@ class BTree {
         return split_leaf_pos;
     }
 
+    /*
+        Inserts key into the full fast-path leaf by moving its smallest
+        entries to the end of the leaf before it, until that one holds
+        IQR_SIZE_THRESH entries, as the sequential QuIT does instead of
+        splitting. Only done if that leaf is a sibling under the locked
+        parent, path.back(), whose separator moves up to the new fp_min,
+        and if it can be latched right away: leaves are latched left to
+        right, so it is only tried. Returns false if it did not apply.
+        Requires:
+            (1) leaf, the sorted fast-path, and path to be locked
+            (2) fp_mutex to be locked
+            (3) fp_meta_mutex to be locked
+    */
+    bool redistribute(node_t &leaf, uint16_t index, const path_t &path,
+                      const key_type &key, const value_type &value) {
+        const node_id_t prev_id = fp_prev_metadata.fp_prev_id;
+        if (prev_id == INVALID_NODE_ID ||
+            fp_prev_metadata.fp_prev_size >= IQR_SIZE_THRESH || path.empty()) {
+            return false;
+        }
+        node_t parent(manager.open_block(path.back()));
+        const uint16_t slot = parent.child_slot(key);
+        if (slot == 0 || parent.children[slot] != leaf.info->id ||
+            parent.children[slot - 1] != prev_id) {
+            return false;
+        }
+        if (!mutexes[prev_id].try_lock()) {
+            return false;
+        }
+        node_t prev(manager.open_block(prev_id));
+        const uint16_t prev_size = prev.info->size;
+        if (prev_size >= IQR_SIZE_THRESH) {
+            mutexes[prev_id].unlock();
+            return false;
+        }
+        ++ctr_redistribute;
+        manager.mark_dirty(prev_id);
+        manager.mark_dirty(leaf.info->id);
+        manager.mark_dirty(parent.info->id);
+
+        const uint16_t size = leaf.info->size;
+        uint16_t items = IQR_SIZE_THRESH - prev_size;
+        if (index < items) {
+            // key moves along
+            --items;
+            std::memcpy(prev.keys + prev_size, leaf.keys,
+                        index * sizeof(key_type));
+            std::memcpy(prev.keys + prev_size + index + 1, leaf.keys + index,
+                        (items - index) * sizeof(key_type));
+            prev.keys[prev_size + index] = key;
+            std::memcpy(prev.values + prev_size, leaf.values,
+                        index * sizeof(value_type));
+            std::memcpy(prev.values + prev_size + index + 1,
+                        leaf.values + index,
+                        (items - index) * sizeof(value_type));
+            prev.values[prev_size + index] = value;
+            std::memmove(leaf.keys, leaf.keys + items,
+                         (size - items) * sizeof(key_type));
+            std::memmove(leaf.values, leaf.values + items,
+                         (size - items) * sizeof(value_type));
+            leaf.info->size = size - items;
+        } else {
+            std::memcpy(prev.keys + prev_size, leaf.keys,
+                        items * sizeof(key_type));
+            std::memcpy(prev.values + prev_size, leaf.values,
+                        items * sizeof(value_type));
+            const uint16_t new_index = index - items;
+            std::memmove(leaf.keys, leaf.keys + items,
+                         new_index * sizeof(key_type));
+            std::memmove(leaf.keys + new_index + 1, leaf.keys + index,
+                         (size - index) * sizeof(key_type));
+            leaf.keys[new_index] = key;
+            std::memmove(leaf.values, leaf.values + items,
+                         new_index * sizeof(value_type));
+            std::memmove(leaf.values + new_index + 1, leaf.values + index,
+                         (size - index) * sizeof(value_type));
+            leaf.values[new_index] = value;
+            leaf.info->size = size - items + 1;
+        }
+        prev.info->size = IQR_SIZE_THRESH;
+        parent.keys[slot - 1] = leaf.keys[0];
+
+        fp_prev_metadata.fp_prev_size = IQR_SIZE_THRESH;
+        fp_metadata.fp_min = leaf.keys[0];
+        fp_metadata.fp_size = leaf.info->size;
+        mutexes[prev_id].unlock();
+        return true;
+    }
+
+    /*
+        Latches the unsafe part of the path to the full fast-path leaf
+        bottom-up, from the path cached by its last split, so that the leaf
+        can be split without another descent from the root. The cache holds
+        if no internal node was retired since it was taken and every node
+        still has the one below it as the child of key; it is also right for
+        the new leaves of the fast-path as long as they share the parent.
+        Ancestors are latched after their child, against the top-down order,
+        so they are only tried. Requires leaf to be locked exclusively and
+        fp_mutex. Returns false, with none of path locked, if the cache did
+        not hold.
+    */
+    bool latch_fast_path(const node_t &leaf, const key_type &key,
+                         path_t &path) {
+        // the cached nodes are live, and stay so while we are pinned
+        if (fp_path.empty() ||
+            internal_retired.load(std::memory_order_acquire) !=
+                fp_path_version) {
+            return false;
+        }
+        const auto release = [&] {
+            for (const auto &node_id : path) {
+                mutexes[node_id].unlock();
+            }
+            path.clear();
+            return false;
+        };
+        node_id_t child_id = leaf.info->id;
+        for (auto it = fp_path.rbegin(); it != fp_path.rend(); ++it) {
+            if (!mutexes[*it].try_lock()) {
+                return release();
+            }
+            path.push_back(*it);
+            const node_t node(manager.open_block(*it));
+            if (node.info->type != INTERNAL ||
+                node.children[node.child_slot(key)] != child_id) {
+                return release();
+            }
+            if (node.info->size < node_t::internal_capacity) {
+                break;
+            }
+            child_id = *it;
+        }
+        // a node may have been retired before we latched it
+        if (internal_retired.load(std::memory_order_acquire) !=
+            fp_path_version) {
+            return release();
+        }
+        std::ranges::reverse(path);
+        ++ctr_cached_path;
+        return true;
+    }
+
+    /*
+        Latches the path to the full fast-path leaf top-down and caches it
+        for the next split. Requires fp_mutex to be locked exclusively.
+    */
+    void find_fast_path(node_t &leaf, path_t &path, const key_type &key,
+                        key_type &leaf_max) {
+        path_t trail;
+        const uint32_t version =
+            internal_retired.load(std::memory_order_acquire);
+        find_leaf_exclusive(leaf, path, key, leaf_max, &trail);
+        fp_path = std::move(trail);
+        fp_path_version = version;
+    }
+
     void split_insert(node_t &leaf, uint16_t index, const path_t &path,
                       const key_type &key, const value_type &value, bool fast) {
         ++size;
@@ -516,6 +830,13 @@ class BTree {
         if (fast) {
             // requires fp_mutex and fp_meta_mutex to be locked by caller
             if (leaf.info->id == fp_metadata.fp_id) {
+                if (redistribute(leaf, index, path, key, value)) {
+                    mutexes[leaf.info->id].unlock();
+                    for (const auto &parent_id : path) {
+                        mutexes[parent_id].unlock();
+                    }
+                    return;
+                }
                 if (fp_prev_metadata.fp_prev_id == INVALID_NODE_ID ||
                     fp_prev_metadata.fp_prev_size < IQR_SIZE_THRESH) {
                     fp_move = true;
@@ -549,6 +870,7 @@ class BTree {
         new_leaf.info->id = new_leaf_id;
         new_leaf.info->next_id = leaf.info->next_id;
         new_leaf.info->size = node_t::leaf_capacity + 1 - leaf.info->size;
+        new_leaf.info->prev_id = leaf.info->id;
         leaf.info->next_id = new_leaf_id;
 
         if (index < leaf.info->size) {
@@ -577,6 +899,8 @@ class BTree {
         }
         if (leaf.info->id == tail_id) {
             tail_id = new_leaf_id;
+        } else {
+            link_prev(new_leaf.info->next_id, new_leaf_id);
         }
 
         if (fast) {
@@ -604,6 +928,276 @@ class BTree {
         internal_insert(path, new_leaf.keys[0], new_leaf_id);
     }
 
+    /*
+        Sorts an appended fast-path leaf before an erase searches it or moves
+        its entries. Requires fp_mutex, shared suffices as it keeps out the
+        fast-path inserts that append.
+    */
+    void sort_fast_path() {
+        if constexpr (LEAF_APPENDS_ENABLED) {
+            if (fp_sorted) {
+                return;
+            }
+            mutexes[fp_metadata.fp_id].lock();
+            if (!fp_sorted) {
+                node_t fp_leaf(manager.open_block(fp_metadata.fp_id), LEAF);
+                sort_leaf(fp_leaf);
+                fp_sorted = true;
+                ++ctr_sort;
+                manager.mark_dirty(fp_metadata.fp_id);
+            }
+            mutexes[fp_metadata.fp_id].unlock();
+        }
+    }
+
+    /*
+        sort_fast_path for a caller that latched a leaf right of the
+        fast-path leaf, which may then only try the latch of the fast-path
+        leaf. Returns false if that leaf is unsorted and latched by someone
+        else. Requires fp_mutex to be locked.
+    */
+    bool try_sort_fast_path() {
+        if constexpr (LEAF_APPENDS_ENABLED) {
+            if (fp_sorted) {
+                return true;
+            }
+            if (!mutexes[fp_metadata.fp_id].try_lock()) {
+                return false;
+            }
+            node_t fp_leaf(manager.open_block(fp_metadata.fp_id), LEAF);
+            sort_leaf(fp_leaf);
+            fp_sorted = true;
+            ++ctr_sort;
+            manager.mark_dirty(fp_metadata.fp_id);
+            mutexes[fp_metadata.fp_id].unlock();
+        }
+        return true;
+    }
+
+    /*
+        Requires leaf to be locked and fp_mutex to be held, shared suffices:
+        the fast-path cannot move and only the holder of a leaf updates its
+        size in the metadata.
+    */
+    void leaf_erase(node_t &leaf, uint16_t index) {
+        --size;
+        manager.mark_dirty(leaf.info->id);
+        leaf.erase_value(index);
+        if (leaf.info->id == fp_metadata.fp_id) {
+            fp_metadata.fp_size = leaf.info->size;
+        } else if (leaf.info->id == fp_prev_metadata.fp_prev_id) {
+            fp_prev_metadata.fp_prev_size = leaf.info->size;
+        }
+    }
+
+    /*
+        Keeps the fast-path metadata in line with a borrow between or a merge
+        of two sibling leaves. fp_min stays a lower bound of the fast-path
+        and fp_max an upper bound, they are exact unless the fast-path grew
+        by a merge.
+        Requires:
+            (1) both leaves to be locked
+            (2) fp_mutex to be locked
+    */
+    void update_fp_metadata_rebalance(const node_t &left, const node_t &right,
+                                      bool merged, const key_type &separator) {
+        if (merged) {
+            if (right.info->id == fp_metadata.fp_id) {
+                // the predecessor of left is unknown
+                fp_prev_metadata.fp_prev_id = INVALID_NODE_ID;
+                fp_metadata.fp_id = left.info->id;
+                fp_metadata.fp_min = left.keys[0];
+                fp_metadata.fp_size = left.info->size;
+            } else if (left.info->id == fp_metadata.fp_id) {
+                fp_metadata.fp_size = left.info->size;
+            } else if (right.info->id == fp_prev_metadata.fp_prev_id) {
+                fp_prev_metadata.fp_prev_id = left.info->id;
+                fp_prev_metadata.fp_prev_min = left.keys[0];
+                fp_prev_metadata.fp_prev_size = left.info->size;
+            }
+            return;
+        }
+        if (right.info->id == fp_metadata.fp_id) {
+            fp_metadata.fp_min = separator;
+            fp_metadata.fp_size = right.info->size;
+            if (left.info->id == fp_prev_metadata.fp_prev_id) {
+                fp_prev_metadata.fp_prev_min = left.keys[0];
+                fp_prev_metadata.fp_prev_size = left.info->size;
+            }
+        } else if (left.info->id == fp_metadata.fp_id) {
+            fp_metadata.fp_max = separator;
+            fp_metadata.fp_size = left.info->size;
+        } else if (right.info->id == fp_prev_metadata.fp_prev_id) {
+            fp_prev_metadata.fp_prev_min = right.keys[0];
+            fp_prev_metadata.fp_prev_size = right.info->size;
+        }
+    }
+
+    bool underflows(const node_t &node) const {
+        return node.info->size < (node.info->type == bp_node_type::LEAF
+                                      ? MIN_LEAF_SIZE
+                                      : MIN_INTERNAL_SIZE);
+    }
+
+    // true if erasing one entry from node cannot change its parent
+    bool erase_safe(const node_t &node) const {
+        if (node.info->type == bp_node_type::LEAF) {
+            return node.info->size > MIN_LEAF_SIZE;
+        }
+        return node.info->size >
+               (node.info->id == root_id ? 1 : MIN_INTERNAL_SIZE);
+    }
+
+    /*
+        Like find_leaf_exclusive, but path keeps the ancestors an erase
+        could underflow into, plus the parent of the topmost one.
+    */
+    void find_leaf_erase(node_t &node, path_t &path,
+                         const key_type &key) const {
+        node_id_t node_id = root_id;
+        mutexes[node_id].lock();
+        ++ctr_root_unique;
+        path.reserve(height);
+        node.load(manager.open_block(node_id));
+        do {
+            if (erase_safe(node)) {
+                for (const auto &parent_id : path) {
+                    mutexes[parent_id].unlock();
+                }
+                path.clear();
+            }
+            path.push_back(node_id);
+            uint16_t slot = node.child_slot(key);
+            node_id = node.children[slot];
+            mutexes[node_id].lock();
+            node.load(manager.open_block(node_id));
+        } while (node.info->type == bp_node_type::INTERNAL);
+        if (erase_safe(node)) {
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            path.clear();
+        }
+    }
+
+    /*
+        Restores the minimum size of node, reached through path on the way to
+        key, by borrowing from or merging with a sibling under the same
+        parent. Merges repeat this for the parent, and the root is collapsed
+        once it is left with a single internal child. Requires node and path
+        to be locked and releases them. Siblings are locked left to right, as
+        scans do; node is unlocked first if its sibling is on the left, which
+        is safe as it cannot be split or merged without the locked parent.
+    */
+    void rebalance(node_t &node, path_t &path, const key_type &key) {
+        while (!path.empty() && underflows(node)) {
+            const node_id_t node_id = node.info->id;
+            node.load(manager.open_block(path.back()));
+            path.pop_back();
+            if (node.info->size == 0) {
+                mutexes[node_id].unlock();
+                break;
+            }
+            uint16_t slot = node.child_slot(key);
+            if (slot == node.info->size) {
+                --slot;
+                mutexes[node_id].unlock();
+                mutexes[node.children[slot]].lock();
+                mutexes[node_id].lock();
+            } else {
+                mutexes[node.children[slot + 1]].lock();
+            }
+            node_t left(manager.open_block(node.children[slot]));
+            node_t right(manager.open_block(node.children[slot + 1]));
+            manager.mark_dirty(node.info->id);
+            manager.mark_dirty(left.info->id);
+            manager.mark_dirty(right.info->id);
+            if (!left.fits(right)) {
+                node.keys[slot] = left.redistribute(right, node.keys[slot]);
+                if (right.info->type == LEAF) {
+                    update_fp_metadata_rebalance(left, right, false,
+                                                 node.keys[slot]);
+                }
+                mutexes[left.info->id].unlock();
+                mutexes[right.info->id].unlock();
+                break;
+            }
+            left.merge(right, node.keys[slot]);
+            node.erase_child(slot + 1);
+            if (right.info->type == LEAF) {
+                --leaves;
+            } else {
+                --internal;
+            }
+            if (right.info->type == LEAF) {
+                if (right.info->id == tail_id) {
+                    tail_id = left.info->id;
+                } else {
+                    link_prev(left.info->next_id, left.info->id);
+                }
+                update_fp_metadata_rebalance(left, right, true,
+                                             node.keys[slot]);
+            }
+            const node_id_t right_id = right.info->id;
+            // lets scans that latch it again see that it is gone
+            right.info->size = 0;
+            if (right.info->type == INTERNAL) {
+                ++internal_retired;
+            }
+            mutexes[left.info->id].unlock();
+            mutexes[right_id].unlock();
+            manager.retire(right_id);
+        }
+        if (node.info->id == root_id) {
+            collapse_root();
+        }
+        mutexes[node.info->id].unlock();
+        for (const auto &parent_id : path) {
+            mutexes[parent_id].unlock();
+        }
+    }
+
+    /*
+        Points the leaf next_id back at prev_id. Requires the leaf left of
+        next_id to be locked, so leaves are locked left to right, and not
+        to be the tail, whose next_id wraps around to the head.
+    */
+    void link_prev(node_id_t next_id, node_id_t prev_id) {
+        mutexes[next_id].lock();
+        node_t next(manager.open_block(next_id));
+        manager.mark_dirty(next_id);
+        next.info->prev_id = prev_id;
+        mutexes[next_id].unlock();
+    }
+
+    /*
+        Pulls the only child of the root into the root block, root_id is
+        fixed. Requires the root to be locked.
+    */
+    void collapse_root() {
+        node_t root(manager.open_block(root_id));
+        while (root.info->size == 0) {
+            const node_id_t child_id = root.children[0];
+            mutexes[child_id].lock();
+            node_t child(manager.open_block(child_id));
+            if (child.info->type != bp_node_type::INTERNAL) {
+                mutexes[child_id].unlock();
+                return;
+            }
+            manager.mark_dirty(root_id);
+            root.info->size = child.info->size;
+            std::memcpy(root.keys, child.keys,
+                        child.info->size * sizeof(key_type));
+            std::memcpy(root.children, child.children,
+                        (child.info->size + 1) * sizeof(node_id_t));
+            --internal;
+            --height;
+            ++internal_retired;
+            mutexes[child_id].unlock();
+            manager.retire(child_id);
+        }
+    }
+
     static std::size_t cmp(const key_type &max, const key_type &min) {
         return max - min;
     }
@@ -611,7 +1205,7 @@ class BTree {
    public:
     explicit BTree(BlockManager &m)
         : manager(m),
-          mutexes(m.get_capacity()),
+          mutexes(m),
           root_id(m.allocate()),
           height(1),
           life(sqrt(node_t::leaf_capacity)) {
@@ -631,7 +1225,9 @@ class BTree {
         manager.mark_dirty(head_id);
         leaf.info->id = head_id;
         leaf.info->next_id = head_id;
+        leaf.info->prev_id = INVALID_NODE_ID;
         leaf.info->size = 0;
+        leaves = 1;
 
         node_t root(manager.open_block(root_id), INTERNAL);
         manager.mark_dirty(root_id);
@@ -646,7 +1242,49 @@ class BTree {
         }
     }
 
+    /*
+        Builds the tree bottom-up out of [begin, end), keys or key/value pairs
+        in strictly ascending key order, instead of inserting them one by one.
+        Nodes are filled to fill_factor, in [0.5, 1], of their capacity and
+        num_threads share the work on each level. Requires a tree that was
+        just constructed and that no other thread uses yet.
+    */
+    template <std::random_access_iterator It>
+    void bulk_load(It begin, It end, double fill_factor = 1.0,
+                   unsigned num_threads = 1) {
+        utils::bulk::loader<node_t, BlockManager> loader(manager, num_threads);
+        loader.leaves(begin, end, node_t::leaf_capacity, fill_factor, head_id);
+        leaves = loader.ids.size();
+        // the fast-path starts at the tail, preceded by the leaf before it
+        tail_id = loader.ids.back();
+        const uint16_t tail_size =
+            node_t(manager.open_block(tail_id)).info->size;
+        fp_metadata.fp_id = tail_id;
+        fp_metadata.fp_min = loader.mins.back();
+        fp_metadata.fp_size = tail_size;
+        if (leaves > 1) {
+            const node_id_t prev_id = loader.ids[leaves - 2];
+            fp_prev_metadata.fp_prev_id = prev_id;
+            fp_prev_metadata.fp_prev_min = loader.mins[leaves - 2];
+            fp_prev_metadata.fp_prev_size =
+                node_t(manager.open_block(prev_id)).info->size;
+        }
+        while (loader.ids.size() > 1) {
+            loader.internal(node_t::internal_capacity, fill_factor);
+            internal += loader.ids.size();
+            ++height;
+        }
+        // the single node on top takes the place of the root
+        if (height > 1) {
+            loader.move_to(root_id);
+            --internal;
+            --height;
+        }
+        size = end - begin;
+    }
+
     bool update(const key_type &key, const value_type &value) {
+        const auto guard = manager.pin();
         node_t leaf;
         key_type max;
         find_leaf_exclusive(leaf, key, max);
@@ -661,20 +1299,24 @@ class BTree {
         return true;
     }
 
-    bool reset_fast_path(node_t &leaf, key_type &leaf_max) {
-        // if leaf appends are enabled, we need to sort the fast-path
-        if constexpr (LEAF_APPENDS_ENABLED) {
-            if (!fp_sorted) {
-                mutexes[fp_metadata.fp_id].lock();
-                node_t fp_leaf(manager.open_block(fp_metadata.fp_id), LEAF);
-                sort_leaf(fp_leaf);
-                fp_sorted = true;
-                ++ctr_sort;
-                manager.mark_dirty(fp_metadata.fp_id);
-                mutexes[fp_metadata.fp_id].unlock();
-            }
-        }
+    /*
+        Whether the fast-path would move on to fp-next, should key land
+        there, in a soft reset: its key range has to be no wider than IKR
+        expects from the leaf before it, so the stream is likely to go on
+        in fp-next. Requires fp_mutex and fp_meta_mutex to be locked.
+    */
+    bool soft_reset(const key_type &key) const {
+        return fp_prev_metadata.fp_prev_id != INVALID_NODE_ID &&
+               fp_metadata.fp_id != tail_id && !(key < fp_metadata.fp_max) &&
+               dist(fp_metadata.fp_max, fp_metadata.fp_min) <
+                   IKR::upper_bound(dist(fp_metadata.fp_min,
+                                         fp_prev_metadata.fp_prev_min),
+                                    fp_prev_metadata.fp_prev_size,
+                                    fp_metadata.fp_size);
+    }
 
+    // the caller sorted the old fast-path, see try_sort_fast_path
+    bool reset_fast_path(node_t &leaf, key_type &leaf_max) {
         // update associated metadata
         if (fp_metadata.fp_id != tail_id &&
             leaf.keys[0] == fp_metadata.fp_max) {
@@ -694,6 +1336,7 @@ class BTree {
     }
 
     void insert(const key_type &key, const value_type &value) {
+        const auto guard = manager.pin();
         path_t path;
         uint16_t index;
         node_t leaf;
@@ -728,12 +1371,21 @@ class BTree {
                             end - start)
                             .count();
                 }
-                fp_metadata.fp_size++;
+                // an update of an existing key leaves the size as is
+                const bool grows_fp =
+                    index >= leaf.info->size || leaf.keys[index] != key;
                 // TODO: unlock fp_lock here - however, should check for
                 // in-order insert here
-                leaf_insert(leaf, index, key, value, true);
-                ++ctr_fast;
-                return;  // also unlocks fp_mutex
+                if (leaf_insert(leaf, index, key, value, true)) {
+                    if (grows_fp) {
+                        ++fp_metadata.fp_size;
+                    }
+                    ++ctr_fast;
+                    return;  // also unlocks fp_mutex
+                }
+                // the leaf is full after all; it is still latched, so sort
+                // and split it below
+                fp_metadata.fp_size = leaf.info->size;
             }
             // else block -> fast-path is will be at capacity needs to split
 
@@ -746,14 +1398,22 @@ class BTree {
                 }
             }
             ++ctr_fast_fail;
-            mutexes[fp_metadata.fp_id]
-                .unlock();  // unlock fast-path as it will be locked
-                            // by find_leaf_exclusive
-            // split case handled as a top-insert as both perform similar effort
-            find_leaf_exclusive(leaf, path, key, leaf_max);
+            // split from the latched leaf up if its cached path still holds,
+            // and as a top-insert otherwise
+            if (!latch_fast_path(leaf, key, path)) {
+                mutexes[fp_metadata.fp_id].unlock();
+                find_fast_path(leaf, path, key, leaf_max);
+            }
             index = leaf.value_slot(
                 key);  // we have to do this as leaf has been sorted
+            // sorting drops repeated keys, which may free a slot here
+            const bool grows_fp = leaf.info->id == fp_metadata.fp_id &&
+                                  (index >= leaf.info->size ||
+                                   leaf.keys[index] != key);
             if (leaf_insert(leaf, index, key, value, fast)) {
+                if (grows_fp) {
+                    ++fp_metadata.fp_size;
+                }
                 for (const auto &parent_id : path) {
                     mutexes[parent_id].unlock();
                 }
@@ -768,15 +1428,38 @@ class BTree {
             ++ctr_fast_fail;
             std::unique_lock fp_meta_lock(fp_meta_mutex);
             fast = false;
-            bool reset = life.failure();
-            if (!reset) {
-                // not resetting the fast-path so it's metadata can be unlocked
+            // a key that may land in fp-next does not count as a miss until
+            // its leaf tells whether the fast-path moves there, see below
+            const bool maybe_soft = soft_reset(key);
+            bool reset = !maybe_soft && life.failure();
+            if (reset) {
+                // the old fast-path may lie left of the leaf we latch next,
+                // and leaves are only latched left to right
+                sort_fast_path();
+            } else {
                 fp_lock.unlock();
             }
             // find the leaf node to insert into
             find_leaf_exclusive(leaf, key, leaf_max);
-            if (reset) {
-                ++ctr_hard;
+            // fp_mutex is only retaken now that the leaf is latched, so that
+            // misses do not descend one at a time. It comes after the leaf
+            // latch here and is only tried; skipping a soft reset is fine
+            bool soft = false;
+            if (maybe_soft && fp_lock.try_lock()) {
+                // the fast-path may have moved during the descent
+                soft = soft_reset(key) && leaf.info->size > 0 &&
+                       leaf.keys[0] == fp_metadata.fp_max;
+                reset = !soft && life.failure();
+                if ((soft || reset) && (fp_metadata.fp_id == leaf.info->id ||
+                                        !try_sort_fast_path())) {
+                    soft = reset = false;
+                }
+                if (!soft && !reset) {
+                    fp_lock.unlock();
+                }
+            }
+            if (soft || reset) {
+                ++(soft ? ctr_soft : ctr_hard);
                 // sets fast to true as we reset the fast-path
                 fast = reset_fast_path(
                     leaf,
@@ -784,10 +1467,14 @@ class BTree {
                                 // fast-path, and updates fast-path to leaf
             }
             index = leaf.value_slot(key);
+            // an update of an existing key leaves the size as is
+            const bool grows_fp = leaf.info->id == fp_metadata.fp_id &&
+                                  (index >= leaf.info->size ||
+                                   leaf.keys[index] != key);
             // attempt to insert into the leaf node
             if (leaf_insert(leaf, index, key, value, fast)) {
                 // if we inserted into the fast-path, update its size
-                if (leaf.info->id == fp_metadata.fp_id) {
+                if (grows_fp) {
                     ++fp_metadata.fp_size;
                 }
                 // insert was successful so we can complete the operation
@@ -925,8 +1612,141 @@ class BTree {
     //     split_insert(leaf, index, path, key, value, fast);
     // }
 
+    /*
+        Inserts the entries of batch, which it sorts by key, like insert one
+        by one would; the last of the entries with equal keys wins. Each run
+        of entries that belongs to the same leaf is merged into it in a single
+        pass under one latch, as far as it fits, holding fp_mutex and
+        fp_meta_mutex so the fast-path stays put. Runs in the fast-path skip
+        the search. The entry that finds the leaf full goes through insert,
+        which splits it.
+    */
+    void insert_batch(std::span<std::pair<key_type, value_type>> batch) {
+        const auto guard = manager.pin();
+        const size_t n = utils::bulk::prepare(batch);
+        node_t leaf;
+        for (size_t i = 0; i < n;) {
+            const auto &[key, value] = batch[i];
+            key_type leaf_max{};
+            std::unique_lock fp_lock(fp_mutex);
+            std::unique_lock fp_meta_lock(fp_meta_mutex);
+            const bool fast =
+                (fp_metadata.fp_id == head_id || fp_metadata.fp_min <= key) &&
+                (fp_metadata.fp_id == tail_id || key < fp_metadata.fp_max);
+            if (fast) {
+                mutexes[fp_metadata.fp_id].lock();
+                leaf.load(manager.open_block(fp_metadata.fp_id));
+                leaf_max = fp_metadata.fp_max;
+                life.success();
+                if constexpr (LEAF_APPENDS_ENABLED) {
+                    if (!fp_sorted) {
+                        sort_leaf(leaf);
+                        fp_sorted = true;
+                        ++ctr_sort;
+                    }
+                }
+            } else {
+                find_leaf_exclusive(leaf, key, leaf_max);
+            }
+            const size_t taken = leaf_merge(
+                leaf,
+                utils::bulk::run(batch.subspan(i, n - i),
+                                 leaf.info->id == tail_id ? nullptr
+                                                          : &leaf_max));
+            mutexes[leaf.info->id].unlock();
+            fp_meta_lock.unlock();
+            fp_lock.unlock();
+            if (fast) {
+                ctr_fast += taken;
+            }
+            if (taken == 0) {
+                insert(key, value);
+                ++i;
+            }
+            i += taken;
+        }
+    }
+
+    bool erase(const key_type &key) {
+        const auto guard = manager.pin();
+        {
+            // keeps fast-path inserts out, so the fast-path cannot move
+            std::shared_lock fp_lock(fp_mutex);
+            std::shared_lock fp_meta_lock(fp_meta_mutex);
+            sort_fast_path();
+            node_t leaf;
+            key_type leaf_max;
+            find_leaf_exclusive(leaf, key, leaf_max);
+            uint16_t index = leaf.value_slot(key);
+            if (index >= leaf.info->size || leaf.keys[index] != key) {
+                mutexes[leaf.info->id].unlock();
+                return false;
+            }
+            if (leaf.info->size > MIN_LEAF_SIZE) {
+                leaf_erase(leaf, index);
+                mutexes[leaf.info->id].unlock();
+                return true;
+            }
+            mutexes[leaf.info->id].unlock();
+        }
+        return erase_pessimistic(key);
+    }
+
+    bool erase_pessimistic(const key_type &key) {
+        const auto guard = manager.pin();
+        std::unique_lock fp_lock(fp_mutex);
+        std::unique_lock fp_meta_lock(fp_meta_mutex);
+        sort_fast_path();
+        node_t leaf;
+        path_t path;
+        find_leaf_erase(leaf, path, key);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            mutexes[leaf.info->id].unlock();
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            return false;
+        }
+        leaf_erase(leaf, index);
+        rebalance(leaf, path, key);
+        return true;
+    }
+
     uint32_t select_k(size_t count, const key_type &min_key) const {
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, min_key, version)) {
+                continue;
+            }
+            uint16_t curr_size = clamped_size(leaf, node_t::leaf_capacity);
+            uint16_t index =
+                utils::search::lower_bound(leaf.keys, curr_size, min_key);
+            uint32_t loads = 1;
+            size_t remaining = count;
+            bool valid = true;
+            curr_size -= index;
+            while (remaining > curr_size) {
+                remaining -= curr_size;
+                if (leaf.info->id == tail_id) {
+                    break;
+                }
+                node_id_t next_id = leaf.info->next_id;
+                if (!next_leaf_optimistic(leaf, version, next_id)) {
+                    valid = false;
+                    break;
+                }
+                curr_size = clamped_size(leaf, node_t::leaf_capacity);
+                ++loads;
+            }
+            if (valid && mutexes[leaf.info->id].validate(version)) {
+                return loads;
+            }
+        }
+#else
         find_leaf_shared(leaf, min_key);
         uint16_t index = leaf.value_slot(min_key);
         uint32_t loads = 1;
@@ -946,13 +1766,42 @@ class BTree {
         }
         mutexes[leaf.info->id].unlock_shared();
         return loads;
+#endif
     }
 
     uint32_t range(const key_type &min_key, const key_type &max_key) const {
-        uint32_t loads = 1;
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, min_key, version)) {
+                continue;
+            }
+            uint32_t loads = 1;
+            bool valid = true;
+            uint16_t curr_size = clamped_size(leaf, node_t::leaf_capacity);
+            while (curr_size > 0 && leaf.keys[curr_size - 1] < max_key) {
+                if (leaf.info->id == tail_id) {
+                    break;
+                }
+                node_id_t next_id = leaf.info->next_id;
+                if (!next_leaf_optimistic(leaf, version, next_id)) {
+                    valid = false;
+                    break;
+                }
+                curr_size = clamped_size(leaf, node_t::leaf_capacity);
+                ++loads;
+            }
+            if (valid && mutexes[leaf.info->id].validate(version)) {
+                return loads;
+            }
+        }
+#else
+        uint32_t loads = 1;
         find_leaf_shared(leaf, min_key);
-        while (leaf.keys[leaf.info->size - 1] < max_key) {
+        while (leaf.info->size > 0 &&
+               leaf.keys[leaf.info->size - 1] < max_key) {
             if (leaf.info->id == tail_id) {
                 break;
             }
@@ -965,20 +1814,268 @@ class BTree {
         }
         mutexes[leaf.info->id].unlock_shared();
         return loads;
+#endif
+    }
+
+    /*
+        Hands the entries with keys >= min_key to emit in key order, one leaf
+        at a time, as emit(keys, values) with two std::span of equal length.
+        Stops once emit returns false or the last leaf was read; returns the
+        number of leaves read. Each batch is copied out of its leaf, so emit
+        runs without a latch held. The scan then goes on after the last key
+        it emitted, from the root again if the leaf was merged away or
+        changed in a way that may have moved the following keys.
+    */
+    template <typename F>
+    uint32_t scan(const key_type &min_key, F &&emit) const {
+        const auto guard = manager.pin();
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = min_key;
+        // set once the entries up to bound were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+#ifdef OPTIMISTIC_READS
+        uint32_t version;
+        bool descend = true;
+        while (true) {
+            if (descend) {
+                if (!find_leaf_optimistic(leaf, bound, version)) {
+                    continue;
+                }
+                descend = false;
+                ++loads;
+            }
+            // only the fast-path leaf takes appends
+            const bool sorted =
+                !LEAF_APPENDS_ENABLED || leaf.info->id != fp_metadata.fp_id;
+            batch.copy(leaf.keys, leaf.values,
+                       clamped_size(leaf, node_t::leaf_capacity), sorted);
+            const bool last = leaf.info->id == tail_id;
+            const node_id_t next_id = leaf.info->next_id;
+            if (!mutexes[leaf.info->id].validate(version)) {
+                descend = true;
+                continue;
+            }
+            batch.seek(bound, after);
+            if (!batch.empty()) {
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.last();
+                after = true;
+            }
+            if (last) {
+                return loads;
+            }
+            // fails if the leaf changed while emit ran
+            descend = !next_leaf_optimistic(leaf, version, next_id);
+            loads += !descend;
+        }
+#else
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            // only the fast-path leaf takes appends
+            bool sorted = !LEAF_APPENDS_ENABLED || leaf_id != fp_metadata.fp_id;
+            batch.copy(leaf.keys, leaf.values, leaf.info->size, sorted);
+            batch.seek(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.last();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                sorted = !LEAF_APPENDS_ENABLED || leaf_id != fp_metadata.fp_id;
+                const utils::scan::step step = utils::scan::resume(
+                    leaf.keys, leaf.info->size, bound, sorted);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+                if (step == utils::scan::step::descend) {
+                    mutexes[leaf_id].unlock_shared();
+                    find_leaf_shared(leaf, bound);
+                    ++loads;
+                    continue;
+                }
+            }
+            if (leaf_id == tail_id) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            const node_id_t next_id = leaf.info->next_id;
+            mutexes[next_id].lock_shared();
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(next_id));
+            ++loads;
+        }
+#endif
+    }
+
+    /*
+        Hands the entries with keys <= max_key to emit like scan, but one leaf
+        at a time from right to left: the batches come in descending order,
+        while the keys within each batch ascend. Leaves are only latched
+        right to left with try_lock_shared; a scan that does not get the left
+        sibling drops its latch and descends from the root again, so it
+        cannot deadlock with writers or forward scans.
+    */
+    template <typename F>
+    uint32_t reverse_scan(const key_type &max_key, F &&emit) const {
+        const auto guard = manager.pin();
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = max_key;
+        // set once the entries from bound on were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+#ifdef OPTIMISTIC_READS
+        uint32_t version;
+        bool descend = true;
+        while (true) {
+            if (descend) {
+                if (!find_leaf_optimistic(leaf, bound, version)) {
+                    continue;
+                }
+                descend = false;
+                ++loads;
+            }
+            // only the fast-path leaf takes appends
+            const bool sorted =
+                !LEAF_APPENDS_ENABLED || leaf.info->id != fp_metadata.fp_id;
+            batch.copy(leaf.keys, leaf.values,
+                       clamped_size(leaf, node_t::leaf_capacity), sorted);
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (!mutexes[leaf.info->id].validate(version)) {
+                descend = true;
+                continue;
+            }
+            batch.seek_back(bound, after);
+            if (!batch.empty()) {
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.first();
+                after = true;
+            }
+            if (prev_id == INVALID_NODE_ID) {
+                return loads;
+            }
+            // fails if the leaf changed while emit ran
+            descend = !next_leaf_optimistic(leaf, version, prev_id);
+            loads += !descend;
+        }
+#else
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            // only the fast-path leaf takes appends
+            bool sorted = !LEAF_APPENDS_ENABLED || leaf_id != fp_metadata.fp_id;
+            batch.copy(leaf.keys, leaf.values, leaf.info->size, sorted);
+            batch.seek_back(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.first();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                sorted = !LEAF_APPENDS_ENABLED || leaf_id != fp_metadata.fp_id;
+                const utils::scan::step step = utils::scan::resume_back(
+                    leaf.keys, leaf.info->size, bound, sorted);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+                if (step == utils::scan::step::descend) {
+                    mutexes[leaf_id].unlock_shared();
+                    find_leaf_shared(leaf, bound);
+                    ++loads;
+                    continue;
+                }
+            }
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (prev_id == INVALID_NODE_ID) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            if (!mutexes[prev_id].try_lock_shared()) {
+                mutexes[leaf_id].unlock_shared();
+                find_leaf_shared(leaf, bound);
+                ++loads;
+                continue;
+            }
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(prev_id));
+            ++loads;
+        }
+#endif
+    }
+
+    // reads the count largest entries with keys <= max_key
+    uint32_t select_k_desc(size_t count, const key_type &max_key) const {
+        return reverse_scan(max_key, [&](auto keys, auto) {
+            count -= std::min(count, keys.size());
+            return count > 0;
+        });
     }
 
     std::optional<value_type> get(const key_type &key) const {
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, key, version)) {
+                continue;
+            }
+            const std::optional<value_type> result =
+                leaf_get(leaf, key, clamped_size(leaf, node_t::leaf_capacity));
+            if (mutexes[leaf.info->id].validate(version)) {
+                return result;
+            }
+        }
+#else
         find_leaf_shared(leaf, key);
         std::shared_lock lock(mutexes[leaf.info->id], std::adopt_lock);
-        uint16_t index = leaf.value_slot(key);
-        return index < leaf.info->size &&
-               (leaf.keys[index] == key ? std::make_optional(leaf.values[index])
-                                        : std::nullopt);
+        return leaf_get(leaf, key, leaf.info->size);
+#endif
     }
 
     bool contains(const key_type &key) const {
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, key, version)) {
+                continue;
+            }
+            const uint16_t leaf_size =
+                clamped_size(leaf, node_t::leaf_capacity);
+            bool result = false;
+            if (leaf.info->id != fp_metadata.fp_id) {
+                uint16_t index =
+                    utils::search::lower_bound(leaf.keys, leaf_size, key);
+                result = index < leaf_size && (leaf.keys[index] == key);
+            } else {
+                // do a linear scan of node
+                for (uint16_t i = 0; i < leaf_size; i++) {
+                    if (leaf.keys[i] == key) {
+                        result = true;
+                        break;
+                    }
+                }
+            }
+            if (mutexes[leaf.info->id].validate(version)) {
+                return result;
+            }
+        }
+#else
         find_leaf_shared(leaf, key);
         std::shared_lock lock(mutexes[leaf.info->id], std::adopt_lock);
         if (leaf.info->id != fp_metadata.fp_id) {
@@ -993,6 +2090,100 @@ class BTree {
             }
             return false;
         }
+#endif
+    }
+
+    /*
+        Looks up every key of keys into the same position of out, like get.
+        The lookups go down the tree in groups, one level per round. Each
+        prefetches the child it moves to and only latches it, or reads its
+        version, in the next round, so the cache misses of a group overlap.
+        A lookup keeps its parent latched while the others take their turn,
+        so it only try-locks the child; one that does not get it, or fails
+        validation, is left to get once the group is done.
+    */
+    void multi_get(std::span<const key_type> keys,
+                   std::span<std::optional<value_type>> out) const {
+        constexpr size_t group_size = utils::lookup::group_size;
+        // the node each lookup latched or read the version of, and its child
+        node_id_t parents[group_size];
+        node_id_t children[group_size];
+#ifdef OPTIMISTIC_READS
+        uint32_t versions[group_size];
+#endif
+        // positions in keys of the lookups left to get
+        size_t retries[group_size];
+        node_t node;
+        for (size_t begin = 0; begin < keys.size(); begin += group_size) {
+            const auto guard = manager.pin();
+            const size_t n = std::min(group_size, keys.size() - begin);
+            std::fill_n(parents, n, INVALID_NODE_ID);
+            std::fill_n(children, n, root_id);
+            size_t pending = n;
+            size_t num_retries = 0;
+            while (pending > 0) {
+                for (size_t i = 0; i < n; ++i) {
+                    const node_id_t node_id = children[i];
+                    if (node_id == INVALID_NODE_ID) {
+                        continue;
+                    }
+                    const node_id_t parent_id = parents[i];
+                    const key_type &key = keys[begin + i];
+#ifdef OPTIMISTIC_READS
+                    const uint32_t version = mutexes[node_id].read_lock();
+                    bool valid = parent_id == INVALID_NODE_ID ||
+                                 mutexes[parent_id].validate(versions[i]);
+                    node.load(manager.open_block(node_id));
+                    if (valid && node.info->type == bp_node_type::INTERNAL) {
+                        const uint16_t slot = utils::search::upper_bound(
+                            node.keys,
+                            clamped_size(node, node_t::internal_capacity), key);
+                        const node_id_t child_id = node.children[slot];
+                        if (mutexes[node_id].validate(version)) {
+                            parents[i] = node_id;
+                            versions[i] = version;
+                            children[i] = child_id;
+                            mutexes.prefetch(child_id);
+                            node_t::prefetch(manager.open_block(child_id));
+                            continue;
+                        }
+                        valid = false;
+                    }
+                    if (valid) {
+                        const uint16_t leaf_size =
+                            clamped_size(node, node_t::leaf_capacity);
+                        out[begin + i] = leaf_get(node, key, leaf_size);
+                        valid = mutexes[node_id].validate(version);
+                    }
+#else
+                    const bool valid = mutexes[node_id].try_lock_shared();
+                    if (parent_id != INVALID_NODE_ID) {
+                        mutexes[parent_id].unlock_shared();
+                    }
+                    if (valid) {
+                        node.load(manager.open_block(node_id));
+                        if (node.info->type == bp_node_type::INTERNAL) {
+                            parents[i] = node_id;
+                            children[i] = node.children[node.child_slot(key)];
+                            mutexes.prefetch(children[i]);
+                            node_t::prefetch(manager.open_block(children[i]));
+                            continue;
+                        }
+                        out[begin + i] = leaf_get(node, key, node.info->size);
+                        mutexes[node_id].unlock_shared();
+                    }
+#endif
+                    if (!valid) {
+                        retries[num_retries++] = begin + i;
+                    }
+                    children[i] = INVALID_NODE_ID;
+                    --pending;
+                }
+            }
+            for (size_t i = 0; i < num_retries; ++i) {
+                out[retries[i]] = get(keys[retries[i]]);
+            }
+        }
     }
 };
 }  // namespace ConcurrentQuITBTreeAppends
@@ -1,54 +1,93 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <mutex>
 #include <optional>
 #include <ranges>
 #include <shared_mutex>
+#include <span>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "../MemoryBlockManager.hpp"
 #include "BTreeNode.hpp"
+#include "bulk.hpp"
 #include "ikr.h"
+#include "latch_table.hpp"
+#include "lookup.hpp"
+#include "mtx.hpp"
+#include "scan.hpp"
 #include "sort.hpp"
+#include "sortedness.hpp"
+
+// number of fast-paths of a tree, one per near-sorted stream of inserts
+#ifndef FAST_PATHS
+#define FAST_PATHS 1
+#endif
+
+// entries of the buffer that stages keys arriving just behind a fast-path,
+// none turns staging off
+#ifndef STAGING_BUFFER
+#define STAGING_BUFFER 0
+#endif
 
 namespace ConcurrentQuITBTreeAtomic {
+#ifdef OPTIMISTIC_READS
+using latch_t = olc::shared_mutex;
+#else
+using latch_t = std::shared_mutex;
+#endif
+
 struct reset_stats {
-    uint8_t fails;
-    uint8_t threshold;
+    std::atomic<uint8_t> fails;
+    // tuned by the sortedness estimator while inserts run
+    std::atomic<uint8_t> threshold;
 
     explicit reset_stats(uint8_t t) {
         fails = 0;
         threshold = t;
     }
 
-    void success() { fails = 0; }
+    // only write the shared counter when it actually changes
+    void success() {
+        if (fails.load(std::memory_order_relaxed)) {
+            fails.store(0, std::memory_order_relaxed);
+        }
+    }
 
     bool failure() {
-        fails++;
-        if (fails >= threshold) {
-            return true;
-        }
-        return false;
+        return fails.fetch_add(1, std::memory_order_relaxed) + 1 >=
+               threshold.load(std::memory_order_relaxed);
     }
 
-    void reset() { fails = 0; }
+    void reset() { fails.store(0, std::memory_order_relaxed); }
 };
 
 template <typename key_type, typename value_type,
-          bool LEAF_APPENDS_ENABLED = false>
+          bool LEAF_APPENDS_ENABLED = false, typename latch_type = latch_t>
 class BTree {
    public:
     using node_id_t = uint32_t;
     using BlockManager = InMemoryBlockManager<node_id_t>;
+#ifdef EMBEDDED_LATCHES
+    using node_t = BTreeNode<node_id_t, key_type, value_type,
+                             BlockManager::block_size, latch_type>;
+    using latches_t = embedded_latch_table<node_t, BlockManager>;
+#else
     using node_t =
         BTreeNode<node_id_t, key_type, value_type, BlockManager::block_size>;
+    using latches_t = latch_table<latch_type, BlockManager>;
+#endif
     using step = node_id_t;
     using path_t = std::vector<step>;
 
@@ -78,7 +117,15 @@ class BTree {
                 {"soft_resets", ctr_soft},
                 {"hard_resets", ctr_hard},
                 {"fast_inserts_fail", ctr_fast_fail},
-                {"sort", ctr_sort}};
+                {"sort", ctr_sort},
+                {"staged_inserts", ctr_staged},
+                {"cached_path_splits", ctr_cached_path},
+                {"out_of_order_permille",
+                 std::llround(sortedness.out_of_order() * 1000)},
+                {"displacement", std::llround(sortedness.displacement())},
+                {"reset_threshold", sortedness.reset_threshold()},
+                {"ikr_upper_permille",
+                 std::llround(1000 / sortedness.ikr_bound())}};
     }
 
     std::unordered_map<std::string, uint64_t> get_profiling_times() {
@@ -94,16 +141,22 @@ class BTree {
     static constexpr uint16_t SPLIT_INTERNAL_POS =
         node_t::internal_capacity / 2;
     static constexpr uint16_t SPLIT_LEAF_POS = (node_t::leaf_capacity + 1) / 2;
+    // nodes below these sizes borrow from or merge with a sibling
+    static constexpr uint16_t MIN_LEAF_SIZE = node_t::leaf_capacity / 4;
+    static constexpr uint16_t MIN_INTERNAL_SIZE = node_t::internal_capacity / 4;
     static constexpr uint16_t IQR_SIZE_THRESH = SPLIT_LEAF_POS;
     static constexpr node_id_t INVALID_NODE_ID = -1;
+    static constexpr size_t NUM_FAST_PATHS = FAST_PATHS;
+    static_assert(NUM_FAST_PATHS > 0);
+    static constexpr uint16_t STAGING_CAPACITY = STAGING_BUFFER;
 
     dist_f dist;
 
     BlockManager &manager;
-    mutable std::vector<std::shared_mutex> mutexes;
+    mutable latches_t mutexes;
     const node_id_t root_id;
     node_id_t head_id;
-    node_id_t tail_id;
+    std::atomic<node_id_t> tail_id;
 
     struct fast_path_metadata {
         node_id_t fp_id;
@@ -124,27 +177,133 @@ class BTree {
         }
     };
 
-    mutable std::shared_mutex fp_mutex;
-    fast_path_metadata fp_metadata;
+    /*
+        Seqlock around the fast-path metadata. Writers hold fp_mutex and make
+        the version odd while they update the fields; readers never block,
+        they retry until they copy all fields under the same even version.
+        fp_mutex is always acquired after any node latch.
+    */
+    struct versioned_fast_path_metadata {
+        std::atomic<uint32_t> version{};
+        std::atomic<node_id_t> fp_id;
+        std::atomic<key_type> fp_min;
+        std::atomic<key_type> fp_max;
+        std::atomic<uint16_t> fp_size;
+
+        fast_path_metadata load(uint32_t &v) const {
+            fast_path_metadata snapshot;
+            do {
+                v = version.load(std::memory_order_acquire);
+                snapshot.fp_id = fp_id.load(std::memory_order_relaxed);
+                snapshot.fp_min = fp_min.load(std::memory_order_relaxed);
+                snapshot.fp_max = fp_max.load(std::memory_order_relaxed);
+                snapshot.fp_size = fp_size.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((v & 1) || v != version.load(std::memory_order_relaxed));
+            return snapshot;
+        }
+
+        fast_path_metadata load() const {
+            uint32_t v;
+            return load(v);
+        }
 
-    // mutable std::shared_mutex fp_meta_mutex;
-    // fast_path_helper_metadata fp_prev_metadata;
-    std::atomic<fast_path_helper_metadata> fp_prev_metadata;
+        bool validate(uint32_t v) const {
+            return version.load(std::memory_order_acquire) == v;
+        }
 
-    uint8_t height;
+        // requires fp_mutex
+        void store(const fast_path_metadata &m) {
+            const uint32_t v = version.load(std::memory_order_relaxed);
+            version.store(v + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            fp_id.store(m.fp_id, std::memory_order_relaxed);
+            fp_min.store(m.fp_min, std::memory_order_relaxed);
+            fp_max.store(m.fp_max, std::memory_order_relaxed);
+            fp_size.store(m.fp_size, std::memory_order_relaxed);
+            version.store(v + 2, std::memory_order_release);
+        }
+    };
+
+    // the slots of a leaf with appends before sorted are in key order, the
+    // ones appended after them carry the tag of their key in tags
+    struct appended_entries {
+        std::atomic<uint16_t> sorted{};
+        std::array<uint8_t, node_t::leaf_capacity> tags{};
+    };
+
+    /*
+        One fast-path: its leaf and key range, the leaf before it for the IKR
+        split heuristic, its own reset counter and, in appends mode, the
+        state of the appends to its leaf. A fast-path without a leaf has
+        fp_id INVALID_NODE_ID and an empty key range.
+    */
+    struct fast_path {
+        versioned_fast_path_metadata fp_metadata;
+        std::atomic<fast_path_helper_metadata> fp_prev_metadata;
+        reset_stats life{static_cast<uint8_t>(sqrt(node_t::leaf_capacity))};
+        std::atomic<bool> fp_sorted{true};
+        // next free slot of the fast-path leaf in appends mode, only reset
+        // while the fast-path leaf is locked exclusively
+        std::atomic<uint32_t> fp_slot{};
+        appended_entries fp_appends;
+        // the internal nodes from the root down to the fast-path leaf, as
+        // of fp_path_version of internal_retired. Guarded by fp_mutex
+        path_t fp_path;
+        uint32_t fp_path_version{};
+    };
+
+    // guards the metadata of all fast-paths, so no two share a leaf
+    std::mutex fp_mutex;
+    std::array<fast_path, NUM_FAST_PATHS> fast_paths;
 
-    reset_stats life;
+    uint8_t height;
 
-    std::atomic<bool> fp_sorted{};
+    // out of order share and displacement of the inserts, which tune the
+    // reset threshold of the fast-paths and the IKR bound
+    utils::sortedness::estimator sortedness{node_t::leaf_capacity};
 
     std::atomic<uint32_t> ctr_fast{};
     std::atomic<uint32_t> ctr_fast_fail{};
     std::atomic<uint32_t> ctr_hard{};
     std::atomic<uint32_t> ctr_sort{};
-    std::atomic<uint32_t> fp_slot{};
+    std::atomic<uint32_t> ctr_staged{};
+    std::atomic<uint32_t> ctr_cached_path{};
+
+    // bumped while a retired internal node is still latched, so that cached
+    // paths through it fail validation before it can be reused
+    std::atomic<uint32_t> internal_retired{};
+
+    /*
+        Keys that arrived just behind a fast-path, in key order, until they
+        are merged into the tree with insert_batch. size is only written
+        under the exclusive latch, so readers that find it zero can skip
+        the buffer.
+    */
+    struct staging_buffer {
+        std::shared_mutex mutex;
+        std::atomic<uint16_t> size{};
+        std::array<key_type, STAGING_CAPACITY> keys;
+        std::array<value_type, STAGING_CAPACITY> values;
+    };
+    mutable staging_buffer staging;
+
+    /*
+        The last fast-path leaf that was left unsorted when the fast-path
+        moved on, if any, and its appended entries. The sorter thread sorts
+        it unless a writer that latches it exclusively gets there first.
+    */
+    std::atomic<node_id_t> retired_id{INVALID_NODE_ID};
+    appended_entries retired_appends;
+    std::mutex retired_mutex;
+    std::condition_variable_any retired_cv;
+
     mutable std::atomic<uint32_t> ctr_root_shared{};
     mutable uint32_t ctr_root_unique{};
     uint32_t ctr_root{};
+    // entries in the tree. A key appended again to a fast-path leaf counts
+    // once per copy until sort_leaf drops the older copies, so size runs
+    // ahead by the copies in leaves that are still unsorted
     std::atomic<uint32_t> size{};
     std::atomic<uint32_t> leaves{};
     std::atomic<uint32_t> internal{};
@@ -152,9 +311,12 @@ class BTree {
     std::atomic<uint32_t> ctr_soft{};
 
     // timers for profiling
-    long long find_leaf_slot_time = 0;
-    long long move_in_leaf_time = 0;
-    long long sort_time = 0;
+    std::atomic<long long> find_leaf_slot_time{};
+    std::atomic<long long> move_in_leaf_time{};
+    std::atomic<long long> sort_time{};
+
+    // declared last so that it stops before anything it uses goes away
+    std::jthread sorter;
 
     void create_new_root(const key_type &key, node_id_t right_node_id) {
         ++ctr_root;
@@ -162,8 +324,12 @@ class BTree {
         node_t root(manager.open_block(root_id));
         node_t left_node(manager.open_block(left_node_id));
         ++internal;
-        std::memcpy(left_node.info, root.info, node_t::block_size);
+        // a raw copy of the block, so an embedded latch comes along held and
+        // is reset below
+        std::memcpy(static_cast<void *>(left_node.info), root.info,
+                    BlockManager::block_size);
         left_node.info->id = left_node_id;
+        mutexes.reset(left_node_id);
         manager.mark_dirty(left_node_id);
 
         manager.mark_dirty(root_id);
@@ -189,8 +355,138 @@ class BTree {
         } while (node.info->type == INTERNAL);
     }
 
+    /*
+        Position of key among the first n entries of a leaf with appends, or
+        n. The sorted entries are searched, the appended ones probed through
+        their tags, so neither needs the leaf to be sorted.
+    */
+    static uint16_t appended_slot(const node_t &leaf, const key_type &key,
+                                  uint16_t n,
+                                  const appended_entries &appends) {
+        const uint16_t sorted =
+            std::min(appends.sorted.load(std::memory_order_relaxed), n);
+        // a key appended again has its latest write in the last copy
+        uint16_t last = n;
+        for (uint16_t i = sorted; i < n; ++i) {
+            i += utils::search::find_tagged(appends.tags.data() + i,
+                                            leaf.keys + i, n - i, key);
+            if (i < n) {
+                last = i;
+            }
+        }
+        if (last < n) {
+            return last;
+        }
+        const uint16_t index =
+            utils::search::lower_bound(leaf.keys, sorted, key);
+        if (index < sorted && leaf.keys[index] == key) {
+            return index;
+        }
+        return n;
+    }
+
+    // the fast-path whose leaf is leaf_id, if any
+    fast_path *fast_path_of(node_id_t leaf_id) {
+        for (auto &fpath : fast_paths) {
+            if (fpath.fp_metadata.fp_id == leaf_id) {
+                return &fpath;
+            }
+        }
+        return nullptr;
+    }
+
+    const fast_path *fast_path_of(node_id_t leaf_id) const {
+        return const_cast<BTree *>(this)->fast_path_of(leaf_id);
+    }
+
+    // whether the entries of the leaf may be out of key order
+    bool has_appends(node_id_t leaf_id) const {
+        return LEAF_APPENDS_ENABLED && (fast_path_of(leaf_id) != nullptr ||
+                                        leaf_id == retired_id.load());
+    }
+
+    // requires leaf to be latched, or its version to be validated after
+    std::optional<value_type> leaf_get(const node_t &leaf, const key_type &key,
+                                       uint16_t n) const {
+        const fast_path *fpath =
+            LEAF_APPENDS_ENABLED ? fast_path_of(leaf.info->id) : nullptr;
+        uint16_t index;
+        if (fpath != nullptr) {
+            index = appended_slot(leaf, key, n, fpath->fp_appends);
+        } else if (LEAF_APPENDS_ENABLED && leaf.info->id == retired_id) {
+            index = appended_slot(leaf, key, n, retired_appends);
+        } else {
+            index = utils::search::lower_bound(leaf.keys, n, key);
+        }
+        if (index < n && leaf.keys[index] == key) {
+            return leaf.values[index];
+        }
+        return std::nullopt;
+    }
+
+#ifdef OPTIMISTIC_READS
+    // sizes read optimistically may be garbage, keep searches inside the node
+    static uint16_t clamped_size(const node_t &node, uint16_t capacity) {
+        return std::min(committed_size(node), capacity);
+    }
+
+    /*
+        Optimistic lock coupling: descends to the leaf responsible for key
+        without writing to any latch. A child is only entered once the
+        parent's version validated after reading the child id, and again after
+        reading the child's version. Returns false on a conflict with a writer;
+        otherwise version has to be validated once the caller is done reading
+        the leaf.
+    */
+    bool find_leaf_optimistic(node_t &node, const key_type &key,
+                              uint32_t &version) const {
+        node_id_t node_id = root_id;
+        version = mutexes[node_id].read_lock();
+        node.load(manager.open_block(node_id));
+        do {
+            const uint16_t slot = utils::search::upper_bound(
+                node.keys, clamped_size(node, node_t::internal_capacity), key);
+            const node_id_t child_id = node.children[slot];
+            if (!mutexes[node_id].validate(version)) {
+                return false;
+            }
+            const uint32_t child_version = mutexes[child_id].read_lock();
+            if (!mutexes[node_id].validate(version)) {
+                return false;
+            }
+            node_id = child_id;
+            version = child_version;
+            node.load(manager.open_block(node_id));
+        } while (node.info->type == INTERNAL);
+        return true;
+    }
+
+    /*
+        Moves an optimistic reader from leaf to its sibling next_id, on
+        either side. Returns false if leaf changed since version was taken.
+    */
+    bool next_leaf_optimistic(node_t &leaf, uint32_t &version,
+                              node_id_t next_id) const {
+        if (!mutexes[leaf.info->id].validate(version)) {
+            return false;
+        }
+        const uint32_t next_version = mutexes[next_id].read_lock();
+        if (!mutexes[leaf.info->id].validate(version)) {
+            return false;
+        }
+        version = next_version;
+        leaf.load(manager.open_block(next_id));
+        return true;
+    }
+#endif
+
+    /*
+        Descends to the leaf of key, latching the unsafe part of the path
+        exclusively. trail, if given, gets every internal node on the way.
+    */
     void find_leaf_exclusive(node_t &node, path_t &path, const key_type &key,
-                             key_type &leaf_max) const {
+                             key_type &leaf_max,
+                             path_t *trail = nullptr) const {
         node_id_t node_id = root_id;
 
         mutexes[node_id].lock();
@@ -206,6 +502,9 @@ class BTree {
                 path.clear();
             }
             path.push_back(node_id);
+            if (trail != nullptr) {
+                trail->push_back(node_id);
+            }
             uint16_t slot = node.child_slot(key);
 
             if (slot != node.info->size) {
@@ -327,7 +626,8 @@ class BTree {
                             (index - node.info->size) * sizeof(uint32_t));
                 std::memcpy(new_node.children + 1 + index - node.info->size,
                             node.children + 1 + index,
-                            new_node.info->size * sizeof(uint32_t));
+                            (node_t::internal_capacity - index) *
+                                sizeof(uint32_t));
                 new_node.children[index - node.info->size] = child_id;
 
                 key = node.keys[node.info->size];
@@ -342,40 +642,8 @@ class BTree {
         mutexes[root_id].unlock();
     }
 
-    /*
-        Function to update fast-path metadata upon leaf insert
-        Requires:
-            (1) leaf to be locked
-            (2) fp_mutex to be locked
-            (3) fp_meta_mutex to be locked
-    */
-    void update_fp_metadata_with_leaf_insert(node_t &leaf) {
-        if (leaf.info->next_id == fp_metadata.fp_id) {
-            // if inserting to fast_prev
-            // fp_prev_metadata.fp_prev_id = leaf.info->id;
-            // fp_prev_metadata.fp_prev_min = leaf.keys[0];
-            // fp_prev_metadata.fp_prev_size = leaf.info->size;
-
-            // update fp_prev_metadata
-            fast_path_helper_metadata new_metadata = {
-                leaf.info->id, leaf.keys[0], leaf.info->size};
-            fast_path_helper_metadata expected_metadata =
-                fp_prev_metadata.load();
-            // atomically exchange metadata
-            // do {
-            //     // Attempt to update the metadata
-            // } while (!fp_prev_metadata.compare_exchange_strong(
-            //     expected_metadata, new_metadata));
-            while (!fp_prev_metadata.compare_exchange_strong(expected_metadata,
-                                                             new_metadata)) {
-            }
-        }
-    }
-
-    bool leaf_insert(
-        node_t &leaf, uint16_t index, const key_type &key,
-        const value_type &value, bool fast,
-        std::function<void(node_t &l)> update_associated_metadata = nullptr) {
+    bool leaf_insert(node_t &leaf, uint16_t index, const key_type &key,
+                     const value_type &value, bool fast) {
         if (index < leaf.info->size && leaf.keys[index] == key) {
             manager.mark_dirty(leaf.info->id);
             leaf.values[index] = value;
@@ -388,9 +656,11 @@ class BTree {
             return false;
         }
 
-        if (fast && fp_sorted) {
-            if (leaf.keys[index - 1] > key) {
-                fp_sorted = false;
+        fast_path *fpath = fast_path_of(leaf.info->id);
+        if (fast && fpath != nullptr && fpath->fp_sorted) {
+            // an equal key is a second copy, which only the sort drops
+            if (index > 0 && leaf.keys[index - 1] >= key) {
+                fpath->fp_sorted = false;
             }
         }
 
@@ -406,48 +676,76 @@ class BTree {
                          (leaf.info->size - index) * sizeof(value_type));
             std::chrono::high_resolution_clock::time_point end =
                 std::chrono::high_resolution_clock::now();
-            move_in_leaf_time +=
+            move_in_leaf_time.fetch_add(
                 std::chrono::duration_cast<std::chrono::nanoseconds>(end -
                                                                      start)
-                    .count();
+                    .count(),
+                std::memory_order_relaxed);
         }
         leaf.keys[index] = key;
         leaf.values[index] = value;
         ++leaf.info->size;
+        if constexpr (LEAF_APPENDS_ENABLED) {
+            if (fpath != nullptr) {
+                reset_appends(*fpath, leaf.info->size);
+            }
+        }
 
-        if (fast) {
-            if (leaf.info->next_id == fp_metadata.fp_id) {
-                // WARN: Check if this block is ever accessed
-                // fp_prev_metadata.fp_prev_id = leaf.info->id;
-                // fp_prev_metadata.fp_prev_min = leaf.keys[0];
-                // fp_prev_metadata.fp_prev_size = leaf.info->size;
-
-                // update fp_prev_metadata
-                fast_path_helper_metadata new_metadata = {
-                    leaf.info->id, leaf.keys[0], leaf.info->size};
-                fast_path_helper_metadata expected_metadata =
-                    fp_prev_metadata.load();
-                // atomically exchange metadata
-                // do {
-                //     // Attempt to update the metadata
-                // } while (!fp_prev_metadata.compare_exchange_strong(
-                //     expected_metadata, new_metadata));
-                while (!fp_prev_metadata.compare_exchange_strong(
-                    expected_metadata, new_metadata)) {
-                }
-            }
-        }
-
-        // if (update_associated_metadata) {
-        //     // requires fp_mutex and fp_meta_mutex to be locked
-        //     // and unlocked by caller
-        //     update_associated_metadata(leaf);
-        // }
+        // the leaf before a fast-path keeps its size there up to date, the
+        // same whichever way the insert came, as the sequential QuIT does.
+        // redistribute() relies on it once a hard reset dropped it. While
+        // we hold the leaf, only the fast-path moving away can change the
+        // leaf before it, and it stores its new predecessor after bumping
+        // the version: one stored since we checked the version fails the
+        // exchange, so this needs no fp_mutex
+        for (auto &next : fast_paths) {
+            uint32_t v;
+            if (leaf.info->next_id != next.fp_metadata.load(v).fp_id) {
+                continue;
+            }
+            auto prev = next.fp_prev_metadata.load();
+            if (next.fp_metadata.validate(v)) {
+                next.fp_prev_metadata.compare_exchange_strong(
+                    prev, {leaf.info->id, leaf.keys[0], leaf.info->size});
+            }
+        }
 
         mutexes[leaf.info->id].unlock();
         return true;
     }
 
+    /*
+        Merges as many entries from the front of run, whose keys all belong to
+        the exclusively latched and sorted leaf, into it as fit. Returns how
+        many entries it took.
+    */
+    size_t leaf_merge(node_t &leaf,
+                      std::span<std::pair<key_type, value_type>> run) {
+        const auto [taken, total] = utils::bulk::fitting(
+            leaf.keys, leaf.info->size, run, node_t::leaf_capacity);
+        if (taken == 0) {
+            return 0;
+        }
+        size += total - leaf.info->size;
+        manager.mark_dirty(leaf.info->id);
+        utils::bulk::merge(leaf.keys, leaf.values, leaf.info->size,
+                           run.first(taken), total);
+        leaf.info->size = total;
+        for (auto &fpath : fast_paths) {
+            const node_id_t fp_id = fpath.fp_metadata.fp_id;
+            if (leaf.info->id == fp_id) {
+                if constexpr (LEAF_APPENDS_ENABLED) {
+                    reset_appends(fpath, total);
+                }
+            } else if (leaf.info->id != tail_id &&
+                       leaf.info->next_id == fp_id) {
+                fpath.fp_prev_metadata.store({leaf.info->id, leaf.keys[0],
+                                              static_cast<uint16_t>(total)});
+            }
+        }
+        return taken;
+    }
+
     void std_sort_leaf(node_t &leaf) {
         std::array<std::pair<key_type, value_type>, node_t::leaf_capacity> kvs;
         for (uint16_t i = 0; i < leaf.info->size; i++) {
@@ -462,108 +760,328 @@ class BTree {
         }
     }
 
+    /*
+        Sorts a leaf with appends. Appends do not look for an earlier copy of
+        their key, so the sort keeps only the last write of each key.
+        Requires the leaf to be locked exclusively.
+    */
     void sort_leaf(node_t &leaf) {
         auto start = std::chrono::high_resolution_clock::now();
 
-        int depth_limit = 2 * std::log2(leaf.info->size);
-        utils::sort::introsort(leaf.keys, leaf.values, 0, leaf.info->size - 1,
-                               depth_limit);
+        const uint16_t n = leaf.info->size;
+        leaf.info->size = utils::sort::leaf_unique<node_t::leaf_capacity>(
+            leaf.keys, leaf.values, n);
+        size -= n - leaf.info->size;
 
         auto end = std::chrono::high_resolution_clock::now();
-        sort_time +=
+        sort_time.fetch_add(
             std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
-                .count();
+                .count(),
+            std::memory_order_relaxed);
+    }
+
+    /*
+        Appended fast-path leaves, and the retired one, have to be sorted
+        before any positional access (value_slot). Requires the leaf to be
+        locked exclusively; the fast-path cannot move away from a leaf while
+        it is locked.
+    */
+    void sort_if_fast_path(node_t &leaf) {
+        if constexpr (LEAF_APPENDS_ENABLED) {
+            fast_path *fpath = fast_path_of(leaf.info->id);
+            if (fpath != nullptr && !fpath->fp_sorted) {
+                sort_leaf(leaf);
+                reset_appends(*fpath, leaf.info->size);
+                fpath->fp_sorted = true;
+                ++ctr_sort;
+                manager.mark_dirty(leaf.info->id);
+            } else if (leaf.info->id == retired_id) {
+                sort_leaf(leaf);
+                retired_id = INVALID_NODE_ID;
+                ++ctr_sort;
+                manager.mark_dirty(leaf.info->id);
+            }
+        }
+    }
+
+    /*
+        Hands the unsorted fast-path leaf that the fast-path moves away from
+        to the sorter thread, along with its appended entries, instead of
+        sorting it on the insert path. Requires the leaf to be locked
+        exclusively and fp_mutex. Returns false if the sorter has yet to get
+        to the leaf retired before.
+    */
+    bool retire(const fast_path &fpath, const node_t &leaf) {
+        if (retired_id != INVALID_NODE_ID) {
+            return false;
+        }
+        const uint16_t sorted = fpath.fp_appends.sorted;
+        retired_appends.sorted = sorted;
+        std::copy(fpath.fp_appends.tags.begin() + sorted,
+                  fpath.fp_appends.tags.begin() + leaf.info->size,
+                  retired_appends.tags.begin() + sorted);
+        {
+            std::lock_guard lock(retired_mutex);
+            retired_id = leaf.info->id;
+        }
+        retired_cv.notify_one();
+        return true;
+    }
+
+    // body of the sorter thread, see retired_id
+    void sort_retired(std::stop_token stop) {
+        while (true) {
+            {
+                std::unique_lock lock(retired_mutex);
+                if (!retired_cv.wait(lock, stop, [this] {
+                        return retired_id != INVALID_NODE_ID;
+                    })) {
+                    return;
+                }
+            }
+            // pinned before the id is read, the leaf cannot go away under us
+            const auto guard = manager.pin();
+            const node_id_t id = retired_id;
+            if (id == INVALID_NODE_ID) {
+                continue;
+            }
+            mutexes[id].lock();
+            node_t leaf(manager.open_block(id));
+            sort_if_fast_path(leaf);
+            mutexes[id].unlock();
+        }
+    }
+
+    /*
+        Appends to the fast-path leaf while it is only locked shared: the slot
+        is reserved with fp_slot, filled, and then committed in slot order by
+        publishing the new leaf size, so that readers and the eventual sort or
+        split (both need the leaf exclusively) only see a filled prefix.
+        Requires the leaf to be locked shared and to be the leaf of fpath.
+        Returns false if the leaf is full.
+    */
+    bool append(fast_path &fpath, node_t &leaf, const key_type &key,
+                const value_type &value) {
+        const uint32_t slot =
+            fpath.fp_slot.fetch_add(1, std::memory_order_relaxed);
+        if (slot >= node_t::leaf_capacity) {
+            return false;
+        }
+        leaf.keys[slot] = key;
+        leaf.values[slot] = value;
+        fpath.fp_appends.tags[slot] = utils::search::tag(key);
+
+        std::atomic_ref<uint16_t> committed(leaf.info->size);
+        while (committed.load(std::memory_order_acquire) != slot) {
+            std::this_thread::yield();
+        }
+        // an equal key is a second copy, which only the sort drops
+        if (slot > 0 && leaf.keys[slot - 1] >= key) {
+            fpath.fp_sorted = false;
+        }
+        committed.store(slot + 1, std::memory_order_release);
+
+        ++size;
+        manager.mark_dirty(leaf.info->id);
+        return true;
     }
 
     /*
-        Function to determine the split position of the leaf node
+        Restarts appends to the leaf of fpath after its first n entries,
+        which have to be sorted. Requires the leaf to be locked exclusively.
+    */
+    static void reset_appends(fast_path &fpath, uint16_t n) {
+        fpath.fp_slot.store(n, std::memory_order_relaxed);
+        fpath.fp_appends.sorted.store(n, std::memory_order_relaxed);
+    }
+
+    /*
+        Size of a leaf locked shared. In appends mode the size of the
+        fast-path leaf is published by appenders that also hold it shared.
+    */
+    static uint16_t committed_size(const node_t &leaf) {
+        if constexpr (LEAF_APPENDS_ENABLED) {
+            return std::atomic_ref<uint16_t>(leaf.info->size)
+                .load(std::memory_order_acquire);
+        } else {
+            return leaf.info->size;
+        }
+    }
+
+    /*
+        Function to determine the split position of the fast-path leaf
         Requires (from caller):
             (1) leaf to be locked
             (2) fp_mutex to be locked
-            (3) fp_meta_mutex to be locked
     */
-    uint16_t determine_split_pos(node_t &leaf, uint16_t index, bool &fp_move) {
+    uint16_t determine_split_pos(const fast_path &fpath, node_t &leaf,
+                                 const fast_path_metadata &fp, uint16_t index,
+                                 bool &fp_move) {
         uint16_t split_leaf_pos = SPLIT_LEAF_POS;
-        // requires leaf, fp_mutex and fp_meta_mutex to be locked by caller
-        auto expected_prev_metadata = fp_prev_metadata.load();
-        if (leaf.info->id == fp_metadata.fp_id) {
-            // determine split position based on fast path metadata
-            // if (fp_prev_metadata.fp_prev_id == INVALID_NODE_ID ||
-            //     fp_prev_metadata.fp_prev_size < IQR_SIZE_THRESH) {
-            if (expected_prev_metadata.fp_prev_id == INVALID_NODE_ID ||
-                expected_prev_metadata.fp_prev_size < IQR_SIZE_THRESH) {
-                // move the fast-path to new leaf
-                fp_move = true;
+        auto prev = fpath.fp_prev_metadata.load();
+        if (prev.fp_prev_id == INVALID_NODE_ID ||
+            prev.fp_prev_size < IQR_SIZE_THRESH) {
+            // move the fast-path to new leaf
+            fp_move = true;
+        } else {
+            size_t max_distance = IKR::upper_bound(
+                dist(fp.fp_min, prev.fp_prev_min), prev.fp_prev_size,
+                leaf.info->size, sortedness.ikr_bound());
+            uint16_t outlier_pos = leaf.value_slot2(fp.fp_min + max_distance);
+            if (outlier_pos <= SPLIT_LEAF_POS) {
+                // retain fast-path as is
+                split_leaf_pos = outlier_pos;
             } else {
-                // size_t max_distance = IKR::upper_bound(
-                //     dist(fp_metadata.fp_min, fp_prev_metadata.fp_prev_min),
-                //     fp_prev_metadata.fp_prev_size, fp_metadata.fp_size);
-                size_t max_distance = IKR::upper_bound(
-                    dist(fp_metadata.fp_min,
-                         expected_prev_metadata.fp_prev_min),
-                    expected_prev_metadata.fp_prev_size, fp_metadata.fp_size);
-                uint16_t outlier_pos =
-                    leaf.value_slot2(fp_metadata.fp_min + max_distance);
-                if (outlier_pos <= SPLIT_LEAF_POS) {
-                    // retain fast-path as is
-                    split_leaf_pos = outlier_pos;
-                } else {
-                    split_leaf_pos = outlier_pos - 10 < SPLIT_LEAF_POS
-                                         ? SPLIT_LEAF_POS
-                                         : outlier_pos - 10;
-                    // move fast-path to new leaf
-                    fp_move = true;
-                }
-                if (index < outlier_pos) {
-                    split_leaf_pos++;
-                }
+                split_leaf_pos = outlier_pos - 10 < SPLIT_LEAF_POS
+                                     ? SPLIT_LEAF_POS
+                                     : outlier_pos - 10;
+                // move fast-path to new leaf
+                fp_move = true;
+            }
+            if (index < outlier_pos) {
+                split_leaf_pos++;
             }
         }
         return split_leaf_pos;
     }
 
+    /*
+        Inserts key into the full fast-path leaf by moving its smallest
+        entries to the end of the leaf before it, until that one holds
+        IQR_SIZE_THRESH entries, as the sequential QuIT does instead of
+        splitting. Only done if that leaf is a sibling under the locked
+        parent, path.back(), whose separator moves up to the new fp_min,
+        and if it can be latched right away: leaves are latched left to
+        right, so it is only tried. The fast-path has to be sorted.
+        Requires fp_mutex. Returns false if it did not apply.
+    */
+    bool redistribute(fast_path &fpath, const fast_path_metadata &fp,
+                      node_t &leaf, uint16_t index, const path_t &path,
+                      const key_type &key, const value_type &value) {
+        const fast_path_helper_metadata prev_meta =
+            fpath.fp_prev_metadata.load();
+        if (prev_meta.fp_prev_id == INVALID_NODE_ID ||
+            prev_meta.fp_prev_size >= IQR_SIZE_THRESH || path.empty()) {
+            return false;
+        }
+        const node_id_t prev_id = prev_meta.fp_prev_id;
+        node_t parent(manager.open_block(path.back()));
+        const uint16_t slot = parent.child_slot(key);
+        if (slot == 0 || parent.children[slot] != leaf.info->id ||
+            parent.children[slot - 1] != prev_id ||
+            fast_path_of(prev_id) != nullptr) {
+            return false;
+        }
+        if (!mutexes[prev_id].try_lock()) {
+            return false;
+        }
+        node_t prev(manager.open_block(prev_id));
+        sort_if_fast_path(prev);
+        const uint16_t prev_size = prev.info->size;
+        if (prev_size >= IQR_SIZE_THRESH) {
+            mutexes[prev_id].unlock();
+            return false;
+        }
+        ++ctr_redistribute;
+        manager.mark_dirty(prev_id);
+        manager.mark_dirty(leaf.info->id);
+        manager.mark_dirty(parent.info->id);
+
+        const uint16_t size = leaf.info->size;
+        uint16_t items = IQR_SIZE_THRESH - prev_size;
+        if (index < items) {
+            // key moves along
+            --items;
+            std::memcpy(prev.keys + prev_size, leaf.keys,
+                        index * sizeof(key_type));
+            std::memcpy(prev.keys + prev_size + index + 1, leaf.keys + index,
+                        (items - index) * sizeof(key_type));
+            prev.keys[prev_size + index] = key;
+            std::memcpy(prev.values + prev_size, leaf.values,
+                        index * sizeof(value_type));
+            std::memcpy(prev.values + prev_size + index + 1,
+                        leaf.values + index,
+                        (items - index) * sizeof(value_type));
+            prev.values[prev_size + index] = value;
+            std::memmove(leaf.keys, leaf.keys + items,
+                         (size - items) * sizeof(key_type));
+            std::memmove(leaf.values, leaf.values + items,
+                         (size - items) * sizeof(value_type));
+            leaf.info->size = size - items;
+        } else {
+            std::memcpy(prev.keys + prev_size, leaf.keys,
+                        items * sizeof(key_type));
+            std::memcpy(prev.values + prev_size, leaf.values,
+                        items * sizeof(value_type));
+            const uint16_t new_index = index - items;
+            std::memmove(leaf.keys, leaf.keys + items,
+                         new_index * sizeof(key_type));
+            std::memmove(leaf.keys + new_index + 1, leaf.keys + index,
+                         (size - index) * sizeof(key_type));
+            leaf.keys[new_index] = key;
+            std::memmove(leaf.values, leaf.values + items,
+                         new_index * sizeof(value_type));
+            std::memmove(leaf.values + new_index + 1, leaf.values + index,
+                         (size - index) * sizeof(value_type));
+            leaf.values[new_index] = value;
+            leaf.info->size = size - items + 1;
+        }
+        prev.info->size = IQR_SIZE_THRESH;
+        parent.keys[slot - 1] = leaf.keys[0];
+
+        reset_appends(fpath, leaf.info->size);
+        fpath.fp_prev_metadata.store({prev_id, prev.keys[0], prev.info->size});
+        fpath.fp_metadata.store(
+            {fp.fp_id, leaf.keys[0], fp.fp_max, leaf.info->size});
+        for (auto &next : fast_paths) {
+            if (next.fp_prev_metadata.load().fp_prev_id == leaf.info->id) {
+                next.fp_prev_metadata.store(
+                    {leaf.info->id, leaf.keys[0], leaf.info->size});
+            }
+        }
+        mutexes[prev_id].unlock();
+        return true;
+    }
+
+    /*
+        Splits a full leaf, or redistributes a fast-path leaf into the leaf
+        before it. Requires the leaf and the unsafe part of its path
+        to be locked exclusively. fp_mutex is only taken when the leaf is the
+        fast-path: no other leaf can become the fast-path while we hold it.
+        The new leaf stays locked until it is linked into its parent so that
+        fast-path inserts cannot land in a leaf that lookups cannot reach.
+    */
     void split_insert(node_t &leaf, uint16_t index, const path_t &path,
-                      const key_type &key, const value_type &value, bool fast) {
+                      const key_type &key, const value_type &value) {
         ++size;
         uint16_t split_leaf_pos = SPLIT_LEAF_POS;
-        auto expected_prev_metadata = fp_prev_metadata.load();
+
+        std::unique_lock fp_lock(fp_mutex, std::defer_lock);
+        fast_path *fpath = fast_path_of(leaf.info->id);
+        fast_path_metadata fp{};
+        if (fpath != nullptr) {
+            fp_lock.lock();
+            fp = fpath->fp_metadata.load();
+        }
+        const bool fast = fpath != nullptr;
         bool fp_move = false;
         if (fast) {
-            // requires fp_mutex and fp_meta_mutex to be locked by caller
-            if (leaf.info->id == fp_metadata.fp_id) {
-                // if (fp_prev_metadata.fp_prev_id == INVALID_NODE_ID ||
-                //     fp_prev_metadata.fp_prev_size < IQR_SIZE_THRESH) {
-                if (expected_prev_metadata.fp_prev_id == INVALID_NODE_ID ||
-                    expected_prev_metadata.fp_prev_size < IQR_SIZE_THRESH) {
-                    fp_move = true;
-                } else {
-                    // size_t max_distance = IKR::upper_bound(
-                    //     dist(fp_metadata.fp_min,
-                    //     fp_prev_metadata.fp_prev_min),
-                    //     fp_prev_metadata.fp_prev_size, fp_metadata.fp_size);
-                    size_t max_distance = IKR::upper_bound(
-                        dist(fp_metadata.fp_min,
-                             expected_prev_metadata.fp_prev_min),
-                        expected_prev_metadata.fp_prev_size,
-                        fp_metadata.fp_size);
-                    uint16_t outlier_pos =
-                        leaf.value_slot2(fp_metadata.fp_min + max_distance);
-                    if (outlier_pos <= SPLIT_LEAF_POS) {
-                        split_leaf_pos = outlier_pos;
-                    } else {
-                        split_leaf_pos = outlier_pos - 10 < SPLIT_LEAF_POS
-                                             ? SPLIT_LEAF_POS
-                                             : outlier_pos - 10;
-                        fp_move = true;
-                    }
-                    if (index < outlier_pos) {
-                        split_leaf_pos++;
-                    }
+            // streams without misses only get a new estimate here
+            tune();
+            if (redistribute(*fpath, fp, leaf, index, path, key, value)) {
+                fp_lock.unlock();
+                mutexes[leaf.info->id].unlock();
+                for (const auto &parent_id : path) {
+                    mutexes[parent_id].unlock();
                 }
+                return;
             }
+            split_leaf_pos =
+                determine_split_pos(*fpath, leaf, fp, index, fp_move);
         }
 
         node_id_t new_leaf_id = manager.allocate();
+        mutexes[new_leaf_id].lock();
         node_t new_leaf(manager.open_block(new_leaf_id), LEAF);
         ++leaves;
         manager.mark_dirty(new_leaf_id);
@@ -572,6 +1090,7 @@ class BTree {
         new_leaf.info->id = new_leaf_id;
         new_leaf.info->next_id = leaf.info->next_id;
         new_leaf.info->size = node_t::leaf_capacity + 1 - leaf.info->size;
+        new_leaf.info->prev_id = leaf.info->id;
         leaf.info->next_id = new_leaf_id;
 
         if (index < leaf.info->size) {
@@ -598,296 +1117,1117 @@ class BTree {
             std::memcpy(new_leaf.values + new_index + 1, leaf.values + index,
                         (node_t::leaf_capacity - index) * sizeof(value_type));
         }
-        if (leaf.info->id == tail_id) {
+        const bool was_tail = leaf.info->id == tail_id;
+        if (was_tail) {
             tail_id = new_leaf_id;
         }
 
         if (fast) {
-            // requires fp_mutex and fp_meta_mutex to be locked by caller
-            if (leaf.info->id == fp_metadata.fp_id) {
-                if (fp_move) {
-                    // fp_prev_metadata.fp_prev_min = fp_metadata.fp_min;
-                    // fp_prev_metadata.fp_prev_size = leaf.info->size;
-                    // fp_prev_metadata.fp_prev_id = fp_metadata.fp_id;
-                    fast_path_helper_metadata new_metadata = {
-                        fp_metadata.fp_id, fp_metadata.fp_min, leaf.info->size};
-                    fast_path_helper_metadata expected_metadata =
-                        fp_prev_metadata.load();
-                    // do {
-                    // } while (!fp_prev_metadata.compare_exchange_strong(
-                    //     expected_metadata, new_metadata));
-                    while (!fp_prev_metadata.compare_exchange_strong(
-                        expected_metadata, new_metadata)) {
-                    }
-                    fp_metadata.fp_id = new_leaf_id;
-                    fp_metadata.fp_min = new_leaf.keys[0];
-                    fp_metadata.fp_size = new_leaf.info->size;
-                } else {
-                    fp_metadata.fp_max = new_leaf.keys[0];
-                    fp_metadata.fp_size = leaf.info->size;
-                }
-            } else if (new_leaf.info->next_id == fp_metadata.fp_id) {
-                // fp_prev_metadata.fp_prev_id = new_leaf_id;
-                // fp_prev_metadata.fp_prev_min = new_leaf.keys[0];
-                // fp_prev_metadata.fp_prev_size = new_leaf.info->size;
-
-                fast_path_helper_metadata new_metadata = {
-                    new_leaf_id, new_leaf.keys[0], new_leaf.info->size};
-                fast_path_helper_metadata expected_metadata =
-                    fp_prev_metadata.load();
-                // do {
-                // } while (!fp_prev_metadata.compare_exchange_strong(
-                //     expected_metadata, new_metadata));
-                while (!fp_prev_metadata.compare_exchange_strong(
-                    expected_metadata, new_metadata)) {
-                }
+            reset_appends(*fpath,
+                          fp_move ? new_leaf.info->size : leaf.info->size);
+            if (fp_move) {
+                // the predecessor goes after the version, see leaf_insert
+                fpath->fp_metadata.store({new_leaf_id, new_leaf.keys[0],
+                                          fp.fp_max, new_leaf.info->size});
+                fpath->fp_prev_metadata.store(
+                    {fp.fp_id, fp.fp_min, leaf.info->size});
+            } else {
+                fpath->fp_metadata.store({fp.fp_id, fp.fp_min,
+                                          new_leaf.keys[0], leaf.info->size});
             }
         }
+        for (auto &next : fast_paths) {
+            if (&next != fpath &&
+                new_leaf.info->next_id == next.fp_metadata.fp_id) {
+                next.fp_prev_metadata.store(
+                    {new_leaf_id, new_leaf.keys[0], new_leaf.info->size});
+            }
+        }
+        if (fast) {
+            fp_lock.unlock();
+        }
+        // latches the next leaf, which may wait on a writer that waits for
+        // fp_mutex, so it has to come after it
+        if (!was_tail) {
+            link_prev(new_leaf.info->next_id, new_leaf_id);
+        }
 
         mutexes[leaf.info->id].unlock();
         internal_insert(path, new_leaf.keys[0], new_leaf_id);
+        mutexes[new_leaf_id].unlock();
     }
 
-    static std::size_t cmp(const key_type &max, const key_type &min) {
-        return max - min;
+    /*
+        Requires leaf to be locked exclusively, so no appender is in flight.
+        fp_size is only published on resets and splits, the predecessor
+        keeps its size up to date on a best-effort basis.
+    */
+    void leaf_erase(node_t &leaf, uint16_t index) {
+        --size;
+        manager.mark_dirty(leaf.info->id);
+        leaf.erase_value(index);
+        for (auto &fpath : fast_paths) {
+            if constexpr (LEAF_APPENDS_ENABLED) {
+                if (leaf.info->id == fpath.fp_metadata.fp_id) {
+                    reset_appends(fpath, leaf.info->size);
+                }
+            }
+            auto prev = fpath.fp_prev_metadata.load();
+            if (prev.fp_prev_id == leaf.info->id) {
+                fpath.fp_prev_metadata.compare_exchange_strong(
+                    prev,
+                    {prev.fp_prev_id, prev.fp_prev_min, leaf.info->size});
+            }
+        }
     }
 
-   public:
-    explicit BTree(BlockManager &m)
-        : manager(m),
-          mutexes(m.get_capacity()),
-          root_id(m.allocate()),
-          height(1),
-          life(sqrt(node_t::leaf_capacity)) {
-        head_id = tail_id = m.allocate();
-
-        fp_metadata.fp_min = {};
-
-        fp_metadata.fp_id = tail_id;
-        fp_metadata.fp_max = {};
-        dist = cmp;
-        // fp_prev_metadata.fp_prev_id = INVALID_NODE_ID;
-        // fp_prev_metadata.fp_prev_min = {};
-        // fp_prev_metadata.fp_prev_size = 0;
-        fast_path_helper_metadata new_metadata = {INVALID_NODE_ID, {}, 0};
-        fp_prev_metadata.store(new_metadata);
-
-        fp_metadata.fp_size = 0;
-
-        node_t leaf(manager.open_block(head_id), LEAF);
-        manager.mark_dirty(head_id);
-        leaf.info->id = head_id;
-        leaf.info->next_id = head_id;
-        leaf.info->size = 0;
+    /*
+        Keeps the fast-path metadata in line with a borrow between or a merge
+        of two sibling leaves. fp_min stays a lower bound of a fast-path and
+        fp_max an upper bound, they are exact unless the fast-path grew by a
+        merge. A fast-path merged into the leaf of another one is left
+        without a leaf. Requires both leaves to be locked exclusively: no
+        fast-path can move to either of them, and fp_mutex is only taken
+        when one is on them.
+    */
+    void update_fp_metadata_rebalance(const node_t &left, const node_t &right,
+                                      bool merged, const key_type &separator) {
+        const node_id_t left_id = left.info->id;
+        const node_id_t right_id = right.info->id;
+        fast_path *left_fpath = fast_path_of(left_id);
+        fast_path *right_fpath = fast_path_of(right_id);
+        if (left_fpath != nullptr || right_fpath != nullptr) {
+            std::lock_guard fp_lock(fp_mutex);
+            if (right_fpath != nullptr) {
+                fast_path_metadata fp = right_fpath->fp_metadata.load();
+                if (merged && left_fpath != nullptr) {
+                    right_fpath->fp_prev_metadata.store(
+                        {INVALID_NODE_ID, {}, 0});
+                    fp = {INVALID_NODE_ID, {}, {}, 0};
+                } else if (merged) {
+                    // the predecessor of left is unknown
+                    right_fpath->fp_prev_metadata.store(
+                        {INVALID_NODE_ID, {}, 0});
+                    fp = {left_id, left.keys[0], fp.fp_max, left.info->size};
+                } else {
+                    fp.fp_min = separator;
+                    fp.fp_size = right.info->size;
+                }
+                reset_appends(*right_fpath, fp.fp_size);
+                right_fpath->fp_metadata.store(fp);
+            }
+            if (left_fpath != nullptr) {
+                fast_path_metadata fp = left_fpath->fp_metadata.load();
+                if (!merged) {
+                    fp.fp_max = separator;
+                }
+                fp.fp_size = left.info->size;
+                reset_appends(*left_fpath, fp.fp_size);
+                left_fpath->fp_metadata.store(fp);
+            }
+        }
+        for (auto &fpath : fast_paths) {
+            auto prev = fpath.fp_prev_metadata.load();
+            if (prev.fp_prev_id == right_id && merged) {
+                fpath.fp_prev_metadata.compare_exchange_strong(
+                    prev, {left_id, left.keys[0], left.info->size});
+            } else if (prev.fp_prev_id == right_id) {
+                fpath.fp_prev_metadata.compare_exchange_strong(
+                    prev, {right_id, right.keys[0], right.info->size});
+            } else if (prev.fp_prev_id == left_id && !merged) {
+                fpath.fp_prev_metadata.compare_exchange_strong(
+                    prev, {left_id, left.keys[0], left.info->size});
+            }
+        }
+    }
 
-        node_t root(manager.open_block(root_id), INTERNAL);
-        manager.mark_dirty(root_id);
-        root.info->id = root_id;
-        root.info->next_id = root_id;
-        root.info->size = 0;
-        root.children[0] = head_id;
-        fp_sorted = true;
+    bool underflows(const node_t &node) const {
+        return node.info->size < (node.info->type == bp_node_type::LEAF
+                                      ? MIN_LEAF_SIZE
+                                      : MIN_INTERNAL_SIZE);
+    }
 
-        if constexpr (LEAF_APPENDS_ENABLED) {
-            std::cout << "leaf appends enabled" << std::endl;
+    // true if erasing one entry from node cannot change its parent
+    bool erase_safe(const node_t &node) const {
+        if (node.info->type == bp_node_type::LEAF) {
+            return node.info->size > MIN_LEAF_SIZE;
         }
+        return node.info->size >
+               (node.info->id == root_id ? 1 : MIN_INTERNAL_SIZE);
     }
 
-    bool update(const key_type &key, const value_type &value) {
-        node_t leaf;
-        key_type max;
-        find_leaf_exclusive(leaf, key, max);
-        uint16_t index = leaf.value_slot(key);
-        if (index >= leaf.info->size || leaf.keys[index] != key) {
-            mutexes[leaf.info->id].unlock();
-            return false;
-        }
-        manager.mark_dirty(leaf.info->id);
-        leaf.values[index] = value;
-        mutexes[leaf.info->id].unlock();
+    /*
+        Like find_leaf_exclusive, but path keeps the ancestors an erase
+        could underflow into, plus the parent of the topmost one.
+    */
+    void find_leaf_erase(node_t &node, path_t &path,
+                         const key_type &key) const {
+        node_id_t node_id = root_id;
+        mutexes[node_id].lock();
+        ++ctr_root_unique;
+        path.reserve(height);
+        node.load(manager.open_block(node_id));
+        do {
+            if (erase_safe(node)) {
+                for (const auto &parent_id : path) {
+                    mutexes[parent_id].unlock();
+                }
+                path.clear();
+            }
+            path.push_back(node_id);
+            uint16_t slot = node.child_slot(key);
+            node_id = node.children[slot];
+            mutexes[node_id].lock();
+            node.load(manager.open_block(node_id));
+        } while (node.info->type == bp_node_type::INTERNAL);
+        if (erase_safe(node)) {
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            path.clear();
+        }
+    }
+
+    /*
+        Restores the minimum size of node, reached through path on the way to
+        key, by borrowing from or merging with a sibling under the same
+        parent. Merges repeat this for the parent, and the root is collapsed
+        once it is left with a single internal child. Requires node and path
+        to be locked and releases them. Siblings are locked left to right, as
+        scans do; node is unlocked first if its sibling is on the left, which
+        is safe as it cannot be split or merged without the locked parent.
+    */
+    void rebalance(node_t &node, path_t &path, const key_type &key) {
+        while (!path.empty() && underflows(node)) {
+            const node_id_t node_id = node.info->id;
+            node.load(manager.open_block(path.back()));
+            path.pop_back();
+            if (node.info->size == 0) {
+                mutexes[node_id].unlock();
+                break;
+            }
+            uint16_t slot = node.child_slot(key);
+            if (slot == node.info->size) {
+                --slot;
+                mutexes[node_id].unlock();
+                mutexes[node.children[slot]].lock();
+                mutexes[node_id].lock();
+            } else {
+                mutexes[node.children[slot + 1]].lock();
+            }
+            node_t left(manager.open_block(node.children[slot]));
+            node_t right(manager.open_block(node.children[slot + 1]));
+            sort_if_fast_path(left);
+            sort_if_fast_path(right);
+            manager.mark_dirty(node.info->id);
+            manager.mark_dirty(left.info->id);
+            manager.mark_dirty(right.info->id);
+            if (!left.fits(right)) {
+                node.keys[slot] = left.redistribute(right, node.keys[slot]);
+                if (right.info->type == LEAF) {
+                    update_fp_metadata_rebalance(left, right, false,
+                                                 node.keys[slot]);
+                }
+                mutexes[left.info->id].unlock();
+                mutexes[right.info->id].unlock();
+                break;
+            }
+            left.merge(right, node.keys[slot]);
+            node.erase_child(slot + 1);
+            if (right.info->type == LEAF) {
+                --leaves;
+            } else {
+                --internal;
+            }
+            if (right.info->type == LEAF) {
+                if (right.info->id == tail_id) {
+                    tail_id = left.info->id;
+                } else {
+                    link_prev(left.info->next_id, left.info->id);
+                }
+                update_fp_metadata_rebalance(left, right, true,
+                                             node.keys[slot]);
+            }
+            const node_id_t right_id = right.info->id;
+            // lets scans that latch it again see that it is gone
+            right.info->size = 0;
+            if (right.info->type == INTERNAL) {
+                ++internal_retired;
+            }
+            mutexes[left.info->id].unlock();
+            mutexes[right_id].unlock();
+            manager.retire(right_id);
+        }
+        if (node.info->id == root_id) {
+            collapse_root();
+        }
+        mutexes[node.info->id].unlock();
+        for (const auto &parent_id : path) {
+            mutexes[parent_id].unlock();
+        }
+    }
+
+    /*
+        Points the leaf next_id back at prev_id. Requires the leaf left of
+        next_id to be locked, so leaves are locked left to right, and not
+        to be the tail, whose next_id wraps around to the head.
+    */
+    void link_prev(node_id_t next_id, node_id_t prev_id) {
+        mutexes[next_id].lock();
+        node_t next(manager.open_block(next_id));
+        manager.mark_dirty(next_id);
+        next.info->prev_id = prev_id;
+        mutexes[next_id].unlock();
+    }
+
+    /*
+        Pulls the only child of the root into the root block, root_id is
+        fixed. Requires the root to be locked.
+    */
+    void collapse_root() {
+        node_t root(manager.open_block(root_id));
+        while (root.info->size == 0) {
+            const node_id_t child_id = root.children[0];
+            mutexes[child_id].lock();
+            node_t child(manager.open_block(child_id));
+            if (child.info->type != bp_node_type::INTERNAL) {
+                mutexes[child_id].unlock();
+                return;
+            }
+            manager.mark_dirty(root_id);
+            root.info->size = child.info->size;
+            std::memcpy(root.keys, child.keys,
+                        child.info->size * sizeof(key_type));
+            std::memcpy(root.children, child.children,
+                        (child.info->size + 1) * sizeof(node_id_t));
+            --internal;
+            --height;
+            ++internal_retired;
+            mutexes[child_id].unlock();
+            manager.retire(child_id);
+        }
+    }
+
+    static std::size_t cmp(const key_type &max, const key_type &min) {
+        return max - min;
+    }
+
+    /*
+        Top-down insert that latches the unsafe part of the path so that the
+        leaf can be split. Used when the leaf found by the optimistic descent
+        (or the fast-path leaf) turned out to be full.
+    */
+    void insert_pessimistic(const key_type &key, const value_type &value) {
+        path_t path;
+        path_t trail;
+        node_t leaf;
+        key_type leaf_max{};
+        const uint32_t version =
+            internal_retired.load(std::memory_order_acquire);
+        find_leaf_exclusive(leaf, path, key, leaf_max, &trail);
+        sort_if_fast_path(leaf);
+        uint16_t index = leaf.value_slot(key);
+        if (leaf_insert(leaf, index, key, value, false)) {
+            // if the leaf is full but the key already exists we need to
+            // release the path
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            return;
+        }
+        if (fast_path *fpath = fast_path_of(leaf.info->id)) {
+            // the leaves of the fast-path after the split likely share it
+            std::lock_guard fp_lock(fp_mutex);
+            fpath->fp_path = std::move(trail);
+            fpath->fp_path_version = version;
+        }
+        split_insert(leaf, index, path, key, value);
+    }
+
+    /*
+        Latches the unsafe part of the path to the full fast-path leaf of
+        fpath bottom-up, from the path cached by its last split, so that
+        the leaf can be split without another descent from the root. The
+        cache holds if no internal node was retired since it was taken and
+        every node still has the one below it as the child of key; it is
+        also right for the new leaves of the fast-path as long as they share
+        the parent. Ancestors are latched after their child, against the
+        top-down order, so they are only tried. Requires leaf to be locked
+        exclusively. Returns false, with none of path locked, if the cache
+        did not hold.
+    */
+    bool latch_fast_path(fast_path &fpath, const node_t &leaf,
+                         const key_type &key, path_t &path) {
+        path_t cached;
+        uint32_t version;
+        {
+            std::lock_guard fp_lock(fp_mutex);
+            cached = fpath.fp_path;
+            version = fpath.fp_path_version;
+        }
+        // the cached nodes are live, and stay so while we are pinned
+        if (cached.empty() ||
+            internal_retired.load(std::memory_order_acquire) != version) {
+            return false;
+        }
+        const auto release = [&] {
+            for (const auto &node_id : path) {
+                mutexes[node_id].unlock();
+            }
+            path.clear();
+            return false;
+        };
+        node_id_t child_id = leaf.info->id;
+        for (auto it = cached.rbegin(); it != cached.rend(); ++it) {
+            if (!mutexes[*it].try_lock()) {
+                return release();
+            }
+            path.push_back(*it);
+            const node_t node(manager.open_block(*it));
+            if (node.info->type != INTERNAL ||
+                node.children[node.child_slot(key)] != child_id) {
+                return release();
+            }
+            if (node.info->size < node_t::internal_capacity) {
+                break;
+            }
+            child_id = *it;
+        }
+        // a node may have been retired before we latched it
+        if (internal_retired.load(std::memory_order_acquire) != version) {
+            return release();
+        }
+        std::ranges::reverse(path);
+        ++ctr_cached_path;
         return true;
     }
 
-    bool reset_fast_path(node_t &leaf, key_type &leaf_max) {
-        // if leaf appends are enabled, we need to sort the fast-path
+    /*
+        Inserts key into the full fast-path leaf of fpath, splitting it along
+        the cached path if it holds and top-down otherwise. Requires leaf to
+        be locked exclusively, releases it.
+    */
+    void split_fast_path(fast_path &fpath, node_t &leaf, const key_type &key,
+                         const value_type &value) {
+        path_t path;
+        if (!latch_fast_path(fpath, leaf, key, path)) {
+            mutexes[leaf.info->id].unlock();
+            insert_pessimistic(key, value);
+            return;
+        }
+        sort_if_fast_path(leaf);
+        const uint16_t index = leaf.value_slot(key);
+        if (leaf_insert(leaf, index, key, value, false)) {
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            return;
+        }
+        split_insert(leaf, index, path, key, value);
+    }
+
+    /*
+        Reports an insert of key that no fast-path took to the sortedness
+        estimator. If key falls below the fast-path with the lowest fp_min
+        above it, its displacement behind that fast-path is estimated from
+        the key density of the leaf before it, as in IKR. Returns whether
+        key belongs to that leaf, i.e. arrived just behind the fast-path.
+    */
+    bool record_miss(const key_type &key) {
+        fast_path *late_for = nullptr;
+        fast_path_metadata fp{};
+        for (auto &fpath : fast_paths) {
+            const fast_path_metadata m = fpath.fp_metadata.load();
+            if (m.fp_id != INVALID_NODE_ID && m.fp_id != head_id &&
+                key < m.fp_min &&
+                (late_for == nullptr || m.fp_min < fp.fp_min)) {
+                late_for = &fpath;
+                fp = m;
+            }
+        }
+        const fast_path_helper_metadata prev =
+            late_for ? late_for->fp_prev_metadata.load()
+                     : fast_path_helper_metadata{INVALID_NODE_ID, {}, 0};
+        if (prev.fp_prev_id == INVALID_NODE_ID || prev.fp_prev_size == 0 ||
+            !(prev.fp_prev_min < fp.fp_min)) {
+            sortedness.miss();
+            tune();
+            return false;
+        }
+        const double gap =
+            static_cast<double>(dist(fp.fp_min, prev.fp_prev_min));
+        sortedness.miss(
+            static_cast<size_t>(static_cast<double>(dist(fp.fp_min, key)) *
+                                prev.fp_prev_size / gap));
+        tune();
+        return !(key < prev.fp_prev_min);
+    }
+
+    /*
+        Adds key to the staging buffer, or replaces its value there. A full
+        buffer is merged into the tree first. Staged entries count in size.
+    */
+    void stage(const key_type &key, const value_type &value) {
+        std::unique_lock lock(staging.mutex);
+        uint16_t n = staging.size.load(std::memory_order_relaxed);
+        auto slot = std::lower_bound(staging.keys.begin(),
+                                     staging.keys.begin() + n, key);
+        if (slot != staging.keys.begin() + n && *slot == key) {
+            staging.values[slot - staging.keys.begin()] = value;
+            return;
+        }
+        if (n == STAGING_CAPACITY) {
+            drain_locked();
+            n = 0;
+            slot = staging.keys.begin();
+        }
+        const auto index = slot - staging.keys.begin();
+        std::copy_backward(slot, staging.keys.begin() + n,
+                           staging.keys.begin() + n + 1);
+        std::copy_backward(staging.values.begin() + index,
+                           staging.values.begin() + n,
+                           staging.values.begin() + n + 1);
+        *slot = key;
+        staging.values[index] = value;
+        staging.size.store(n + 1, std::memory_order_release);
+        ++size;
+        ++ctr_staged;
+    }
+
+    /*
+        The merge of insert_batch, without draining the staging buffer
+        first, which is also how the drain itself merges it.
+    */
+    void merge_batch(std::span<std::pair<key_type, value_type>> batch) {
+        const auto guard = manager.pin();
+        const size_t n = utils::bulk::prepare(batch);
+        node_t leaf;
+        uint32_t version;
+        for (size_t i = 0; i < n;) {
+            const auto &[key, value] = batch[i];
+            key_type leaf_max{};
+            fast_path_metadata fp;
+            fast_path *fpath = route(key, fp, version);
+            const bool fast = fpath != nullptr;
+            if (fast) {
+                // the snapshot is validated once we hold the latch, as the
+                // fast-path may have moved while we waited
+                mutexes[fp.fp_id].lock();
+                if (!fpath->fp_metadata.validate(version)) {
+                    mutexes[fp.fp_id].unlock();
+                    continue;
+                }
+                fpath->life.success();
+                leaf.load(manager.open_block(fp.fp_id));
+                leaf_max = fp.fp_max;
+            } else {
+                find_leaf_exclusive(leaf, key, leaf_max);
+            }
+            sort_if_fast_path(leaf);
+            const size_t taken = leaf_merge(
+                leaf,
+                utils::bulk::run(batch.subspan(i, n - i),
+                                 leaf.info->id == tail_id ? nullptr
+                                                          : &leaf_max));
+            mutexes[leaf.info->id].unlock();
+            if (fast) {
+                ctr_fast += taken;
+            }
+            if (taken == 0) {
+                // staging it again would wait on a drain that is running
+                insert(key, value, false);
+                ++i;
+            }
+            i += taken;
+        }
+    }
+
+    // requires the staging buffer to be latched exclusively
+    void drain_locked() {
+        const uint16_t n = staging.size.load(std::memory_order_relaxed);
+        std::vector<std::pair<key_type, value_type>> batch;
+        batch.reserve(n);
+        for (uint16_t i = 0; i < n; ++i) {
+            batch.emplace_back(staging.keys[i], staging.values[i]);
+        }
+        // the merge counts the entries again, except for keys it replaces
+        size -= n;
+        merge_batch(batch);
+        staging.size.store(0, std::memory_order_release);
+    }
+
+    /*
+        Merges the staging buffer into the tree. Scans call it first, so they
+        only have to look at the tree, which makes them writes as well.
+    */
+    void drain() {
+        if constexpr (STAGING_CAPACITY > 0) {
+            if (staging.size.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+            std::unique_lock lock(staging.mutex);
+            drain_locked();
+        }
+    }
+
+    // the latch a write of a key holds on the staging buffer
+    struct staging_latch {
+        std::shared_lock<std::shared_mutex> shared;
+        std::unique_lock<std::shared_mutex> exclusive;
+        bool staged = false;
+    };
+
+    /*
+        Latches the staging buffer for a write of key, shared or, if key is
+        staged, exclusively, and holds it until the write reached the tree.
+        No key can be staged or drained in between, which would put an older
+        value over the one written. Latches nothing with staging off.
+    */
+    staging_latch latch_staging(const key_type &key) {
+        staging_latch latch;
+        if constexpr (STAGING_CAPACITY > 0) {
+            latch.shared = std::shared_lock(staging.mutex);
+            if (staged_find(key)) {
+                latch.shared.unlock();
+                latch.exclusive = std::unique_lock(staging.mutex);
+                // a drain may have come first
+                latch.staged = staged_find(key).has_value();
+            }
+        }
+        return latch;
+    }
+
+    /*
+        Replaces the value of key in the staging buffer, or with erase set
+        removes key from it. Requires the staging buffer to be latched
+        exclusively. Returns false if key is not staged.
+    */
+    bool restage(const key_type &key, const value_type &value, bool erase) {
+        if constexpr (STAGING_CAPACITY > 0) {
+            const uint16_t n = staging.size.load(std::memory_order_relaxed);
+            const auto slot = std::lower_bound(
+                staging.keys.begin(), staging.keys.begin() + n, key);
+            if (slot == staging.keys.begin() + n || *slot != key) {
+                return false;
+            }
+            const auto index = slot - staging.keys.begin();
+            if (!erase) {
+                staging.values[index] = value;
+                return true;
+            }
+            std::copy(slot + 1, staging.keys.begin() + n, slot);
+            std::copy(staging.values.begin() + index + 1,
+                      staging.values.begin() + n,
+                      staging.values.begin() + index);
+            staging.size.store(n - 1, std::memory_order_release);
+            --size;
+            return true;
+        }
+        return false;
+    }
+
+    // requires the staging buffer to be latched
+    std::optional<value_type> staged_find(const key_type &key) const {
+        const uint16_t n = staging.size.load(std::memory_order_relaxed);
+        const auto slot = std::lower_bound(staging.keys.begin(),
+                                           staging.keys.begin() + n, key);
+        if (slot != staging.keys.begin() + n && *slot == key) {
+            return staging.values[slot - staging.keys.begin()];
+        }
+        return std::nullopt;
+    }
+
+    // the value of key in the staging buffer, if it is there
+    std::optional<value_type> staged_get(const key_type &key) const {
+        if constexpr (STAGING_CAPACITY > 0) {
+            if (staging.size.load(std::memory_order_acquire) > 0) {
+                std::shared_lock lock(staging.mutex);
+                return staged_find(key);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // hands a new estimate of the sortedness on to the fast-paths
+    void tune() {
+        if (sortedness.fold(ctr_fast + ctr_fast_fail)) {
+            for (auto &fpath : fast_paths) {
+                fpath.life.threshold.store(sortedness.reset_threshold(),
+                                           std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*
+        The fast-path whose key range holds key, along with a snapshot fp of
+        its metadata taken under version, or nullptr if there is none.
+    */
+    fast_path *route(const key_type &key, fast_path_metadata &fp,
+                     uint32_t &version) {
+        for (auto &fpath : fast_paths) {
+            fp = fpath.fp_metadata.load(version);
+            if (fp.fp_id != INVALID_NODE_ID &&
+                (fp.fp_id == head_id || fp.fp_min <= key) &&
+                (fp.fp_id == tail_id || key < fp.fp_max)) {
+                return &fpath;
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+        The size of the leaf of fp. fp_size is only published on resets and
+        splits, so read the actual size if the leaf is not busy.
+    */
+    uint16_t fp_leaf_size(const fast_path_metadata &fp) const {
+        if (!mutexes[fp.fp_id].try_lock_shared()) {
+            return fp.fp_size;
+        }
+        const node_t fp_leaf(manager.open_block(fp.fp_id));
+        const uint16_t fp_size = committed_size(fp_leaf);
+        mutexes[fp.fp_id].unlock_shared();
+        return fp_size;
+    }
+
+    /*
+        Whether fpath would move on to leaf, the one right after it, in a
+        soft reset: its key range has to be no wider than IKR expects from
+        the leaf before it, so the stream is likely to go on in leaf.
+    */
+    bool soft_reset(const fast_path &fpath, const fast_path_metadata &fp,
+                    const node_t &leaf) const {
+        if (fp.fp_id == INVALID_NODE_ID || fp.fp_id == tail_id ||
+            leaf.info->size == 0 || leaf.keys[0] != fp.fp_max) {
+            return false;
+        }
+        const fast_path_helper_metadata prev = fpath.fp_prev_metadata.load();
+        if (prev.fp_prev_id == INVALID_NODE_ID || prev.fp_prev_size == 0 ||
+            !(prev.fp_prev_min < fp.fp_min)) {
+            return false;
+        }
+        return dist(fp.fp_max, fp.fp_min) <
+               IKR::upper_bound(dist(fp.fp_min, prev.fp_prev_min),
+                                prev.fp_prev_size, fp_leaf_size(fp),
+                                sortedness.ikr_bound());
+    }
+
+    /*
+        Moves fpath to leaf. Requires leaf to be locked exclusively. In
+        appends mode the old leaf of fpath has to be locked exclusively as
+        well, both to sort it and to wait for in-flight appenders that hold
+        it shared. Returns false (and leaves the fast-path untouched) if that
+        latch is not available right now or another fast-path got to leaf
+        first; resets are a heuristic so skipping one is fine. A soft reset
+        only moves the fast-path on to the leaf after it, see soft_reset.
+    */
+    bool reset_fast_path(fast_path &fpath, node_t &leaf,
+                         const key_type &leaf_max, bool soft) {
+        std::lock_guard fp_lock(fp_mutex);
+        const fast_path_metadata fp = fpath.fp_metadata.load();
+        const fast_path *owner = fast_path_of(leaf.info->id);
+        if (owner != nullptr && owner != &fpath) {
+            // another fast-path moved here in the meantime
+            return false;
+        }
+        if (soft && !soft_reset(fpath, fp, leaf)) {
+            return false;
+        }
+        const bool had_leaf = fp.fp_id != INVALID_NODE_ID;
+        node_t fp_leaf;
+        bool fp_leaf_locked = false;
+        // if leaf appends are enabled, the new fast-path has to be sorted,
+        // the old one is left to the sorter thread if it is free
         if constexpr (LEAF_APPENDS_ENABLED) {
-            if (!fp_sorted) {
-                mutexes[fp_metadata.fp_id].lock();
-                node_t fp_leaf(manager.open_block(fp_metadata.fp_id), LEAF);
-                sort_leaf(fp_leaf);
-                fp_sorted = true;
-                ++ctr_sort;
-                manager.mark_dirty(fp_metadata.fp_id);
-                mutexes[fp_metadata.fp_id].unlock();
+            sort_if_fast_path(leaf);
+            if (had_leaf && fp.fp_id != leaf.info->id) {
+                if (!mutexes[fp.fp_id].try_lock()) {
+                    return false;
+                }
+                fp_leaf_locked = true;
+                fp_leaf.load(manager.open_block(fp.fp_id));
+                if (!fpath.fp_sorted && !retire(fpath, fp_leaf)) {
+                    sort_leaf(fp_leaf);
+                    ++ctr_sort;
+                    manager.mark_dirty(fp.fp_id);
+                }
             }
         }
 
-        // update associated metadata
-        if (fp_metadata.fp_id != tail_id &&
-            leaf.keys[0] == fp_metadata.fp_max) {
+        // update associated metadata, the predecessor after the version as
+        // leaf_insert expects
+        reset_appends(fpath, leaf.info->size);
+        fpath.fp_metadata.store(
+            {leaf.info->id, leaf.keys[0], leaf_max, leaf.info->size});
+        if (had_leaf && fp.fp_id != tail_id && leaf.keys[0] == fp.fp_max) {
             // in this case, we end up inserting to fp-next
-            // fp_prev_metadata.fp_prev_id = fp_metadata.fp_id;
-            // fp_prev_metadata.fp_prev_size = fp_metadata.fp_size;
-            // fp_prev_metadata.fp_prev_min = fp_metadata.fp_min;
-            fast_path_helper_metadata new_metadata = {
-                fp_metadata.fp_id, fp_metadata.fp_min, fp_metadata.fp_size};
-            fast_path_helper_metadata expected_metadata =
-                fp_prev_metadata.load();
-            // do {
-            // } while (!fp_prev_metadata.compare_exchange_strong(
-            //     expected_metadata, new_metadata));
-            while (!fp_prev_metadata.compare_exchange_strong(expected_metadata,
-                                                             new_metadata)) {
-            }
+            const uint16_t fp_size =
+                fp_leaf_locked ? fp_leaf.info->size : fp_leaf_size(fp);
+            fpath.fp_prev_metadata.store({fp.fp_id, fp.fp_min, fp_size});
         } else {
-            // fp_prev_metadata.fp_prev_id = INVALID_NODE_ID;
-            fast_path_helper_metadata new_metadata = {INVALID_NODE_ID, {}, 0};
-            fast_path_helper_metadata expected_metadata =
-                fp_prev_metadata.load();
-            // do {
-            // } while (!fp_prev_metadata.compare_exchange_strong(
-            //     expected_metadata, new_metadata));
-            while (!fp_prev_metadata.compare_exchange_strong(expected_metadata,
-                                                             new_metadata)) {
-            }
-        }
-        fp_metadata.fp_id = leaf.info->id;
-        fp_metadata.fp_min = leaf.keys[0];
-        fp_metadata.fp_max = leaf_max;
-        fp_metadata.fp_size = leaf.info->size;
-        life.reset();
+            fpath.fp_prev_metadata.store({INVALID_NODE_ID, {}, 0});
+        }
+        fpath.life.reset();
+        ++(soft ? ctr_soft : ctr_hard);
+
+        if constexpr (LEAF_APPENDS_ENABLED) {
+            // the old fast-path may only be released once appenders waiting
+            // on it can observe that the fast-path has moved
+            if (fp_leaf_locked) {
+                fpath.fp_sorted = true;
+                mutexes[fp.fp_id].unlock();
+            }
+        }
         return true;
     }
 
-    void insert(const key_type &key, const value_type &value) {
-        // std::cout << "Inserting key: " << key << std::endl;
-        path_t path;
-        uint16_t index;
-        node_t leaf;
-        bool fast;
-        key_type leaf_max{};
+   public:
+    explicit BTree(BlockManager &m)
+        : manager(m),
+          mutexes(m),
+          root_id(m.allocate()),
+          height(1) {
+        head_id = tail_id = m.allocate();
+
+        dist = cmp;
+        {
+            // the first fast-path starts at the tail, the others without a
+            // leaf
+            std::lock_guard fp_lock(fp_mutex);
+            for (auto &fpath : fast_paths) {
+                fpath.fp_prev_metadata.store({INVALID_NODE_ID, {}, 0});
+                fpath.fp_metadata.store({INVALID_NODE_ID, {}, {}, 0});
+            }
+            fast_paths[0].fp_metadata.store({tail_id, {}, {}, 0});
+        }
 
-        // lock the fast-path to check if we can use it
-        std::unique_lock fp_lock(fp_mutex);  // scoped lock
-        // std::unique_lock fp_meta_lock(fp_meta_mutex);
-        if ((fp_metadata.fp_id == head_id || fp_metadata.fp_min <= key)
+        node_t leaf(manager.open_block(head_id), LEAF);
+        manager.mark_dirty(head_id);
+        leaf.info->id = head_id;
+        leaf.info->next_id = head_id;
+        leaf.info->prev_id = INVALID_NODE_ID;
+        leaf.info->size = 0;
+        leaves = 1;
+
+        node_t root(manager.open_block(root_id), INTERNAL);
+        manager.mark_dirty(root_id);
+        root.info->id = root_id;
+        root.info->next_id = root_id;
+        root.info->size = 0;
+        root.children[0] = head_id;
 
-            && (fp_metadata.fp_id == tail_id || key < fp_metadata.fp_max)) {
-            fast = true;
+        if constexpr (LEAF_APPENDS_ENABLED) {
+            std::cout << "leaf appends enabled" << std::endl;
+            sorter = std::jthread([this](std::stop_token stop) {
+                sort_retired(stop);
+            });
+        }
+    }
 
-            life.success();
-            mutexes[fp_metadata.fp_id]
-                .lock();  // will be unlocked in leaf_insert()
-            leaf.load(manager.open_block(fp_metadata.fp_id));
+    /*
+        Builds the tree bottom-up out of [begin, end), keys or key/value pairs
+        in strictly ascending key order, instead of inserting them one by one.
+        Nodes are filled to fill_factor, in [0.5, 1], of their capacity and
+        num_threads share the work on each level. Requires a tree that was
+        just constructed and that no other thread uses yet.
+    */
+    template <std::random_access_iterator It>
+    void bulk_load(It begin, It end, double fill_factor = 1.0,
+                   unsigned num_threads = 1) {
+        utils::bulk::loader<node_t, BlockManager> loader(manager, num_threads);
+        loader.leaves(begin, end, node_t::leaf_capacity, fill_factor, head_id);
+        leaves = loader.ids.size();
+        // the fast-path starts at the tail, preceded by the leaf before it
+        tail_id = loader.ids.back();
+        const uint16_t tail_size =
+            node_t(manager.open_block(tail_id)).info->size;
+        fast_path &fpath = fast_paths[0];
+        if (leaves > 1) {
+            const node_id_t prev_id = loader.ids[leaves - 2];
+            fpath.fp_prev_metadata.store(
+                {prev_id, loader.mins[leaves - 2],
+                 node_t(manager.open_block(prev_id)).info->size});
+        }
+        reset_appends(fpath, tail_size);
+        {
+            std::lock_guard fp_lock(fp_mutex);
+            fpath.fp_metadata.store(
+                {tail_id, loader.mins.back(), {}, tail_size});
+        }
+        while (loader.ids.size() > 1) {
+            loader.internal(node_t::internal_capacity, fill_factor);
+            internal += loader.ids.size();
+            ++height;
+        }
+        // the single node on top takes the place of the root
+        if (height > 1) {
+            loader.move_to(root_id);
+            --internal;
+            --height;
+        }
+        size = end - begin;
+    }
 
-            if (fp_metadata.fp_size < node_t::leaf_capacity) {
-                // we can directly insert to the fast-path
-                if constexpr (LEAF_APPENDS_ENABLED) {
-                    index = fp_metadata.fp_size;
-                } else {
+    bool update(const key_type &key, const value_type &value) {
+        const auto guard = manager.pin();
+        // a staged key may also be in the tree from before
+        const staging_latch latch = latch_staging(key);
+        const bool staged = latch.staged && restage(key, value, false);
+        node_t leaf;
+        key_type max;
+        find_leaf_exclusive(leaf, key, max);
+        sort_if_fast_path(leaf);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            mutexes[leaf.info->id].unlock();
+            return staged;
+        }
+        manager.mark_dirty(leaf.info->id);
+        leaf.values[index] = value;
+        mutexes[leaf.info->id].unlock();
+        return true;
+    }
+
+    /*
+        Inserts key, or replaces its value. With absorb set, a key that
+        misses the fast-paths but belongs to the leaf just before one goes to
+        the staging buffer instead, if there is one. A key that is still
+        staged takes the new value there, so the drain cannot write an older
+        value over it later. The staging buffer stays latched until the key
+        is in the tree, see latch_staging.
+    */
+    void insert(const key_type &key, const value_type &value,
+                bool absorb = true) {
+        const auto guard = manager.pin();
+        node_t leaf;
+        uint16_t index;
+        uint32_t version;
+
+        // inserts without absorb come from merge_batch, which the drain
+        // runs with the staging buffer latched
+        staging_latch latch;
+        if (absorb) {
+            latch = latch_staging(key);
+            if (latch.staged && restage(key, value, false)) {
+                return;
+            }
+        }
+
+        while (true) {
+            fast_path_metadata fp;
+            fast_path *fpath = route(key, fp, version);
+            if (fpath == nullptr) {
+                break;
+            }
+            if constexpr (LEAF_APPENDS_ENABLED) {
+                // appenders share the fast-path leaf and reserve their slot
+                // atomically; the snapshot is validated afterwards as the
+                // fast-path may have moved while we waited for the latch
+                mutexes[fp.fp_id].lock_shared();
+                if (!fpath->fp_metadata.validate(version)) {
+                    mutexes[fp.fp_id].unlock_shared();
+                    continue;
+                }
+                fpath->life.success();
+                leaf.load(manager.open_block(fp.fp_id));
+                const bool appended = append(*fpath, leaf, key, value);
+                mutexes[fp.fp_id].unlock_shared();
+                if (appended) {
+                    ++ctr_fast;
+                    return;
+                }
+                // the split needs the leaf exclusively
+                mutexes[fp.fp_id].lock();
+                if (!fpath->fp_metadata.validate(version)) {
+                    mutexes[fp.fp_id].unlock();
+                    ++ctr_fast_fail;
+                    insert_pessimistic(key, value);
+                    return;
+                }
+            } else {
+                // only the fast-path leaf is latched; the snapshot is
+                // validated afterwards as the fast-path may have moved while
+                // we waited
+                mutexes[fp.fp_id].lock();
+                if (!fpath->fp_metadata.validate(version)) {
+                    mutexes[fp.fp_id].unlock();
+                    continue;
+                }
+                fpath->life.success();
+                leaf.load(manager.open_block(fp.fp_id));
+
+                if (leaf.info->size < node_t::leaf_capacity) {
+                    // we can directly insert to the fast-path
                     std::chrono::high_resolution_clock::time_point start =
                         std::chrono::high_resolution_clock::now();
                     index = leaf.value_slot(key);
 
                     std::chrono::high_resolution_clock::time_point end =
                         std::chrono::high_resolution_clock::now();
-                    find_leaf_slot_time +=
+                    find_leaf_slot_time.fetch_add(
                         std::chrono::duration_cast<std::chrono::nanoseconds>(
                             end - start)
-                            .count();
+                            .count(),
+                        std::memory_order_relaxed);
+                    leaf_insert(leaf, index, key, value, true);
+                    ++ctr_fast;
+                    return;
                 }
-                fp_metadata.fp_size++;
-                // TODO: unlock fp_lock here - however, should check for
-                // in-order insert here
-                leaf_insert(leaf, index, key, value, true);
-                ++ctr_fast;
-                return;  // also unlocks fp_mutex
             }
-            // std::cout << "in else block of fp" << std::endl;
-            // else block -> fast-path is will be at capacity needs to split
-
-            // // lock fast-path meta-mutex as it will be updated upon split
-            // std::unique_lock fp_meta_lock(fp_meta_mutex);
+            // the fast-path is full and needs to be split, from the latched
+            // leaf up if its cached path still holds
+            ++ctr_fast_fail;
+            split_fast_path(*fpath, leaf, key, value);
+            return;
+        }
 
-            // check if we need to sort the fast-path
-            if constexpr (LEAF_APPENDS_ENABLED) {
-                if (!fp_sorted) {
-                    sort_leaf(leaf);
-                    fp_sorted = true;
-                    ++ctr_sort;
-                }
+        // does not qualify for any fast-path
+        ++ctr_fast_fail;
+        const bool late = record_miss(key);
+        if constexpr (STAGING_CAPACITY > 0) {
+            if (absorb && late) {
+                // stage latches the buffer exclusively
+                latch = {};
+                stage(key, value);
+                return;
             }
-            ++ctr_fast_fail;
-            mutexes[fp_metadata.fp_id]
-                .unlock();  // unlock fast-path as it will be locked
-                            // by find_leaf_exclusive
-            // split case handled as a top-insert as both perform similar effort
-            find_leaf_exclusive(leaf, path, key, leaf_max);
-            index = leaf.value_slot(
-                key);  // we have to do this as leaf has been sorted
-            if (leaf_insert(leaf, index, key, value, fast)) {
-                for (const auto &parent_id : path) {
-                    mutexes[parent_id].unlock();
+        }
+        key_type leaf_max{};
+        find_leaf_exclusive(leaf, key, leaf_max);
+        // a fast-path the stream just left for the leaf after it follows
+        // right away. Otherwise the miss counts against every fast-path, the
+        // first to run out is the one that went longest without a fast
+        // insert. Moving it to this leaf makes the insert a fast one
+        bool fast = false;
+        for (auto &fpath : fast_paths) {
+            if (leaf.info->size > 0 &&
+                fpath.fp_metadata.load().fp_max == leaf.keys[0] &&
+                reset_fast_path(fpath, leaf, leaf_max, true)) {
+                fast = true;
+                break;
+            }
+        }
+        if (!fast) {
+            fast_path *victim = nullptr;
+            for (auto &fpath : fast_paths) {
+                if (fpath.life.failure() && victim == nullptr) {
+                    victim = &fpath;
                 }
-                return;
             }
-            // TODO: pre-determine split position based on IKR here
-            split_insert(leaf, index, path, key, value, fast);
-            // fp_lock and fp_meta_lock will be unlocked when going out of scope
+            fast = victim != nullptr &&
+                   reset_fast_path(*victim, leaf, leaf_max, false);
+        }
+        sort_if_fast_path(leaf);
+        index = leaf.value_slot(key);
+        if (leaf_insert(leaf, index, key, value, fast)) {
             return;
+        }
+        mutexes[leaf.info->id].unlock();
+        insert_pessimistic(key, value);
+    }
+
+    /*
+        Inserts the entries of batch, which it sorts by key, like insert one
+        by one would; the last of the entries with equal keys wins. Each run
+        of entries that belongs to the same leaf is merged into it in a single
+        pass under one latch, as far as it fits. Runs in a fast-path skip
+        the search and latch it exclusively, which also waits out appenders.
+        The entry that finds the leaf full goes through insert, which splits
+        it. Staged entries are older than the batch and are merged first,
+        under the same latch, so none can be staged before the batch is in.
+    */
+    void insert_batch(std::span<std::pair<key_type, value_type>> batch) {
+        if constexpr (STAGING_CAPACITY > 0) {
+            std::unique_lock lock(staging.mutex);
+            drain_locked();
+            merge_batch(batch);
         } else {
-            // std::cout << "non fast insert entered" << std::endl;
-            // does not qualify for fast-path
-            // std::unique_lock fp_meta_lock(fp_meta_mutex);
-            ++ctr_fast_fail;
-            fast = false;
-            bool reset = life.failure();
-            if (!reset) {
-                // not resetting the fast-path so it's metadata can be unlocked
-                // fp_lock.unlock();
-            }
-            // find the leaf node to insert into
-            find_leaf_exclusive(leaf, key, leaf_max);
-            if (reset) {
-                ++ctr_hard;
-                // sets fast to true as we reset the fast-path
-                fast = reset_fast_path(
-                    leaf,
-                    leaf_max);  // reset_fast_path() sorts the
-                                // fast-path, and updates fast-path to leaf
-            }
-            index = leaf.value_slot(key);
-            // attempt to insert into the leaf node
-            if (leaf_insert(leaf, index, key, value, fast)) {
-                // if we inserted into the fast-path, update its size
-                if (leaf.info->id == fp_metadata.fp_id) {
-                    ++fp_metadata.fp_size;
-                }
-                // insert was successful so we can complete the operation
-                // leaf_insert() will unlock the leaf node, unlock any parents
-                for (const auto &parent_id : path) {
-                    mutexes[parent_id].unlock();
-                }
-                return;  // also unlocks fp_meta_mutex + fp_mutex
-            }
+            merge_batch(batch);
+        }
+    }
+
+    bool erase(const key_type &key) {
+        const auto guard = manager.pin();
+        const staging_latch latch = latch_staging(key);
+        const bool staged = latch.staged && restage(key, {}, true);
+        node_t leaf;
+        key_type leaf_max;
+        find_leaf_exclusive(leaf, key, leaf_max);
+        sort_if_fast_path(leaf);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            mutexes[leaf.info->id].unlock();
+            return staged;
+        }
+        if (leaf.info->size > MIN_LEAF_SIZE) {
+            leaf_erase(leaf, index);
+            mutexes[leaf.info->id].unlock();
+            return true;
+        }
+        mutexes[leaf.info->id].unlock();
+        return erase_pessimistic(key) || staged;
+    }
+
+    bool erase_pessimistic(const key_type &key) {
+        const auto guard = manager.pin();
+        node_t leaf;
+        path_t path;
+        find_leaf_erase(leaf, path, key);
+        sort_if_fast_path(leaf);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
             mutexes[leaf.info->id].unlock();
-            find_leaf_exclusive(leaf, path, key, leaf_max);
-            // if (leaf.info->id != fp_prev_metadata.fp_prev_id) {
-            //     // can unlock fp_meta_mutex here as we are not updating
-            // }
-            index = leaf.value_slot(key);
-            split_insert(leaf, index, path, key, value, fast);
-            // will unlock fp_meta_mutex when going out of scope
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            return false;
         }
-        // will unlock fp_mutex when going out of scope
+        leaf_erase(leaf, index);
+        rebalance(leaf, path, key);
+        return true;
     }
 
-    uint32_t select_k(size_t count, const key_type &min_key) const {
+    // drains the staging buffer first, like the other scans
+    uint32_t select_k(size_t count, const key_type &min_key) {
+        drain();
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, min_key, version)) {
+                continue;
+            }
+            uint16_t curr_size = clamped_size(leaf, node_t::leaf_capacity);
+            uint16_t index =
+                utils::search::lower_bound(leaf.keys, curr_size, min_key);
+            uint32_t loads = 1;
+            size_t remaining = count;
+            bool valid = true;
+            curr_size -= index;
+            while (remaining > curr_size) {
+                remaining -= curr_size;
+                if (leaf.info->id == tail_id) {
+                    break;
+                }
+                node_id_t next_id = leaf.info->next_id;
+                if (!next_leaf_optimistic(leaf, version, next_id)) {
+                    valid = false;
+                    break;
+                }
+                curr_size = clamped_size(leaf, node_t::leaf_capacity);
+                ++loads;
+            }
+            if (valid && mutexes[leaf.info->id].validate(version)) {
+                return loads;
+            }
+        }
+#else
         find_leaf_shared(leaf, min_key);
-        uint16_t index = leaf.value_slot(min_key);
+        uint16_t curr_size = committed_size(leaf);
+        uint16_t index =
+            utils::search::lower_bound(leaf.keys, curr_size, min_key);
         uint32_t loads = 1;
-        uint16_t curr_size = leaf.info->size - index;
+        curr_size -= index;
         while (count > curr_size) {
             count -= curr_size;
             if (leaf.info->id == tail_id) {
@@ -898,18 +2238,49 @@ class BTree {
             mutexes[leaf.info->id].unlock_shared();
             leaf.load(manager.open_block(next_id));
 
-            curr_size = leaf.info->size;
+            curr_size = committed_size(leaf);
             ++loads;
         }
         mutexes[leaf.info->id].unlock_shared();
         return loads;
+#endif
     }
 
-    uint32_t range(const key_type &min_key, const key_type &max_key) const {
-        uint32_t loads = 1;
+    // drains the staging buffer first, like the other scans
+    uint32_t range(const key_type &min_key, const key_type &max_key) {
+        drain();
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, min_key, version)) {
+                continue;
+            }
+            uint32_t loads = 1;
+            bool valid = true;
+            uint16_t curr_size = clamped_size(leaf, node_t::leaf_capacity);
+            while (curr_size > 0 && leaf.keys[curr_size - 1] < max_key) {
+                if (leaf.info->id == tail_id) {
+                    break;
+                }
+                node_id_t next_id = leaf.info->next_id;
+                if (!next_leaf_optimistic(leaf, version, next_id)) {
+                    valid = false;
+                    break;
+                }
+                curr_size = clamped_size(leaf, node_t::leaf_capacity);
+                ++loads;
+            }
+            if (valid && mutexes[leaf.info->id].validate(version)) {
+                return loads;
+            }
+        }
+#else
+        uint32_t loads = 1;
         find_leaf_shared(leaf, min_key);
-        while (leaf.keys[leaf.info->size - 1] < max_key) {
+        while (committed_size(leaf) > 0 &&
+               leaf.keys[committed_size(leaf) - 1] < max_key) {
             if (leaf.info->id == tail_id) {
                 break;
             }
@@ -922,33 +2293,368 @@ class BTree {
         }
         mutexes[leaf.info->id].unlock_shared();
         return loads;
+#endif
+    }
+
+    /*
+        Hands the entries with keys >= min_key to emit in key order, one leaf
+        at a time, as emit(keys, values) with two std::span of equal length.
+        Stops once emit returns false or the last leaf was read; returns the
+        number of leaves read. Each batch is copied out of its leaf, so emit
+        runs without a latch held. The scan then goes on after the last key
+        it emitted, from the root again if the leaf was merged away or
+        changed in a way that may have moved the following keys. Staged
+        entries are merged into the tree before the scan starts.
+    */
+    template <typename F>
+    uint32_t scan(const key_type &min_key, F &&emit) {
+        drain();
+        const auto guard = manager.pin();
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = min_key;
+        // set once the entries up to bound were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+#ifdef OPTIMISTIC_READS
+        uint32_t version;
+        bool descend = true;
+        while (true) {
+            if (descend) {
+                if (!find_leaf_optimistic(leaf, bound, version)) {
+                    continue;
+                }
+                descend = false;
+                ++loads;
+            }
+            const bool sorted = !has_appends(leaf.info->id);
+            batch.copy(leaf.keys, leaf.values,
+                       clamped_size(leaf, node_t::leaf_capacity), sorted);
+            const bool last = leaf.info->id == tail_id;
+            const node_id_t next_id = leaf.info->next_id;
+            if (!mutexes[leaf.info->id].validate(version)) {
+                descend = true;
+                continue;
+            }
+            batch.seek(bound, after);
+            if (!batch.empty()) {
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.last();
+                after = true;
+            }
+            if (last) {
+                return loads;
+            }
+            // fails if the leaf changed while emit ran
+            descend = !next_leaf_optimistic(leaf, version, next_id);
+            loads += !descend;
+        }
+#else
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            bool sorted = !has_appends(leaf_id);
+            batch.copy(leaf.keys, leaf.values, committed_size(leaf), sorted);
+            batch.seek(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.last();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                sorted = !has_appends(leaf_id);
+                const utils::scan::step step = utils::scan::resume(
+                    leaf.keys, committed_size(leaf), bound, sorted);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+                if (step == utils::scan::step::descend) {
+                    mutexes[leaf_id].unlock_shared();
+                    find_leaf_shared(leaf, bound);
+                    ++loads;
+                    continue;
+                }
+            }
+            if (leaf_id == tail_id) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            const node_id_t next_id = leaf.info->next_id;
+            mutexes[next_id].lock_shared();
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(next_id));
+            ++loads;
+        }
+#endif
+    }
+
+    /*
+        Hands the entries with keys <= max_key to emit like scan, but one leaf
+        at a time from right to left: the batches come in descending order,
+        while the keys within each batch ascend. Leaves are only latched
+        right to left with try_lock_shared; a scan that does not get the left
+        sibling drops its latch and descends from the root again, so it
+        cannot deadlock with writers or forward scans.
+    */
+    template <typename F>
+    uint32_t reverse_scan(const key_type &max_key, F &&emit) {
+        drain();
+        const auto guard = manager.pin();
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = max_key;
+        // set once the entries from bound on were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+#ifdef OPTIMISTIC_READS
+        uint32_t version;
+        bool descend = true;
+        while (true) {
+            if (descend) {
+                if (!find_leaf_optimistic(leaf, bound, version)) {
+                    continue;
+                }
+                descend = false;
+                ++loads;
+            }
+            const bool sorted = !has_appends(leaf.info->id);
+            batch.copy(leaf.keys, leaf.values,
+                       clamped_size(leaf, node_t::leaf_capacity), sorted);
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (!mutexes[leaf.info->id].validate(version)) {
+                descend = true;
+                continue;
+            }
+            batch.seek_back(bound, after);
+            if (!batch.empty()) {
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.first();
+                after = true;
+            }
+            if (prev_id == INVALID_NODE_ID) {
+                return loads;
+            }
+            // fails if the leaf changed while emit ran
+            descend = !next_leaf_optimistic(leaf, version, prev_id);
+            loads += !descend;
+        }
+#else
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            bool sorted = !has_appends(leaf_id);
+            batch.copy(leaf.keys, leaf.values, committed_size(leaf), sorted);
+            batch.seek_back(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.first();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                sorted = !has_appends(leaf_id);
+                const utils::scan::step step = utils::scan::resume_back(
+                    leaf.keys, committed_size(leaf), bound, sorted);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+                if (step == utils::scan::step::descend) {
+                    mutexes[leaf_id].unlock_shared();
+                    find_leaf_shared(leaf, bound);
+                    ++loads;
+                    continue;
+                }
+            }
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (prev_id == INVALID_NODE_ID) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            if (!mutexes[prev_id].try_lock_shared()) {
+                mutexes[leaf_id].unlock_shared();
+                find_leaf_shared(leaf, bound);
+                ++loads;
+                continue;
+            }
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(prev_id));
+            ++loads;
+        }
+#endif
+    }
+
+    // reads the count largest entries with keys <= max_key
+    uint32_t select_k_desc(size_t count, const key_type &max_key) {
+        return reverse_scan(max_key, [&](auto keys, auto) {
+            count -= std::min(count, keys.size());
+            return count > 0;
+        });
     }
 
     std::optional<value_type> get(const key_type &key) const {
+        if (const auto staged = staged_get(key)) {
+            return staged;
+        }
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, key, version)) {
+                continue;
+            }
+            const std::optional<value_type> result =
+                leaf_get(leaf, key, clamped_size(leaf, node_t::leaf_capacity));
+            if (mutexes[leaf.info->id].validate(version)) {
+                return result;
+            }
+        }
+#else
         find_leaf_shared(leaf, key);
         std::shared_lock lock(mutexes[leaf.info->id], std::adopt_lock);
-        uint16_t index = leaf.value_slot(key);
-        return index < leaf.info->size &&
-               (leaf.keys[index] == key ? std::make_optional(leaf.values[index])
-                                        : std::nullopt);
+        return leaf_get(leaf, key, committed_size(leaf));
+#endif
     }
 
     bool contains(const key_type &key) const {
+        if (staged_get(key)) {
+            return true;
+        }
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, key, version)) {
+                continue;
+            }
+            const bool result =
+                leaf_get(leaf, key, clamped_size(leaf, node_t::leaf_capacity))
+                    .has_value();
+            if (mutexes[leaf.info->id].validate(version)) {
+                return result;
+            }
+        }
+#else
         find_leaf_shared(leaf, key);
         std::shared_lock lock(mutexes[leaf.info->id], std::adopt_lock);
-        if (leaf.info->id != fp_metadata.fp_id) {
-            uint16_t index = leaf.value_slot(key);
-            return index < leaf.info->size && (leaf.keys[index] == key);
-        } else {
-            // do a linear scan of node
-            for (uint16_t i = 0; i < leaf.info->size; i++) {
-                if (leaf.keys[i] == key) {
-                    return true;
+        return leaf_get(leaf, key, committed_size(leaf)).has_value();
+#endif
+    }
+
+    /*
+        Looks up every key of keys into the same position of out, like get.
+        The lookups go down the tree in groups, one level per round. Each
+        prefetches the child it moves to and only latches it, or reads its
+        version, in the next round, so the cache misses of a group overlap.
+        A lookup keeps its parent latched while the others take their turn,
+        so it only try-locks the child; one that does not get it, or fails
+        validation, is left to get once the group is done. As in get, staged
+        keys are looked up in the staging buffer instead of the tree.
+    */
+    void multi_get(std::span<const key_type> keys,
+                   std::span<std::optional<value_type>> out) const {
+        constexpr size_t group_size = utils::lookup::group_size;
+        // the node each lookup latched or read the version of, and its child
+        node_id_t parents[group_size];
+        node_id_t children[group_size];
+#ifdef OPTIMISTIC_READS
+        uint32_t versions[group_size];
+#endif
+        // positions in keys of the lookups left to get
+        size_t retries[group_size];
+        node_t node;
+        for (size_t begin = 0; begin < keys.size(); begin += group_size) {
+            const auto guard = manager.pin();
+            const size_t n = std::min(group_size, keys.size() - begin);
+            std::fill_n(parents, n, INVALID_NODE_ID);
+            std::fill_n(children, n, root_id);
+            size_t pending = n;
+            if constexpr (STAGING_CAPACITY > 0) {
+                if (staging.size.load(std::memory_order_acquire) > 0) {
+                    std::shared_lock lock(staging.mutex);
+                    for (size_t i = 0; i < n; ++i) {
+                        out[begin + i] = staged_find(keys[begin + i]);
+                        if (out[begin + i]) {
+                            children[i] = INVALID_NODE_ID;
+                            --pending;
+                        }
+                    }
                 }
             }
-            return false;
+            size_t num_retries = 0;
+            while (pending > 0) {
+                for (size_t i = 0; i < n; ++i) {
+                    const node_id_t node_id = children[i];
+                    if (node_id == INVALID_NODE_ID) {
+                        continue;
+                    }
+                    const node_id_t parent_id = parents[i];
+                    const key_type &key = keys[begin + i];
+#ifdef OPTIMISTIC_READS
+                    const uint32_t version = mutexes[node_id].read_lock();
+                    bool valid = parent_id == INVALID_NODE_ID ||
+                                 mutexes[parent_id].validate(versions[i]);
+                    node.load(manager.open_block(node_id));
+                    if (valid && node.info->type == bp_node_type::INTERNAL) {
+                        const uint16_t slot = utils::search::upper_bound(
+                            node.keys,
+                            clamped_size(node, node_t::internal_capacity), key);
+                        const node_id_t child_id = node.children[slot];
+                        if (mutexes[node_id].validate(version)) {
+                            parents[i] = node_id;
+                            versions[i] = version;
+                            children[i] = child_id;
+                            mutexes.prefetch(child_id);
+                            node_t::prefetch(manager.open_block(child_id));
+                            continue;
+                        }
+                        valid = false;
+                    }
+                    if (valid) {
+                        const uint16_t leaf_size =
+                            clamped_size(node, node_t::leaf_capacity);
+                        out[begin + i] = leaf_get(node, key, leaf_size);
+                        valid = mutexes[node_id].validate(version);
+                    }
+#else
+                    const bool valid = mutexes[node_id].try_lock_shared();
+                    if (parent_id != INVALID_NODE_ID) {
+                        mutexes[parent_id].unlock_shared();
+                    }
+                    if (valid) {
+                        node.load(manager.open_block(node_id));
+                        if (node.info->type == bp_node_type::INTERNAL) {
+                            parents[i] = node_id;
+                            children[i] = node.children[node.child_slot(key)];
+                            mutexes.prefetch(children[i]);
+                            node_t::prefetch(manager.open_block(children[i]));
+                            continue;
+                        }
+                        const uint16_t leaf_size = committed_size(node);
+                        out[begin + i] = leaf_get(node, key, leaf_size);
+                        mutexes[node_id].unlock_shared();
+                    }
+#endif
+                    if (!valid) {
+                        retries[num_retries++] = begin + i;
+                    }
+                    children[i] = INVALID_NODE_ID;
+                    --pending;
+                }
+            }
+            for (size_t i = 0; i < num_retries; ++i) {
+                out[retries[i]] = get(keys[retries[i]]);
+            }
         }
     }
 };
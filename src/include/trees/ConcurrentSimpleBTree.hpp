@@ -1,27 +1,46 @@
 #pragma once
 
+#include <algorithm>
 #include <cstring>
+#include <iterator>
 #include <limits>
 #include <mutex>
 #include <optional>
 #include <ranges>
+#include <span>
 #include <vector>
 
 #include "BTreeNode.hpp"
 #include "MemoryBlockManager.hpp"
+#include "bulk.hpp"
+#include "latch_table.hpp"
 #include "locks.hpp"
+#include "lookup.hpp"
 #include "mtx.hpp"
-
-using atm::shared_mutex;
+#include "scan.hpp"
 
 namespace ConcurrentSimpleBTree {
-template <typename key_type, typename value_type>
+#ifdef OPTIMISTIC_READS
+using latch_t = olc::shared_mutex;
+#else
+using latch_t = atm::shared_mutex;
+#endif
+
+template <typename key_type, typename value_type,
+          typename latch_type = latch_t>
 class BTree {
    public:
     using node_id_t = uint32_t;
     using BlockManager = InMemoryBlockManager<node_id_t>;
+#ifdef EMBEDDED_LATCHES
+    using node_t = BTreeNode<node_id_t, key_type, value_type,
+                             BlockManager::block_size, latch_type>;
+    using latches_t = embedded_latch_table<node_t, BlockManager>;
+#else
     using node_t =
         BTreeNode<node_id_t, key_type, value_type, BlockManager::block_size>;
+    using latches_t = latch_table<latch_type, BlockManager>;
+#endif
     using step = node_id_t;
     using path_t = std::vector<step>;
 
@@ -30,6 +49,9 @@ class BTree {
     static constexpr uint16_t SPLIT_INTERNAL_POS =
         node_t::internal_capacity / 2;
     static constexpr uint16_t SPLIT_LEAF_POS = (node_t::leaf_capacity + 1) / 2;
+    // nodes below these sizes borrow from or merge with a sibling
+    static constexpr uint16_t MIN_LEAF_SIZE = node_t::leaf_capacity / 4;
+    static constexpr uint16_t MIN_INTERNAL_SIZE = node_t::internal_capacity / 4;
     static constexpr node_id_t INVALID_NODE_ID =
         std::numeric_limits<node_id_t>::max();
 
@@ -49,15 +71,17 @@ class BTree {
 
     explicit BTree(BlockManager &m)
         : manager(m),
-          mutexes(m.get_capacity()),
+          mutexes(m),
           root_id(m.allocate()),
           head_id(m.allocate()),
           height(1) {
         node_t leaf(manager.open_block(head_id), bp_node_type::LEAF);
         manager.mark_dirty(head_id);
         leaves = 1;
+        internal = 0;
         leaf.info->id = head_id;
         leaf.info->next_id = INVALID_NODE_ID;
+        leaf.info->prev_id = INVALID_NODE_ID;
         leaf.info->size = 0;
         node_t root(manager.open_block(root_id), bp_node_type::INTERNAL);
         manager.mark_dirty(root_id);
@@ -67,6 +91,33 @@ class BTree {
         root.children[0] = head_id;
     }
 
+    /*
+        Builds the tree bottom-up out of [begin, end), keys or key/value pairs
+        in strictly ascending key order, instead of inserting them one by one.
+        Nodes are filled to fill_factor, in [0.5, 1], of their capacity and
+        num_threads share the work on each level. Requires a tree that was
+        just constructed and that no other thread uses yet.
+    */
+    template <std::random_access_iterator It>
+    void bulk_load(It begin, It end, double fill_factor = 1.0,
+                   unsigned num_threads = 1) {
+        utils::bulk::loader<node_t, BlockManager> loader(manager, num_threads);
+        loader.leaves(begin, end, node_t::leaf_capacity, fill_factor, head_id);
+        leaves = loader.ids.size();
+        while (loader.ids.size() > 1) {
+            loader.internal(node_t::internal_capacity, fill_factor);
+            internal += loader.ids.size();
+            ++height;
+        }
+        // the single node on top takes the place of the root
+        if (height > 1) {
+            loader.move_to(root_id);
+            --internal;
+            --height;
+        }
+        size = end - begin;
+    }
+
     friend std::ostream &operator<<(std::ostream &os, const BTree &tree) {
         os << tree.size << ", " << +tree.height << ", " << tree.internal << ", "
            << tree.leaves;
@@ -81,6 +132,7 @@ class BTree {
     }
 
     bool update(const key_type &key, const value_type &value) {
+        const auto guard = manager.pin();
         node_t leaf;
         find_leaf_exclusive(leaf, key);
         uint16_t index = leaf.value_slot(key);
@@ -96,6 +148,7 @@ class BTree {
 
     static constexpr size_t OPT_RETRIES = 4;
     void insert(const key_type &key, const value_type &value) {
+        const auto guard = manager.pin();
         node_t leaf;
         for (size_t i = 0; i < OPT_RETRIES; ++i) {
             find_leaf_exclusive(leaf, key);
@@ -109,6 +162,7 @@ class BTree {
     }
 
     void insert_pessimistic(const key_type &key, const value_type &value) {
+        const auto guard = manager.pin();
         node_t leaf;
         path_t path;
         find_leaf_exclusive(leaf, path, key);
@@ -124,8 +178,110 @@ class BTree {
         split_insert(leaf, index, path, key, value);
     }
 
+    /*
+        Inserts the entries of batch, which it sorts by key, like insert one
+        by one would; the last of the entries with equal keys wins. Each run
+        of entries that belongs to the same leaf is merged into it in a single
+        pass under one latch, as far as it fits. The entry that finds the leaf
+        full goes through insert, which splits it.
+    */
+    void insert_batch(std::span<std::pair<key_type, value_type>> batch) {
+        const auto guard = manager.pin();
+        const size_t n = utils::bulk::prepare(batch);
+        node_t leaf;
+        key_type leaf_max{};
+        for (size_t i = 0; i < n;) {
+            const auto &[key, value] = batch[i];
+            find_leaf_exclusive(leaf, key, leaf_max);
+            const size_t taken = leaf_merge(
+                leaf,
+                utils::bulk::run(batch.subspan(i, n - i),
+                                 leaf.info->next_id == INVALID_NODE_ID
+                                     ? nullptr
+                                     : &leaf_max));
+            mutexes[leaf.info->id].unlock();
+            if (taken == 0) {
+                insert(key, value);
+                ++i;
+            }
+            i += taken;
+        }
+    }
+
+    bool erase(const key_type &key) {
+        const auto guard = manager.pin();
+        node_t leaf;
+        find_leaf_exclusive(leaf, key);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            mutexes[leaf.info->id].unlock();
+            return false;
+        }
+        if (leaf.info->size > MIN_LEAF_SIZE) {
+            size.fetch_sub(1, std::memory_order_relaxed);
+            manager.mark_dirty(leaf.info->id);
+            leaf.erase_value(index);
+            mutexes[leaf.info->id].unlock();
+            return true;
+        }
+        mutexes[leaf.info->id].unlock();
+        return erase_pessimistic(key);
+    }
+
+    bool erase_pessimistic(const key_type &key) {
+        const auto guard = manager.pin();
+        node_t leaf;
+        path_t path;
+        find_leaf_erase(leaf, path, key);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            mutexes[leaf.info->id].unlock();
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            return false;
+        }
+        size.fetch_sub(1, std::memory_order_relaxed);
+        manager.mark_dirty(leaf.info->id);
+        leaf.erase_value(index);
+        rebalance(leaf, path, key);
+        return true;
+    }
+
     uint32_t select_k(size_t count, const key_type &min_key) const {
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, min_key, version)) {
+                continue;
+            }
+            uint16_t curr_size = clamped_size(leaf, node_t::leaf_capacity);
+            uint16_t index =
+                utils::search::lower_bound(leaf.keys, curr_size, min_key);
+            uint32_t loads = 1;
+            size_t remaining = count;
+            bool valid = true;
+            curr_size -= index;
+            while (remaining > curr_size) {
+                remaining -= curr_size;
+                node_id_t next_id = leaf.info->next_id;
+                if (next_id == INVALID_NODE_ID) {
+                    break;
+                }
+                if (!next_leaf_optimistic(leaf, version, next_id)) {
+                    valid = false;
+                    break;
+                }
+                curr_size = clamped_size(leaf, node_t::leaf_capacity);
+                ++loads;
+            }
+            if (valid && mutexes[leaf.info->id].validate(version)) {
+                return loads;
+            }
+        }
+#else
         find_leaf_shared(leaf, min_key);
         uint16_t index = leaf.value_slot(min_key);
         uint32_t loads = 1;
@@ -144,13 +300,42 @@ class BTree {
         }
         mutexes[leaf.info->id].unlock_shared();
         return loads;
+#endif
     }
 
     uint32_t range(const key_type &min_key, const key_type &max_key) const {
-        uint32_t loads = 1;
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, min_key, version)) {
+                continue;
+            }
+            uint32_t loads = 1;
+            bool valid = true;
+            uint16_t curr_size = clamped_size(leaf, node_t::leaf_capacity);
+            while (curr_size > 0 && leaf.keys[curr_size - 1] < max_key) {
+                node_id_t next_id = leaf.info->next_id;
+                if (next_id == INVALID_NODE_ID) {
+                    break;
+                }
+                if (!next_leaf_optimistic(leaf, version, next_id)) {
+                    valid = false;
+                    break;
+                }
+                curr_size = clamped_size(leaf, node_t::leaf_capacity);
+                ++loads;
+            }
+            if (valid && mutexes[leaf.info->id].validate(version)) {
+                return loads;
+            }
+        }
+#else
+        uint32_t loads = 1;
         find_leaf_shared(leaf, min_key);
-        while (leaf.keys[leaf.info->size - 1] < max_key) {
+        while (leaf.info->size > 0 &&
+               leaf.keys[leaf.info->size - 1] < max_key) {
             node_id_t next_id = leaf.info->next_id;
             if (next_id == INVALID_NODE_ID) {
                 break;
@@ -162,27 +347,345 @@ class BTree {
         }
         mutexes[leaf.info->id].unlock_shared();
         return loads;
+#endif
+    }
+
+    /*
+        Hands the entries with keys >= min_key to emit in key order, one leaf
+        at a time, as emit(keys, values) with two std::span of equal length.
+        Stops once emit returns false or the last leaf was read; returns the
+        number of leaves read. Each batch is copied out of its leaf, so emit
+        runs without a latch held. The scan then goes on after the last key
+        it emitted, from the root again if the leaf was merged away or
+        changed in a way that may have moved the following keys.
+    */
+    template <typename F>
+    uint32_t scan(const key_type &min_key, F &&emit) const {
+        const auto guard = manager.pin();
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = min_key;
+        // set once the entries up to bound were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+#ifdef OPTIMISTIC_READS
+        uint32_t version;
+        bool descend = true;
+        while (true) {
+            if (descend) {
+                if (!find_leaf_optimistic(leaf, bound, version)) {
+                    continue;
+                }
+                descend = false;
+                ++loads;
+            }
+            batch.copy(leaf.keys, leaf.values,
+                       clamped_size(leaf, node_t::leaf_capacity), true);
+            const node_id_t next_id = leaf.info->next_id;
+            if (!mutexes[leaf.info->id].validate(version)) {
+                descend = true;
+                continue;
+            }
+            batch.seek(bound, after);
+            if (!batch.empty()) {
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.last();
+                after = true;
+            }
+            if (next_id == INVALID_NODE_ID) {
+                return loads;
+            }
+            // fails if the leaf changed while emit ran
+            descend = !next_leaf_optimistic(leaf, version, next_id);
+            loads += !descend;
+        }
+#else
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            batch.copy(leaf.keys, leaf.values, leaf.info->size, true);
+            batch.seek(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.last();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                const utils::scan::step step = utils::scan::resume(
+                    leaf.keys, leaf.info->size, bound, true);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+                if (step == utils::scan::step::descend) {
+                    mutexes[leaf_id].unlock_shared();
+                    find_leaf_shared(leaf, bound);
+                    ++loads;
+                    continue;
+                }
+            }
+            const node_id_t next_id = leaf.info->next_id;
+            if (next_id == INVALID_NODE_ID) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            mutexes[next_id].lock_shared();
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(next_id));
+            ++loads;
+        }
+#endif
+    }
+
+    /*
+        Hands the entries with keys <= max_key to emit like scan, but one leaf
+        at a time from right to left: the batches come in descending order,
+        while the keys within each batch ascend. Leaves are only latched
+        right to left with try_lock_shared; a scan that does not get the left
+        sibling drops its latch and descends from the root again, so it
+        cannot deadlock with writers or forward scans.
+    */
+    template <typename F>
+    uint32_t reverse_scan(const key_type &max_key, F &&emit) const {
+        const auto guard = manager.pin();
+        utils::scan::batch<key_type, value_type, node_t::leaf_capacity> batch;
+        key_type bound = max_key;
+        // set once the entries from bound on were emitted
+        bool after = false;
+        uint32_t loads = 0;
+        node_t leaf;
+#ifdef OPTIMISTIC_READS
+        uint32_t version;
+        bool descend = true;
+        while (true) {
+            if (descend) {
+                if (!find_leaf_optimistic(leaf, bound, version)) {
+                    continue;
+                }
+                descend = false;
+                ++loads;
+            }
+            batch.copy(leaf.keys, leaf.values,
+                       clamped_size(leaf, node_t::leaf_capacity), true);
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (!mutexes[leaf.info->id].validate(version)) {
+                descend = true;
+                continue;
+            }
+            batch.seek_back(bound, after);
+            if (!batch.empty()) {
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.first();
+                after = true;
+            }
+            if (prev_id == INVALID_NODE_ID) {
+                return loads;
+            }
+            // fails if the leaf changed while emit ran
+            descend = !next_leaf_optimistic(leaf, version, prev_id);
+            loads += !descend;
+        }
+#else
+        find_leaf_shared(leaf, bound);
+        loads = 1;
+        while (true) {
+            const node_id_t leaf_id = leaf.info->id;
+            batch.copy(leaf.keys, leaf.values, leaf.info->size, true);
+            batch.seek_back(bound, after);
+            if (!batch.empty()) {
+                mutexes[leaf_id].unlock_shared();
+                if (!batch.emit(emit)) {
+                    return loads;
+                }
+                bound = batch.first();
+                after = true;
+                mutexes[leaf_id].lock_shared();
+                const utils::scan::step step = utils::scan::resume_back(
+                    leaf.keys, leaf.info->size, bound, true);
+                if (step == utils::scan::step::reread) {
+                    continue;
+                }
+                if (step == utils::scan::step::descend) {
+                    mutexes[leaf_id].unlock_shared();
+                    find_leaf_shared(leaf, bound);
+                    ++loads;
+                    continue;
+                }
+            }
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (prev_id == INVALID_NODE_ID) {
+                mutexes[leaf_id].unlock_shared();
+                return loads;
+            }
+            if (!mutexes[prev_id].try_lock_shared()) {
+                mutexes[leaf_id].unlock_shared();
+                find_leaf_shared(leaf, bound);
+                ++loads;
+                continue;
+            }
+            mutexes[leaf_id].unlock_shared();
+            leaf.load(manager.open_block(prev_id));
+            ++loads;
+        }
+#endif
+    }
+
+    // reads the count largest entries with keys <= max_key
+    uint32_t select_k_desc(size_t count, const key_type &max_key) const {
+        return reverse_scan(max_key, [&](auto keys, auto) {
+            count -= std::min(count, keys.size());
+            return count > 0;
+        });
     }
 
     std::optional<value_type> get(const key_type &key) const {
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, key, version)) {
+                continue;
+            }
+            const std::optional<value_type> result =
+                leaf_get(leaf, key, clamped_size(leaf, node_t::leaf_capacity));
+            if (mutexes[leaf.info->id].validate(version)) {
+                return result;
+            }
+        }
+#else
         find_leaf_shared(leaf, key);
-        uint16_t index = leaf.value_slot(key);
-        bool result =
-            index < leaf.info->size &&
-            (leaf.keys[index] == key ? std::make_optional(leaf.values[index])
-                                     : std::nullopt);
+        const std::optional<value_type> result =
+            leaf_get(leaf, key, leaf.info->size);
         mutexes[leaf.info->id].unlock_shared();
         return result;
+#endif
     }
 
     bool contains(const key_type &key) const {
+        const auto guard = manager.pin();
         node_t leaf;
+#ifdef OPTIMISTIC_READS
+        while (true) {
+            uint32_t version;
+            if (!find_leaf_optimistic(leaf, key, version)) {
+                continue;
+            }
+            const uint16_t leaf_size =
+                clamped_size(leaf, node_t::leaf_capacity);
+            uint16_t index =
+                utils::search::lower_bound(leaf.keys, leaf_size, key);
+            bool result = index < leaf_size && (leaf.keys[index] == key);
+            if (mutexes[leaf.info->id].validate(version)) {
+                return result;
+            }
+        }
+#else
         find_leaf_shared(leaf, key);
         uint16_t index = leaf.value_slot(key);
         bool result = index < leaf.info->size && (leaf.keys[index] == key);
         mutexes[leaf.info->id].unlock_shared();
         return result;
+#endif
+    }
+
+    /*
+        Looks up every key of keys into the same position of out, like get.
+        The lookups go down the tree in groups, one level per round. Each
+        prefetches the child it moves to and only latches it, or reads its
+        version, in the next round, so the cache misses of a group overlap.
+        A lookup keeps its parent latched while the others take their turn,
+        so it only try-locks the child; one that does not get it, or fails
+        validation, is left to get once the group is done.
+    */
+    void multi_get(std::span<const key_type> keys,
+                   std::span<std::optional<value_type>> out) const {
+        constexpr size_t group_size = utils::lookup::group_size;
+        // the node each lookup latched or read the version of, and its child
+        node_id_t parents[group_size];
+        node_id_t children[group_size];
+#ifdef OPTIMISTIC_READS
+        uint32_t versions[group_size];
+#endif
+        // positions in keys of the lookups left to get
+        size_t retries[group_size];
+        node_t node;
+        for (size_t begin = 0; begin < keys.size(); begin += group_size) {
+            const auto guard = manager.pin();
+            const size_t n = std::min(group_size, keys.size() - begin);
+            std::fill_n(parents, n, INVALID_NODE_ID);
+            std::fill_n(children, n, root_id);
+            size_t pending = n;
+            size_t num_retries = 0;
+            while (pending > 0) {
+                for (size_t i = 0; i < n; ++i) {
+                    const node_id_t node_id = children[i];
+                    if (node_id == INVALID_NODE_ID) {
+                        continue;
+                    }
+                    const node_id_t parent_id = parents[i];
+                    const key_type &key = keys[begin + i];
+#ifdef OPTIMISTIC_READS
+                    const uint32_t version = mutexes[node_id].read_lock();
+                    bool valid = parent_id == INVALID_NODE_ID ||
+                                 mutexes[parent_id].validate(versions[i]);
+                    node.load(manager.open_block(node_id));
+                    if (valid && node.info->type == bp_node_type::INTERNAL) {
+                        const uint16_t slot = utils::search::upper_bound(
+                            node.keys,
+                            clamped_size(node, node_t::internal_capacity), key);
+                        const node_id_t child_id = node.children[slot];
+                        if (mutexes[node_id].validate(version)) {
+                            parents[i] = node_id;
+                            versions[i] = version;
+                            children[i] = child_id;
+                            mutexes.prefetch(child_id);
+                            node_t::prefetch(manager.open_block(child_id));
+                            continue;
+                        }
+                        valid = false;
+                    }
+                    if (valid) {
+                        const uint16_t leaf_size =
+                            clamped_size(node, node_t::leaf_capacity);
+                        out[begin + i] = leaf_get(node, key, leaf_size);
+                        valid = mutexes[node_id].validate(version);
+                    }
+#else
+                    const bool valid = mutexes[node_id].try_lock_shared();
+                    if (parent_id != INVALID_NODE_ID) {
+                        mutexes[parent_id].unlock_shared();
+                    }
+                    if (valid) {
+                        node.load(manager.open_block(node_id));
+                        if (node.info->type == bp_node_type::INTERNAL) {
+                            parents[i] = node_id;
+                            children[i] = node.children[node.child_slot(key)];
+                            mutexes.prefetch(children[i]);
+                            node_t::prefetch(manager.open_block(children[i]));
+                            continue;
+                        }
+                        out[begin + i] = leaf_get(node, key, node.info->size);
+                        mutexes[node_id].unlock_shared();
+                    }
+#endif
+                    if (!valid) {
+                        retries[num_retries++] = begin + i;
+                    }
+                    children[i] = INVALID_NODE_ID;
+                    --pending;
+                }
+            }
+            for (size_t i = 0; i < num_retries; ++i) {
+                out[retries[i]] = get(keys[retries[i]]);
+            }
+        }
     }
 
    private:
@@ -192,8 +695,12 @@ class BTree {
         node_t root(manager.open_block(root_id));
         node_t left_node(manager.open_block(left_node_id));
         ++internal;
-        std::memcpy(left_node.info, root.info, BlockManager::block_size);
+        // a raw copy of the block, so an embedded latch comes along held and
+        // is reset below
+        std::memcpy(static_cast<void *>(left_node.info), root.info,
+                    BlockManager::block_size);
         left_node.info->id = left_node_id;
+        mutexes.reset(left_node_id);
         manager.mark_dirty(left_node_id);
         manager.mark_dirty(root_id);
         root.info->size = 1;
@@ -218,6 +725,72 @@ class BTree {
         } while (node.info->type == bp_node_type::INTERNAL);
     }
 
+    // requires leaf to be latched, or its version to be validated after
+    std::optional<value_type> leaf_get(const node_t &leaf, const key_type &key,
+                                       uint16_t n) const {
+        uint16_t index = utils::search::lower_bound(leaf.keys, n, key);
+        if (index < n && leaf.keys[index] == key) {
+            return leaf.values[index];
+        }
+        return std::nullopt;
+    }
+
+#ifdef OPTIMISTIC_READS
+    // sizes read optimistically may be garbage, keep searches inside the node
+    static uint16_t clamped_size(const node_t &node, uint16_t capacity) {
+        return std::min(node.info->size, capacity);
+    }
+
+    /*
+        Optimistic lock coupling: descends to the leaf responsible for key
+        without writing to any latch. A child is only entered once the
+        parent's version validated after reading the child id, and again after
+        reading the child's version. Returns false on a conflict with a writer;
+        otherwise version has to be validated once the caller is done reading
+        the leaf.
+    */
+    bool find_leaf_optimistic(node_t &node, const key_type &key,
+                              uint32_t &version) const {
+        node_id_t node_id = root_id;
+        version = mutexes[node_id].read_lock();
+        node.load(manager.open_block(node_id));
+        do {
+            const uint16_t slot = utils::search::upper_bound(
+                node.keys, clamped_size(node, node_t::internal_capacity), key);
+            const node_id_t child_id = node.children[slot];
+            if (!mutexes[node_id].validate(version)) {
+                return false;
+            }
+            const uint32_t child_version = mutexes[child_id].read_lock();
+            if (!mutexes[node_id].validate(version)) {
+                return false;
+            }
+            node_id = child_id;
+            version = child_version;
+            node.load(manager.open_block(node_id));
+        } while (node.info->type == bp_node_type::INTERNAL);
+        return true;
+    }
+
+    /*
+        Moves an optimistic reader from leaf to its sibling next_id, on
+        either side. Returns false if leaf changed since version was taken.
+    */
+    bool next_leaf_optimistic(node_t &leaf, uint32_t &version,
+                              node_id_t next_id) const {
+        if (!mutexes[leaf.info->id].validate(version)) {
+            return false;
+        }
+        const uint32_t next_version = mutexes[next_id].read_lock();
+        if (!mutexes[leaf.info->id].validate(version)) {
+            return false;
+        }
+        version = next_version;
+        leaf.load(manager.open_block(next_id));
+        return true;
+    }
+#endif
+
     void find_leaf_exclusive(node_t &node, path_t &path,
                              const key_type &key) const {
         node_id_t node_id = root_id;
@@ -247,6 +820,16 @@ class BTree {
     }
 
     void find_leaf_exclusive(node_t &node, const key_type &key) const {
+        key_type leaf_max;
+        find_leaf_exclusive(node, key, leaf_max);
+    }
+
+    /*
+        Also sets leaf_max to the separator above the leaf, unless it is the
+        last one. The latched leaf keeps it as its upper bound.
+    */
+    void find_leaf_exclusive(node_t &node, const key_type &key,
+                             key_type &leaf_max) const {
         node_id_t parent_id = root_id;
         mutexes[root_id].lock_shared();
         ctr_root_shared.fetch_add(1, std::memory_order_relaxed);
@@ -254,6 +837,9 @@ class BTree {
         node.load(manager.open_block(parent_id));
         while (--i > 0) {
             const uint16_t slot = node.child_slot(key);
+            if (slot != node.info->size) {
+                leaf_max = node.keys[slot];
+            }
             const node_id_t child_id = node.children[slot];
             mutexes[child_id].lock_shared();
             mutexes[parent_id].unlock_shared();
@@ -261,12 +847,169 @@ class BTree {
             parent_id = child_id;
         }
         const uint16_t slot = node.child_slot(key);
+        if (slot != node.info->size) {
+            leaf_max = node.keys[slot];
+        }
         const node_id_t leaf_id = node.children[slot];
         mutexes[leaf_id].lock();
         mutexes[parent_id].unlock_shared();
         node.load(manager.open_block(leaf_id));
     }
 
+    bool underflows(const node_t &node) const {
+        return node.info->size < (node.info->type == bp_node_type::LEAF
+                                      ? MIN_LEAF_SIZE
+                                      : MIN_INTERNAL_SIZE);
+    }
+
+    // true if erasing one entry from node cannot change its parent
+    bool erase_safe(const node_t &node) const {
+        if (node.info->type == bp_node_type::LEAF) {
+            return node.info->size > MIN_LEAF_SIZE;
+        }
+        return node.info->size >
+               (node.info->id == root_id ? 1 : MIN_INTERNAL_SIZE);
+    }
+
+    /*
+        Like find_leaf_exclusive, but path keeps the ancestors an erase
+        could underflow into, plus the parent of the topmost one.
+    */
+    void find_leaf_erase(node_t &node, path_t &path,
+                         const key_type &key) const {
+        node_id_t node_id = root_id;
+        mutexes[node_id].lock();
+        ++ctr_root_exclusive;
+        path.reserve(height);
+        node.load(manager.open_block(node_id));
+        do {
+            if (erase_safe(node)) {
+                for (const auto &parent_id : path) {
+                    mutexes[parent_id].unlock();
+                }
+                path.clear();
+            }
+            path.push_back(node_id);
+            uint16_t slot = node.child_slot(key);
+            node_id = node.children[slot];
+            mutexes[node_id].lock();
+            node.load(manager.open_block(node_id));
+        } while (node.info->type == bp_node_type::INTERNAL);
+        if (erase_safe(node)) {
+            for (const auto &parent_id : path) {
+                mutexes[parent_id].unlock();
+            }
+            path.clear();
+        }
+    }
+
+    /*
+        Restores the minimum size of node, reached through path on the way to
+        key, by borrowing from or merging with a sibling under the same
+        parent. Merges repeat this for the parent, and the root is collapsed
+        once it is left with a single internal child. Requires node and path
+        to be locked and releases them. Siblings are locked left to right, as
+        scans do; node is unlocked first if its sibling is on the left, which
+        is safe as it cannot be split or merged without the locked parent.
+    */
+    void rebalance(node_t &node, path_t &path, const key_type &key) {
+        while (!path.empty() && underflows(node)) {
+            const node_id_t node_id = node.info->id;
+            node.load(manager.open_block(path.back()));
+            path.pop_back();
+            if (node.info->size == 0) {
+                mutexes[node_id].unlock();
+                break;
+            }
+            uint16_t slot = node.child_slot(key);
+            if (slot == node.info->size) {
+                --slot;
+                mutexes[node_id].unlock();
+                mutexes[node.children[slot]].lock();
+                mutexes[node_id].lock();
+            } else {
+                mutexes[node.children[slot + 1]].lock();
+            }
+            node_t left(manager.open_block(node.children[slot]));
+            node_t right(manager.open_block(node.children[slot + 1]));
+            manager.mark_dirty(node.info->id);
+            manager.mark_dirty(left.info->id);
+            manager.mark_dirty(right.info->id);
+            if (!left.fits(right)) {
+                node.keys[slot] = left.redistribute(right, node.keys[slot]);
+                mutexes[left.info->id].unlock();
+                mutexes[right.info->id].unlock();
+                break;
+            }
+            left.merge(right, node.keys[slot]);
+            if (right.info->type == bp_node_type::LEAF) {
+                link_prev(left.info->next_id, left.info->id);
+            }
+            node.erase_child(slot + 1);
+            if (right.info->type == bp_node_type::LEAF) {
+                --leaves;
+            } else {
+                --internal;
+            }
+            const node_id_t right_id = right.info->id;
+            // lets scans that latch it again see that it is gone
+            right.info->size = 0;
+            mutexes[left.info->id].unlock();
+            mutexes[right_id].unlock();
+            manager.retire(right_id);
+        }
+        if (node.info->id == root_id) {
+            collapse_root();
+        }
+        mutexes[node.info->id].unlock();
+        for (const auto &parent_id : path) {
+            mutexes[parent_id].unlock();
+        }
+    }
+
+    /*
+        Pulls the only child of the root into the root block, root_id is
+        fixed. Requires the root to be locked.
+    */
+    void collapse_root() {
+        node_t root(manager.open_block(root_id));
+        while (root.info->size == 0) {
+            const node_id_t child_id = root.children[0];
+            mutexes[child_id].lock();
+            node_t child(manager.open_block(child_id));
+            if (child.info->type != bp_node_type::INTERNAL) {
+                mutexes[child_id].unlock();
+                return;
+            }
+            manager.mark_dirty(root_id);
+            root.info->size = child.info->size;
+            std::memcpy(root.keys, child.keys,
+                        child.info->size * sizeof(key_type));
+            std::memcpy(root.children, child.children,
+                        (child.info->size + 1) * sizeof(node_id_t));
+            --internal;
+            --height;
+            mutexes[child_id].unlock();
+            manager.retire(child_id);
+        }
+    }
+
+    /*
+        Points the leaf next_id, unless the chain ends before it, back at
+        prev_id. Requires the leaf left of next_id to be locked, so leaves
+        are locked left to right.
+    */
+    void link_prev(node_id_t next_id, node_id_t prev_id) {
+        if (next_id == INVALID_NODE_ID) {
+            return;
+        }
+        mutexes[next_id].lock();
+        node_t next(manager.open_block(next_id));
+        manager.mark_dirty(next_id);
+        next.info->prev_id = prev_id;
+        mutexes[next_id].unlock();
+    }
+
     void internal_insert(const path_t &path, key_type key, node_id_t child_id) {
         for (node_id_t node_id : std::ranges::reverse_view(path)) {
             node_t node(manager.open_block(node_id));
@@ -326,7 +1069,8 @@ class BTree {
                             (index - node.info->size) * sizeof(uint32_t));
                 std::memcpy(new_node.children + 1 + index - node.info->size,
                             node.children + 1 + index,
-                            new_node.info->size * sizeof(uint32_t));
+                            (node_t::internal_capacity - index) *
+                                sizeof(uint32_t));
                 new_node.children[index - node.info->size] = child_id;
                 key = node.keys[node.info->size];
             }
@@ -339,6 +1083,25 @@ class BTree {
         mutexes[root_id].unlock();
     }
 
+    /*
+        Merges as many entries from the front of run, whose keys all belong to
+        the exclusively latched leaf, into it as fit. Returns how many.
+    */
+    size_t leaf_merge(node_t &leaf,
+                      std::span<std::pair<key_type, value_type>> run) {
+        const auto [taken, total] = utils::bulk::fitting(
+            leaf.keys, leaf.info->size, run, node_t::leaf_capacity);
+        if (taken == 0) {
+            return 0;
+        }
+        size.fetch_add(total - leaf.info->size, std::memory_order_relaxed);
+        manager.mark_dirty(leaf.info->id);
+        utils::bulk::merge(leaf.keys, leaf.values, leaf.info->size,
+                           run.first(taken), total);
+        leaf.info->size = total;
+        return taken;
+    }
+
     bool leaf_insert(node_t &leaf, uint16_t index, const key_type &key,
                      const value_type &value) {
         if (index < leaf.info->size && leaf.keys[index] == key) {
@@ -375,6 +1138,8 @@ class BTree {
         new_leaf.info->next_id = leaf.info->next_id;
         new_leaf.info->size = node_t::leaf_capacity + 1 - split_leaf_pos;
         leaf.info->next_id = new_leaf_id;
+        new_leaf.info->prev_id = leaf.info->id;
+        link_prev(new_leaf.info->next_id, new_leaf_id);
         leaf.info->size = split_leaf_pos;
         if (index < leaf.info->size) {
             std::memcpy(new_leaf.keys, leaf.keys + leaf.info->size - 1,
@@ -405,7 +1170,7 @@ class BTree {
     }
 
     BlockManager &manager;
-    mutable std::vector<shared_mutex> mutexes;
+    mutable latches_t mutexes;
     const node_id_t root_id;
     node_id_t head_id;
     uint8_t height;
@@ -2,14 +2,20 @@
 
 #include <ikr.h>
 
+#include <algorithm>
 #include <cstring>
+#include <iterator>
 #include <limits>
 #include <optional>
 #include <ranges>
+#include <span>
 #include <vector>
 
 #include "BTreeNode.hpp"
 #include "MemoryBlockManager.hpp"
+#include "bulk.hpp"
+#include "lookup.hpp"
+#include "order.hpp"
 
 namespace QuITBTree {
 
@@ -40,8 +46,13 @@ class BTree {
    public:
     using node_id_t = uint32_t;
     using BlockManager = InMemoryBlockManager<node_id_t>;
+#ifdef ORDER_STATISTICS
+    using node_t = BTreeNode<node_id_t, key_type, value_type,
+                             BlockManager::block_size, void, uint32_t>;
+#else
     using node_t =
         BTreeNode<node_id_t, key_type, value_type, BlockManager::block_size>;
+#endif
     using step = node_id_t;
     using path_t = std::array<node_id_t, 10>;
 
@@ -51,6 +62,9 @@ class BTree {
         node_t::internal_capacity / 2;
     static constexpr uint16_t SPLIT_LEAF_POS = (node_t::leaf_capacity + 1) / 2;
     static constexpr uint16_t IQR_SIZE_THRESH = SPLIT_LEAF_POS;
+    // nodes below these sizes borrow from or merge with a sibling
+    static constexpr uint16_t MIN_LEAF_SIZE = node_t::leaf_capacity / 4;
+    static constexpr uint16_t MIN_INTERNAL_SIZE = node_t::internal_capacity / 4;
     static constexpr node_id_t INVALID_NODE_ID =
         std::numeric_limits<node_id_t>::max();
     using dist_f = std::size_t (*)(const key_type &, const key_type &);
@@ -80,6 +94,7 @@ class BTree {
         manager.mark_dirty(root_id);
         root.info->id = root_id;
         root.info->next_id = root_id;
+        root.info->prev_id = INVALID_NODE_ID;
         root.info->size = 0;
 
         size = 0;
@@ -90,6 +105,45 @@ class BTree {
         ctr_redistribute = 0;
     }
 
+    /*
+        Builds the tree bottom-up out of [begin, end), keys or key/value pairs
+        in strictly ascending key order, instead of inserting them one by one.
+        Nodes are filled to fill_factor, in [0.5, 1], of their capacity and
+        num_threads share the work on each level. Requires a tree that was
+        just constructed.
+    */
+    template <std::random_access_iterator It>
+    void bulk_load(It begin, It end, double fill_factor = 1.0,
+                   unsigned num_threads = 1) {
+        utils::bulk::loader<node_t, BlockManager> loader(manager, num_threads);
+        loader.leaves(begin, end, node_t::leaf_capacity, fill_factor);
+        leaves = loader.ids.size();
+        // the fast-path starts at the tail, preceded by the leaf before it
+        head_id = loader.ids.front();
+        tail_id = fp_id = loader.ids.back();
+        fp_min = loader.mins.back();
+        lol_size = node_t(manager.open_block(tail_id)).info->size;
+        if (leaves > 1) {
+            lol_prev_id = loader.ids[leaves - 2];
+            lol_prev_min = loader.mins[leaves - 2];
+            lol_prev_size = node_t(manager.open_block(lol_prev_id)).info->size;
+        }
+        while (loader.ids.size() > 1) {
+            loader.internal(node_t::internal_capacity, fill_factor);
+            internal += loader.ids.size();
+            ++height;
+        }
+        // the single node on top takes the place of the root, which stays
+        // counted in internal as it is on the insert path
+        loader.move_to(root_id);
+        if (leaves == 1) {
+            head_id = tail_id = fp_id = root_id;
+        }
+        size = end - begin;
+        node_t leaf;
+        find_leaf(leaf, fp_path, fp_min);
+    }
+
     bool update(const key_type &key, const value_type &value) {
         node_t leaf;
         path_t path;
@@ -152,6 +206,73 @@ class BTree {
         return leaf_insert(leaf, path, key, value);
     }
 
+    /*
+        Inserts the entries of batch, which it sorts by key, like insert one
+        by one would; the last of the entries with equal keys wins. Each run
+        of entries that belongs to the same leaf is merged into it in a single
+        pass, which splits the leaf into as many leaves as the run needs. Runs
+        that fall into the fast-path skip the search, the others count as its
+        misses and a hard reset moves it to the leaf holding their end.
+    */
+    void insert_batch(std::span<std::pair<key_type, value_type>> batch) {
+        const size_t n = utils::bulk::prepare(batch);
+        node_t leaf;
+        path_t path;
+        for (size_t i = 0; i < n;) {
+            const key_type &key = batch[i].first;
+            key_type leaf_max = fp_max;
+            const bool fast = (fp_id == head_id || fp_min <= key) &&
+                              (fp_id == tail_id || key < fp_max);
+            if (fast) {
+                leaf.load(manager.open_block(fp_id));
+                life.success();
+            } else {
+                leaf_max = find_leaf(leaf, path, key);
+            }
+            const auto run = utils::bulk::run(
+                batch.subspan(i, n - i),
+                leaf.info->id == tail_id ? nullptr : &leaf_max);
+            i += run.size();
+            if (fast) {
+                ctr_fast += run.size();
+            }
+            const node_t last = leaf_merge(leaf, run);
+            if (!fast && life.failure()) {
+                ++ctr_hard;
+                lol_prev_id = INVALID_NODE_ID;
+                fp_id = last.info->id;
+                fp_min = last.keys[0];
+                fp_max = leaf_max;
+                lol_size = last.info->size;
+                find_leaf(leaf, fp_path, fp_min);
+                life.reset();
+            }
+        }
+    }
+
+    bool erase(const key_type &key) {
+        node_t leaf;
+        path_t path;
+        find_leaf(leaf, path, key);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            return false;
+        }
+        --size;
+        utils::order::adjust<node_t>(manager, root_id, key, -1);
+        manager.mark_dirty(leaf.info->id);
+        leaf.erase_value(index);
+        if (leaf.info->id == fp_id) {
+            --lol_size;
+        } else if (leaf.info->id == lol_prev_id) {
+            --lol_prev_size;
+        }
+        if (underflows(leaf)) {
+            rebalance(leaf, path, key);
+        }
+        return true;
+    }
+
     size_t select_k(size_t count, const key_type &min_key) const {
         node_t leaf;
         path_t path;
@@ -178,7 +299,8 @@ class BTree {
         node_t leaf;
         path_t path;
         find_leaf(leaf, path, min_key);
-        while (leaf.keys[leaf.info->size - 1] < max_key) {
+        while (leaf.info->size > 0 &&
+               leaf.keys[leaf.info->size - 1] < max_key) {
             if (leaf.info->id == tail_id) {
                 break;
             }
@@ -189,19 +311,144 @@ class BTree {
         return loads;
     }
 
+    /*
+        Hands the entries with keys >= min_key to emit in key order, one leaf
+        at a time, as emit(keys, values) with two std::span of equal length.
+        Stops once emit returns false or the last leaf was read; returns the
+        number of leaves read. emit must not modify the tree.
+    */
+    template <typename F>
+    size_t scan(const key_type &min_key, F &&emit) const {
+        node_t leaf;
+        path_t path;
+        find_leaf(leaf, path, min_key);
+        uint16_t index = leaf.value_slot(min_key);
+        size_t loads = 1;
+        while (true) {
+            const uint16_t n = leaf.info->size - index;
+            if (n > 0 &&
+                !emit(std::span<const key_type>(leaf.keys + index, n),
+                      std::span<const value_type>(leaf.values + index, n))) {
+                return loads;
+            }
+            if (leaf.info->id == tail_id) {
+                return loads;
+            }
+            const node_id_t next_id = leaf.info->next_id;
+            leaf.load(manager.open_block(next_id));
+            index = 0;
+            ++loads;
+        }
+    }
+
+    /*
+        Hands the entries with keys <= max_key to emit like scan, but one leaf
+        at a time from right to left: the batches come in descending order,
+        while the keys within each batch ascend.
+    */
+    template <typename F>
+    size_t reverse_scan(const key_type &max_key, F &&emit) const {
+        node_t leaf;
+        path_t path;
+        find_leaf(leaf, path, max_key);
+        uint16_t n = leaf.value_slot2(max_key);
+        size_t loads = 1;
+        while (true) {
+            if (n > 0 && !emit(std::span<const key_type>(leaf.keys, n),
+                               std::span<const value_type>(leaf.values, n))) {
+                return loads;
+            }
+            if (leaf.info->id == head_id) {
+                return loads;
+            }
+            const node_id_t prev_id = leaf.info->prev_id;
+            leaf.load(manager.open_block(prev_id));
+            n = leaf.info->size;
+            ++loads;
+        }
+    }
+
+    // reads the count largest entries with keys <= max_key
+    size_t select_k_desc(size_t count, const key_type &max_key) const {
+        return reverse_scan(max_key, [&](auto keys, auto) {
+            count -= std::min(count, keys.size());
+            return count > 0;
+        });
+    }
+
+    // number of keys below key
+    size_t rank(const key_type &key) const
+        requires node_t::counted
+    {
+        return utils::order::rank<node_t>(manager, root_id, key);
+    }
+
+    // the entry with position keys below it, if the tree holds that many
+    std::optional<std::pair<key_type, value_type>> at(size_t position) const
+        requires node_t::counted
+    {
+        if (position >= size) {
+            return std::nullopt;
+        }
+        node_t leaf;
+        const uint16_t index =
+            utils::order::select(manager, root_id, position, leaf);
+        return std::pair(leaf.keys[index], leaf.values[index]);
+    }
+
+    // number of keys in [min_key, max_key)
+    size_t count(const key_type &min_key, const key_type &max_key) const
+        requires node_t::counted
+    {
+        if (!(min_key < max_key)) {
+            return 0;
+        }
+        return rank(max_key) - rank(min_key);
+    }
+
     std::optional<value_type> get(const key_type &key) const {
         node_t leaf;
         path_t path;
         find_leaf(leaf, path, key);
-        uint16_t index = leaf.value_slot(key);
-        if (index < leaf.info->size && leaf.keys[index] == key) {
-            return leaf.values[index];
-        }
-        return std::nullopt;
+        return leaf_get(leaf, key);
     }
 
     bool contains(const key_type &key) const { return get(key).has_value(); }
 
+    /*
+        Looks up every key of keys into the same position of out, like get.
+        The lookups go down the tree in groups, one level per round, and each
+        prefetches the node it moves to, so their cache misses overlap.
+    */
+    void multi_get(std::span<const key_type> keys,
+                   std::span<std::optional<value_type>> out) const {
+        constexpr size_t group_size = utils::lookup::group_size;
+        node_id_t ids[group_size];
+        node_t node;
+        for (size_t begin = 0; begin < keys.size(); begin += group_size) {
+            const size_t n = std::min(group_size, keys.size() - begin);
+            std::fill_n(ids, n, root_id);
+            size_t pending = n;
+            while (pending > 0) {
+                for (size_t i = 0; i < n; ++i) {
+                    if (ids[i] == INVALID_NODE_ID) {
+                        continue;
+                    }
+                    const key_type &key = keys[begin + i];
+                    node.load(manager.open_block(ids[i]));
+                    if (node.info->type == bp_node_type::INTERNAL) {
+                        ids[i] = node.children[node.child_slot(key)];
+                        node_t::prefetch(manager.open_block(ids[i]));
+                        continue;
+                    }
+                    out[begin + i] = leaf_get(node, key);
+                    ids[i] = INVALID_NODE_ID;
+                    --pending;
+                }
+            }
+        }
+    }
+
     friend std::ostream &operator<<(std::ostream &os, const BTree &tree) {
         os << tree.size << ", " << +tree.height << ", " << tree.internal << ", "
            << tree.leaves << ", " << tree.ctr_fast << ", "
@@ -229,6 +476,15 @@ class BTree {
     }
 
    private:
+    std::optional<value_type> leaf_get(const node_t &leaf,
+                                       const key_type &key) const {
+        uint16_t index = leaf.value_slot(key);
+        if (index < leaf.info->size && leaf.keys[index] == key) {
+            return leaf.values[index];
+        }
+        return std::nullopt;
+    }
+
     void create_new_root(const key_type &key, node_id_t node_id) {
         node_id_t left_node_id = manager.allocate();
         node_t root;
@@ -241,6 +497,7 @@ class BTree {
         manager.mark_dirty(left_node_id);
 
         if (root.info->type == LEAF) {
+            link_prev(node_id, left_node_id);
             root.info->type = INTERNAL;
             root.children = reinterpret_cast<node_id_t *>(
                 root.keys + root.internal_capacity);
@@ -250,6 +507,7 @@ class BTree {
         root.keys[0] = key;
         root.children[0] = left_node_id;
         root.children[1] = node_id;
+        utils::order::recount(manager, root);
         if (root_id == head_id) {
             head_id = left_node_id;
         }
@@ -284,6 +542,137 @@ class BTree {
         return leaf_max;
     }
 
+    bool underflows(const node_t &node) const {
+        return node.info->size <
+               (node.info->type == LEAF ? MIN_LEAF_SIZE : MIN_INTERNAL_SIZE);
+    }
+
+    /*
+        Keeps the fast-path metadata in sync after left and its right sibling
+        were merged into left or redistributed around separator. fp_min stays
+        the separator in front of the fast-path while lol_prev_id is valid, as
+        redistribute() relies on it.
+    */
+    void update_fp_metadata_rebalance(const node_t &left, const node_t &right,
+                                      bool merged, const key_type &separator) {
+        if (merged) {
+            if (right.info->id == fp_id) {
+                // the predecessor of left is unknown
+                lol_prev_id = INVALID_NODE_ID;
+                fp_id = left.info->id;
+                fp_min = left.keys[0];
+                lol_size = left.info->size;
+            } else if (left.info->id == fp_id) {
+                lol_size = left.info->size;
+            } else if (right.info->id == lol_prev_id) {
+                lol_prev_id = left.info->id;
+                lol_prev_min = left.keys[0];
+                lol_prev_size = left.info->size;
+            }
+            return;
+        }
+        if (right.info->id == fp_id) {
+            fp_min = separator;
+            lol_size = right.info->size;
+            if (left.info->id == lol_prev_id) {
+                lol_prev_min = left.keys[0];
+                lol_prev_size = left.info->size;
+            }
+        } else if (left.info->id == fp_id) {
+            fp_max = separator;
+            lol_size = left.info->size;
+        } else if (right.info->id == lol_prev_id) {
+            lol_prev_min = right.keys[0];
+            lol_prev_size = right.info->size;
+        }
+    }
+
+    /*
+        Restores the minimum size of node, reached through path on the way to
+        key, by borrowing from or merging with a sibling under the same
+        parent. Merges repeat this for the parent and the root is collapsed
+        once it is left with a single child. fp_path is looked up again as
+        its nodes may have moved.
+    */
+    void rebalance(node_t &node, const path_t &path, const key_type &key) {
+        for (uint8_t i = 1; i < height && underflows(node); ++i) {
+            node_t parent(manager.open_block(path[i]));
+            if (parent.info->size == 0) {
+                break;
+            }
+            uint16_t slot = parent.child_slot(key);
+            if (slot == parent.info->size) {
+                --slot;
+            }
+            node_t left(manager.open_block(parent.children[slot]));
+            node_t right(manager.open_block(parent.children[slot + 1]));
+            manager.mark_dirty(parent.info->id);
+            manager.mark_dirty(left.info->id);
+            manager.mark_dirty(right.info->id);
+            const bool is_leaf = left.info->type == LEAF;
+            if (!left.fits(right)) {
+                parent.keys[slot] = left.redistribute(right, parent.keys[slot]);
+                utils::order::recount(manager, parent, slot);
+                utils::order::recount(manager, parent, slot + 1);
+                if (is_leaf) {
+                    update_fp_metadata_rebalance(left, right, false,
+                                                 parent.keys[slot]);
+                }
+                break;
+            }
+            left.merge(right, parent.keys[slot]);
+            parent.erase_child(slot + 1);
+            utils::order::recount(manager, parent, slot);
+            if (is_leaf) {
+                --leaves;
+                if (right.info->id == tail_id) {
+                    tail_id = left.info->id;
+                } else {
+                    link_prev(left.info->next_id, left.info->id);
+                }
+                update_fp_metadata_rebalance(left, right, true,
+                                             parent.keys[slot]);
+            } else {
+                --internal;
+            }
+            manager.free(right.info->id);
+            node = parent;
+        }
+        collapse_root();
+
+        node_t leaf(manager.open_block(fp_id));
+        find_leaf(leaf, fp_path, leaf.info->size ? leaf.keys[0] : fp_min);
+    }
+
+    // moves the only child of the root into the root block, root_id is fixed
+    void collapse_root() {
+        node_t root(manager.open_block(root_id));
+        while (root.info->type == INTERNAL && root.info->size == 0) {
+            const node_id_t child_id = root.children[0];
+            manager.mark_dirty(root_id);
+            std::memcpy(root.info, manager.open_block(child_id),
+                        BlockManager::block_size);
+            root.load(manager.open_block(root_id));
+            root.info->id = root_id;
+            if (root.info->type == LEAF) {
+                root.info->next_id = root_id;
+                root.info->prev_id = INVALID_NODE_ID;
+                head_id = tail_id = fp_id = root_id;
+                lol_prev_id = INVALID_NODE_ID;
+            }
+            --internal;
+            --height;
+            manager.free(child_id);
+        }
+    }
+
+    // points the leaf next_id, which must not follow the tail, at prev_id
+    void link_prev(node_id_t next_id, node_id_t prev_id) {
+        node_t next(manager.open_block(next_id));
+        manager.mark_dirty(next_id);
+        next.info->prev_id = prev_id;
+    }
+
     void update_internal(const path_t &path, const key_type &old_key,
                          const key_type &new_key) {
         node_t node;
@@ -318,6 +707,7 @@ class BTree {
                 node.keys[index] = key;
                 node.children[index + 1] = child_id;
                 ++node.info->size;
+                utils::order::split(manager, node, index);
                 return;
             }
 
@@ -364,11 +754,14 @@ class BTree {
                             (index - node.info->size) * sizeof(uint32_t));
                 std::memcpy(new_node.children + 1 + index - node.info->size,
                             node.children + 1 + index,
-                            new_node.info->size * sizeof(uint32_t));
+                            (node_t::internal_capacity - index) *
+                                sizeof(uint32_t));
                 new_node.children[index - node.info->size] = child_id;
 
                 key = node.keys[node.info->size];
             }
+            utils::order::recount(manager, node);
+            utils::order::recount(manager, new_node);
 
             if (fp_path[i] == node_id && fp_id != head_id && key <= fp_min) {
                 fp_path[i] = new_node_id;
@@ -426,6 +819,10 @@ class BTree {
         }
 
         update_internal(fp_path, fp_min, leaf.keys[0]);
+        // the items that moved now count under the new separator
+        utils::order::adjust<node_t>(manager, root_id, leaf.keys[0], -items);
+        utils::order::adjust<node_t>(manager, root_id, lol_prev.keys[0],
+                                     items);
 
         fp_min = leaf.keys[0];
         lol_size = lol_size - items + 1;
@@ -444,6 +841,7 @@ class BTree {
         }
 
         size++;
+        utils::order::adjust<node_t>(manager, root_id, key, 1);
         if (leaf.info->size < node_t::leaf_capacity) {
             std::memmove(leaf.keys + index + 1, leaf.keys + index,
                          (leaf.info->size - index) * sizeof(key_type));
@@ -500,6 +898,7 @@ class BTree {
         leaf.info->size = split_leaf_pos;
         new_leaf.info->id = new_leaf_id;
         new_leaf.info->next_id = leaf.info->next_id;
+        new_leaf.info->prev_id = leaf.info->id;
         leaf.info->next_id = new_leaf_id;
         new_leaf.info->size = node_t::leaf_capacity + 1 - leaf.info->size;
 
@@ -530,6 +929,8 @@ class BTree {
         }
         if (leaf.info->id == tail_id) {
             tail_id = new_leaf_id;
+        } else {
+            link_prev(new_leaf.info->next_id, new_leaf_id);
         }
 
         if (leaf.info->id == fp_id) {
@@ -558,6 +959,79 @@ class BTree {
         return true;
     }
 
+    /*
+        Merges run, whose keys all belong to leaf, into it. If they do not fit,
+        the entries are spread over leaf and new leaves after it, which get
+        their separators inserted from left to right, and a fast-path leaf
+        moves on to the last of them. Returns the leaf that ends up with the
+        largest of the keys.
+    */
+    node_t leaf_merge(node_t &leaf,
+                      std::span<std::pair<key_type, value_type>> run) {
+        const size_t total =
+            utils::bulk::fitting(leaf.keys, leaf.info->size, run,
+                                 std::numeric_limits<size_t>::max())
+                .second;
+        size += total - leaf.info->size;
+        manager.mark_dirty(leaf.info->id);
+        if (total <= node_t::leaf_capacity) {
+            utils::order::adjust<node_t>(manager, root_id, run[0].first,
+                                         total - leaf.info->size);
+            utils::bulk::merge(leaf.keys, leaf.values, leaf.info->size, run,
+                               total);
+            leaf.info->size = total;
+            if (leaf.info->id == fp_id) {
+                lol_size = total;
+            } else if (leaf.info->next_id == fp_id) {
+                lol_prev_id = leaf.info->id;
+                lol_prev_min = leaf.keys[0];
+                lol_prev_size = total;
+            }
+            return leaf;
+        }
+        const bool was_fp = leaf.info->id == fp_id;
+        const node_id_t next_id = leaf.info->next_id;
+        const uint16_t leaf_size = leaf.info->size;
+        const auto ids = utils::bulk::spread(manager, leaf, run, total);
+        utils::order::adjust<node_t>(manager, root_id, leaf.keys[0],
+                                     leaf.info->size - leaf_size);
+        if (leaf.info->id == tail_id) {
+            tail_id = ids.back();
+        } else {
+            link_prev(next_id, ids.back());
+        }
+        leaves += ids.size();
+        node_t node;
+        path_t path;
+        for (node_id_t id : ids) {
+            const node_t next(manager.open_block(id));
+            const key_type key = next.keys[0];
+            // the new leaf is not reachable yet, this finds the one before it
+            utils::order::adjust<node_t>(manager, root_id, key,
+                                         next.info->size);
+            find_leaf(node, path, key);
+            internal_insert(path, key, id, SPLIT_INTERNAL_POS);
+        }
+        // a root leaf has moved into a new block by now
+        const node_t last(manager.open_block(ids.back()));
+        const node_t prev(manager.open_block(last.info->prev_id));
+        if (was_fp) {
+            lol_prev_id = prev.info->id;
+            lol_prev_min = prev.keys[0];
+            lol_prev_size = prev.info->size;
+            fp_id = last.info->id;
+            fp_min = last.keys[0];
+            lol_size = last.info->size;
+        } else if (last.info->next_id == fp_id) {
+            lol_prev_id = last.info->id;
+            lol_prev_min = last.keys[0];
+            lol_prev_size = last.info->size;
+        }
+        node = node_t(manager.open_block(fp_id));
+        find_leaf(node, fp_path, node.info->size ? node.keys[0] : fp_min);
+        return last;
+    }
+
     static std::size_t cmp(const key_type &max, const key_type &min) {
         return max - min;
     }
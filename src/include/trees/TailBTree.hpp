@@ -1,13 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <cstring>
+#include <iterator>
 #include <limits>
 #include <optional>
 #include <ranges>
+#include <span>
 #include <vector>
 
 #include "BTreeNode.hpp"
 #include "MemoryBlockManager.hpp"
+#include "bulk.hpp"
+#include "lookup.hpp"
+#include "order.hpp"
 
 namespace TailBTree {
 template <typename key_type, typename value_type>
@@ -15,8 +21,13 @@ class BTree {
    public:
     using node_id_t = uint32_t;
     using BlockManager = InMemoryBlockManager<node_id_t>;
+#ifdef ORDER_STATISTICS
+    using node_t = BTreeNode<node_id_t, key_type, value_type,
+                             BlockManager::block_size, void, uint32_t>;
+#else
     using node_t =
         BTreeNode<node_id_t, key_type, value_type, BlockManager::block_size>;
+#endif
     using step = node_id_t;
     using path_t = std::vector<step>;
 
@@ -25,6 +36,9 @@ class BTree {
     static constexpr uint16_t SPLIT_INTERNAL_POS =
         node_t::internal_capacity / 2;
     static constexpr uint16_t SPLIT_LEAF_POS = (node_t::leaf_capacity + 1) / 2;
+    // nodes below these sizes borrow from or merge with a sibling
+    static constexpr uint16_t MIN_LEAF_SIZE = node_t::leaf_capacity / 4;
+    static constexpr uint16_t MIN_INTERNAL_SIZE = node_t::internal_capacity / 4;
     static constexpr node_id_t INVALID_NODE_ID =
         std::numeric_limits<node_id_t>::max();
 
@@ -38,9 +52,11 @@ class BTree {
         tail_id = head_id;
         node_t leaf(manager.open_block(head_id), bp_node_type::LEAF);
         leaves = 1;
+        internal = 0;
         manager.mark_dirty(head_id);
         leaf.info->id = head_id;
         leaf.info->next_id = INVALID_NODE_ID;
+        leaf.info->prev_id = INVALID_NODE_ID;
         leaf.info->size = 0;
         node_t root(manager.open_block(root_id), bp_node_type::INTERNAL);
         manager.mark_dirty(root_id);
@@ -50,6 +66,37 @@ class BTree {
         root.children[0] = head_id;
     }
 
+    /*
+        Builds the tree bottom-up out of [begin, end), keys or key/value pairs
+        in strictly ascending key order, instead of inserting them one by one.
+        Nodes are filled to fill_factor, in [0.5, 1], of their capacity and
+        num_threads share the work on each level. Requires a tree that was
+        just constructed.
+    */
+    template <std::random_access_iterator It>
+    void bulk_load(It begin, It end, double fill_factor = 1.0,
+                   unsigned num_threads = 1) {
+        utils::bulk::loader<node_t, BlockManager> loader(manager, num_threads);
+        loader.leaves(begin, end, node_t::leaf_capacity, fill_factor, head_id);
+        leaves = loader.ids.size();
+        tail_id = loader.ids.back();
+        if (leaves > 1) {
+            tail_min = loader.mins.back();
+        }
+        while (loader.ids.size() > 1) {
+            loader.internal(node_t::internal_capacity, fill_factor);
+            internal += loader.ids.size();
+            ++height;
+        }
+        // the single node on top takes the place of the root
+        if (height > 1) {
+            loader.move_to(root_id);
+            --internal;
+            --height;
+        }
+        size = end - begin;
+    }
+
     friend std::ostream &operator<<(std::ostream &os, const BTree &tree) {
         os << tree.size << ", " << +tree.height << ", " << tree.internal << ", "
            << tree.leaves << ", " << tree.ctr_fast;
@@ -105,6 +152,51 @@ class BTree {
         }
     }
 
+    /*
+        Inserts the entries of batch, which it sorts by key, like insert one
+        by one would; the last of the entries with equal keys wins. Each run
+        of entries that belongs to the same leaf is merged into it in a single
+        pass, which splits the leaf into as many leaves as the run needs. The
+        entries from tail_min on go straight to the tail.
+    */
+    void insert_batch(std::span<std::pair<key_type, value_type>> batch) {
+        const size_t n = utils::bulk::prepare(batch);
+        node_t leaf;
+        path_t path;
+        key_type leaf_max{};
+        for (size_t i = 0; i < n;) {
+            auto run = batch.subspan(i, n - i);
+            if (run.front().first >= tail_min) {
+                leaf.load(manager.open_block(tail_id));
+                ctr_fast += run.size();
+            } else {
+                path.clear();
+                find_leaf(leaf, path, run.front().first, leaf_max);
+                run = utils::bulk::run(
+                    run, leaf.info->next_id == INVALID_NODE_ID ? nullptr
+                                                               : &leaf_max);
+            }
+            leaf_merge(leaf, run);
+            i += run.size();
+        }
+    }
+
+    bool erase(const key_type &key) {
+        node_t leaf;
+        path_t path;
+        find_leaf(leaf, path, key);
+        uint16_t index = leaf.value_slot(key);
+        if (index >= leaf.info->size || leaf.keys[index] != key) {
+            return false;
+        }
+        --size;
+        utils::order::adjust<node_t>(manager, root_id, key, -1);
+        manager.mark_dirty(leaf.info->id);
+        leaf.erase_value(index);
+        rebalance(leaf, path, key);
+        return true;
+    }
+
     uint32_t select_k(size_t count, const key_type &min_key) const {
         node_t leaf;
         find_leaf(leaf, min_key);
@@ -128,7 +220,8 @@ class BTree {
         uint32_t loads = 1;
         node_t leaf;
         find_leaf(leaf, min_key);
-        while (leaf.keys[leaf.info->size - 1] < max_key) {
+        while (leaf.info->size > 0 &&
+               leaf.keys[leaf.info->size - 1] < max_key) {
             node_id_t next_id = leaf.info->next_id;
             if (next_id == INVALID_NODE_ID) {
                 break;
@@ -139,13 +232,103 @@ class BTree {
         return loads;
     }
 
+    /*
+        Hands the entries with keys >= min_key to emit in key order, one leaf
+        at a time, as emit(keys, values) with two std::span of equal length.
+        Stops once emit returns false or the last leaf was read; returns the
+        number of leaves read. emit must not modify the tree.
+    */
+    template <typename F>
+    uint32_t scan(const key_type &min_key, F &&emit) const {
+        node_t leaf;
+        find_leaf(leaf, min_key);
+        uint16_t index = leaf.value_slot(min_key);
+        uint32_t loads = 1;
+        while (true) {
+            const uint16_t n = leaf.info->size - index;
+            if (n > 0 &&
+                !emit(std::span<const key_type>(leaf.keys + index, n),
+                      std::span<const value_type>(leaf.values + index, n))) {
+                return loads;
+            }
+            const node_id_t next_id = leaf.info->next_id;
+            if (next_id == INVALID_NODE_ID) {
+                return loads;
+            }
+            leaf.load(manager.open_block(next_id));
+            index = 0;
+            ++loads;
+        }
+    }
+
+    /*
+        Hands the entries with keys <= max_key to emit like scan, but one leaf
+        at a time from right to left: the batches come in descending order,
+        while the keys within each batch ascend.
+    */
+    template <typename F>
+    uint32_t reverse_scan(const key_type &max_key, F &&emit) const {
+        node_t leaf;
+        find_leaf(leaf, max_key);
+        uint16_t n = leaf.value_slot2(max_key);
+        uint32_t loads = 1;
+        while (true) {
+            if (n > 0 && !emit(std::span<const key_type>(leaf.keys, n),
+                               std::span<const value_type>(leaf.values, n))) {
+                return loads;
+            }
+            const node_id_t prev_id = leaf.info->prev_id;
+            if (prev_id == INVALID_NODE_ID) {
+                return loads;
+            }
+            leaf.load(manager.open_block(prev_id));
+            n = leaf.info->size;
+            ++loads;
+        }
+    }
+
+    // reads the count largest entries with keys <= max_key
+    uint32_t select_k_desc(size_t count, const key_type &max_key) const {
+        return reverse_scan(max_key, [&](auto keys, auto) {
+            count -= std::min(count, keys.size());
+            return count > 0;
+        });
+    }
+
+    // number of keys below key
+    size_t rank(const key_type &key) const
+        requires node_t::counted
+    {
+        return utils::order::rank<node_t>(manager, root_id, key);
+    }
+
+    // the entry with position keys below it, if the tree holds that many
+    std::optional<std::pair<key_type, value_type>> at(size_t position) const
+        requires node_t::counted
+    {
+        if (position >= size) {
+            return std::nullopt;
+        }
+        node_t leaf;
+        const uint16_t index =
+            utils::order::select(manager, root_id, position, leaf);
+        return std::pair(leaf.keys[index], leaf.values[index]);
+    }
+
+    // number of keys in [min_key, max_key)
+    size_t count(const key_type &min_key, const key_type &max_key) const
+        requires node_t::counted
+    {
+        if (!(min_key < max_key)) {
+            return 0;
+        }
+        return rank(max_key) - rank(min_key);
+    }
+
     std::optional<value_type> get(const key_type &key) const {
         node_t leaf;
         find_leaf(leaf, key);
-        uint16_t index = leaf.value_slot(key);
-        return index < leaf.info->size &&
-               (leaf.keys[index] == key ? std::make_optional(leaf.values[index])
-                                        : std::nullopt);
+        return leaf_get(leaf, key);
     }
 
     bool contains(const key_type &key) const {
@@ -155,7 +338,50 @@ class BTree {
         return index < leaf.info->size && (leaf.keys[index] == key);
     }
 
+    /*
+        Looks up every key of keys into the same position of out, like get.
+        The lookups go down the tree in groups, one level per round, and each
+        prefetches the node it moves to, so their cache misses overlap.
+    */
+    void multi_get(std::span<const key_type> keys,
+                   std::span<std::optional<value_type>> out) const {
+        constexpr size_t group_size = utils::lookup::group_size;
+        node_id_t ids[group_size];
+        node_t node;
+        for (size_t begin = 0; begin < keys.size(); begin += group_size) {
+            const size_t n = std::min(group_size, keys.size() - begin);
+            std::fill_n(ids, n, root_id);
+            size_t pending = n;
+            while (pending > 0) {
+                for (size_t i = 0; i < n; ++i) {
+                    if (ids[i] == INVALID_NODE_ID) {
+                        continue;
+                    }
+                    const key_type &key = keys[begin + i];
+                    node.load(manager.open_block(ids[i]));
+                    if (node.info->type == bp_node_type::INTERNAL) {
+                        ids[i] = node.children[node.child_slot(key)];
+                        node_t::prefetch(manager.open_block(ids[i]));
+                        continue;
+                    }
+                    out[begin + i] = leaf_get(node, key);
+                    ids[i] = INVALID_NODE_ID;
+                    --pending;
+                }
+            }
+        }
+    }
+
    private:
+    std::optional<value_type> leaf_get(const node_t &leaf,
+                                       const key_type &key) const {
+        uint16_t index = leaf.value_slot(key);
+        if (index < leaf.info->size && leaf.keys[index] == key) {
+            return leaf.values[index];
+        }
+        return std::nullopt;
+    }
+
     void create_new_root(const key_type &key, node_id_t right_node_id) {
         node_id_t left_node_id = manager.allocate();
         node_t root(manager.open_block(root_id));
@@ -169,6 +395,7 @@ class BTree {
         root.keys[0] = key;
         root.children[0] = left_node_id;
         root.children[1] = right_node_id;
+        utils::order::recount(manager, root);
         ++height;
     }
 
@@ -194,6 +421,22 @@ class BTree {
         } while (node.info->type == bp_node_type::INTERNAL);
     }
 
+    void find_leaf(node_t &node, path_t &path, const key_type &key,
+                   key_type &leaf_max) const {
+        node_id_t node_id = root_id;
+        path.reserve(height);
+        node.load(manager.open_block(node_id));
+        do {
+            path.push_back(node_id);
+            uint16_t slot = node.child_slot(key);
+            node_id = node.children[slot];
+            if (slot != node.info->size) {
+                leaf_max = node.keys[slot];
+            }
+            node.load(manager.open_block(node_id));
+        } while (node.info->type == bp_node_type::INTERNAL);
+    }
+
     void internal_insert(const path_t &path, key_type key, node_id_t child_id) {
         for (node_id_t node_id : std::ranges::reverse_view(path)) {
             node_t node(manager.open_block(node_id));
@@ -208,6 +451,7 @@ class BTree {
                 node.keys[index] = key;
                 node.children[index + 1] = child_id;
                 ++node.info->size;
+                utils::order::split(manager, node, index);
                 return;
             }
             node_id_t new_node_id = manager.allocate();
@@ -252,15 +496,124 @@ class BTree {
                             (index - node.info->size) * sizeof(uint32_t));
                 std::memcpy(new_node.children + 1 + index - node.info->size,
                             node.children + 1 + index,
-                            new_node.info->size * sizeof(uint32_t));
+                            (node_t::internal_capacity - index) *
+                                sizeof(uint32_t));
                 new_node.children[index - node.info->size] = child_id;
                 key = node.keys[node.info->size];
             }
+            utils::order::recount(manager, node);
+            utils::order::recount(manager, new_node);
             child_id = new_node_id;
         }
         create_new_root(key, child_id);
     }
 
+    bool underflows(const node_t &node) const {
+        return node.info->size < (node.info->type == bp_node_type::LEAF
+                                      ? MIN_LEAF_SIZE
+                                      : MIN_INTERNAL_SIZE);
+    }
+
+    /*
+        Restores the minimum size of node, reached through path on the way to
+        key, by borrowing from or merging with a sibling under the same
+        parent. Merges repeat this for the parent, and the root is collapsed
+        once it is left with a single internal child.
+    */
+    void rebalance(node_t &node, path_t &path, const key_type &key) {
+        while (!path.empty() && underflows(node)) {
+            node_t parent(manager.open_block(path.back()));
+            path.pop_back();
+            if (parent.info->size == 0) {
+                break;
+            }
+            uint16_t slot = parent.child_slot(key);
+            if (slot == parent.info->size) {
+                --slot;
+            }
+            node_t left(manager.open_block(parent.children[slot]));
+            node_t right(manager.open_block(parent.children[slot + 1]));
+            manager.mark_dirty(parent.info->id);
+            manager.mark_dirty(left.info->id);
+            manager.mark_dirty(right.info->id);
+            if (!left.fits(right)) {
+                parent.keys[slot] = left.redistribute(right, parent.keys[slot]);
+                utils::order::recount(manager, parent, slot);
+                utils::order::recount(manager, parent, slot + 1);
+                if (right.info->id == tail_id) {
+                    tail_min = parent.keys[slot];
+                }
+                return;
+            }
+            left.merge(right, parent.keys[slot]);
+            if (left.info->type == bp_node_type::LEAF) {
+                link_prev(left.info->next_id, left.info->id);
+            }
+            parent.erase_child(slot + 1);
+            utils::order::recount(manager, parent, slot);
+            if (right.info->type == bp_node_type::LEAF) {
+                --leaves;
+            } else {
+                --internal;
+            }
+            if (right.info->id == tail_id) {
+                tail_id = left.info->id;
+                tail_min = find_tail_min();
+            }
+            manager.free(right.info->id);
+            node = parent;
+        }
+        collapse_root();
+    }
+
+    // lower bound of the last leaf, inserts at or above it go to the tail
+    key_type find_tail_min() const {
+        key_type min = std::numeric_limits<key_type>::min();
+        node_t node(manager.open_block(root_id));
+        while (node.info->type == bp_node_type::INTERNAL) {
+            if (node.info->size > 0) {
+                min = node.keys[node.info->size - 1];
+            }
+            node.load(manager.open_block(node.children[node.info->size]));
+        }
+        return min;
+    }
+
+    // pulls the only child of the root into the root block, root_id is fixed
+    void collapse_root() {
+        node_t root(manager.open_block(root_id));
+        while (root.info->size == 0) {
+            const node_id_t child_id = root.children[0];
+            node_t child(manager.open_block(child_id));
+            if (child.info->type != bp_node_type::INTERNAL) {
+                return;
+            }
+            manager.mark_dirty(root_id);
+            root.info->size = child.info->size;
+            std::memcpy(root.keys, child.keys,
+                        child.info->size * sizeof(key_type));
+            std::memcpy(root.children, child.children,
+                        (child.info->size + 1) * sizeof(node_id_t));
+            if constexpr (node_t::counted) {
+                std::memcpy(root.counts(), child.counts(),
+                            (child.info->size + 1) * sizeof(*root.counts()));
+            }
+            --internal;
+            --height;
+            manager.free(child_id);
+        }
+    }
+
+    // points the leaf after a changed link, unless there is none, at prev_id
+    void link_prev(node_id_t next_id, node_id_t prev_id) {
+        if (next_id == INVALID_NODE_ID) {
+            return;
+        }
+        node_t next(manager.open_block(next_id));
+        manager.mark_dirty(next_id);
+        next.info->prev_id = prev_id;
+    }
+
     bool leaf_insert(node_t &leaf, uint16_t index, const key_type &key,
                      const value_type &value) {
         if (index < leaf.info->size && leaf.keys[index] == key) {
@@ -272,6 +625,7 @@ class BTree {
             return false;
         }
         ++size;
+        utils::order::adjust<node_t>(manager, root_id, key, 1);
         manager.mark_dirty(leaf.info->id);
         std::memmove(leaf.keys + index + 1, leaf.keys + index,
                      (leaf.info->size - index) * sizeof(key_type));
@@ -283,10 +637,57 @@ class BTree {
         return true;
     }
 
+    /*
+        Merges run, whose keys all belong to leaf, into it. If they do not fit,
+        the entries are spread over leaf and new leaves after it, which get
+        their separators inserted from left to right.
+    */
+    void leaf_merge(node_t &leaf,
+                    std::span<std::pair<key_type, value_type>> run) {
+        const size_t total =
+            utils::bulk::fitting(leaf.keys, leaf.info->size, run,
+                                 std::numeric_limits<size_t>::max())
+                .second;
+        size += total - leaf.info->size;
+        manager.mark_dirty(leaf.info->id);
+        if (total <= node_t::leaf_capacity) {
+            utils::order::adjust<node_t>(manager, root_id, run[0].first,
+                                         total - leaf.info->size);
+            utils::bulk::merge(leaf.keys, leaf.values, leaf.info->size, run,
+                               total);
+            leaf.info->size = total;
+            return;
+        }
+        const node_id_t next_id = leaf.info->next_id;
+        const uint16_t leaf_size = leaf.info->size;
+        const auto ids = utils::bulk::spread(manager, leaf, run, total);
+        utils::order::adjust<node_t>(manager, root_id, leaf.keys[0],
+                                     leaf.info->size - leaf_size);
+        link_prev(next_id, ids.back());
+        leaves += ids.size();
+        node_t node;
+        path_t path;
+        for (node_id_t id : ids) {
+            const node_t next(manager.open_block(id));
+            const key_type key = next.keys[0];
+            // the new leaf is not reachable yet, this finds the one before it
+            utils::order::adjust<node_t>(manager, root_id, key,
+                                         next.info->size);
+            path.clear();
+            find_leaf(node, path, key);
+            internal_insert(path, key, id);
+        }
+        if (leaf.info->id == tail_id) {
+            tail_id = ids.back();
+            tail_min = node_t(manager.open_block(tail_id)).keys[0];
+        }
+    }
+
     void split_insert(node_t &leaf, uint16_t index, const key_type &key,
                       const value_type &value, key_type &new_key,
                       node_id_t &new_id) {
         ++size;
+        utils::order::adjust<node_t>(manager, root_id, key, 1);
         uint16_t split_leaf_pos = SPLIT_LEAF_POS;
         node_id_t new_leaf_id = manager.allocate();
         node_t new_leaf(manager.open_block(new_leaf_id), bp_node_type::LEAF);
@@ -296,6 +697,8 @@ class BTree {
         new_leaf.info->next_id = leaf.info->next_id;
         new_leaf.info->size = node_t::leaf_capacity + 1 - split_leaf_pos;
         leaf.info->next_id = new_leaf_id;
+        new_leaf.info->prev_id = leaf.info->id;
+        link_prev(new_leaf.info->next_id, new_leaf_id);
         leaf.info->size = split_leaf_pos;
         if (index < leaf.info->size) {
             std::memcpy(new_leaf.keys, leaf.keys + leaf.info->size - 1,
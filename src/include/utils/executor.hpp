@@ -1,8 +1,12 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <random>
+#include <ranges>
+#include <span>
 #include <vector>
 
 #include "../config.hpp"
@@ -14,16 +18,25 @@
 namespace utils {
 namespace executor {
 enum RANGE_QUERY_TYPE { SHORT, MID, LONG };
+// reads k entries from each random start key; checksum sums their keys
 template <typename tree_t, typename key_type>
 size_t range_queries(tree_t &tree, const std::vector<key_type> &data,
                      size_t num_inserts, size_t range, const key_type &offset,
-                     size_t size, std::mt19937 &generator) {
+                     size_t size, std::mt19937 &generator, size_t &checksum) {
     size_t leaf_accesses = 0;
     size_t k = num_inserts / size;
     std::uniform_int_distribution<size_t> index(0, num_inserts - k - 1);
     for (size_t i = 0; i < range; i++) {
         const key_type min_key = data[index(generator)] + offset;
-        leaf_accesses += tree.select_k(k, min_key);
+        size_t remaining = k;
+        leaf_accesses += tree.scan(min_key, [&](auto keys, auto) {
+            const size_t n = std::min(remaining, keys.size());
+            for (size_t j = 0; j < n; ++j) {
+                checksum += keys[j];
+            }
+            remaining -= n;
+            return remaining > 0;
+        });
     }
     return leaf_accesses;
 }
@@ -37,6 +50,28 @@ class Workload {
     std::mt19937 generator;
     utils::logging::Logger &log;
     utils::executor::metrics::Latency timer;
+    // nothing was loaded into the tree yet
+    bool empty = true;
+    // most recent keys erased again by validate_reinserts
+    static constexpr size_t reinserts_erased = 4096;
+
+    // inserts data[begin, end), through insert_batch if conf.insert_batch
+    std::chrono::nanoseconds inserts(const std::vector<key_type> &data,
+                                     size_t begin, size_t end) {
+        if (conf.insert_batch > 0) {
+            const size_t batch = conf.insert_batch;
+            return utils::worker::work(
+                [batch](tree_t &tree, const std::vector<key_type> &data,
+                        utils::worker::Ticket &line, const key_type &offset) {
+                    utils::worker::batch_insert_worker(tree, data, line,
+                                                       offset, batch);
+                },
+                tree, data, begin, end, conf.num_threads, offset);
+        }
+        return utils::worker::work(
+            utils::worker::insert_worker<tree_t, key_type>, tree, data, begin,
+            end, conf.num_threads, offset);
+    }
 
    public:
     Workload(tree_t &tree, const Config &conf)
@@ -62,10 +97,24 @@ class Workload {
     void run_preload(const std::vector<key_type> &data, size_t begin,
                      size_t num_load) {
         if (num_load > 0) {
-            log.trace("Preload ({})", num_load);
-            auto duration = utils::worker::work(
-                utils::worker::insert_worker<tree_t, key_type>, tree, data,
-                begin, num_load, conf.num_threads, offset);
+            const auto load = std::span(data).subspan(begin, num_load - begin);
+            std::chrono::nanoseconds duration;
+            if (conf.bulk_load_fill > 0 && empty &&
+                std::ranges::adjacent_find(load, std::greater_equal{}) ==
+                    load.end()) {
+                log.trace("Bulk load ({})", num_load);
+                const auto keys =
+                    load | std::views::transform([this](const key_type &key) {
+                        return key + offset;
+                    });
+                auto start = std::chrono::high_resolution_clock::now();
+                tree.bulk_load(keys.begin(), keys.end(),
+                               conf.bulk_load_fill / 100.0, conf.num_threads);
+                duration = std::chrono::high_resolution_clock::now() - start;
+            } else {
+                log.trace("Preload ({})", num_load);
+                duration = inserts(data, begin, num_load);
+            }
             results << ", " << duration.count();
             timer.preload = duration.count();
         }
@@ -75,9 +124,7 @@ class Workload {
                     size_t raw_writes) {
         if (raw_writes > 0) {
             log.trace("Raw write ({})", raw_writes);
-            auto duration = utils::worker::work(
-                utils::worker::insert_worker<tree_t, key_type>, tree, data,
-                begin, begin + raw_writes, conf.num_threads, offset);
+            auto duration = inserts(data, begin, begin + raw_writes);
             results << ", " << duration.count();
             timer.raw_writes = duration.count();
         }
@@ -92,9 +139,22 @@ class Workload {
             for (size_t i = 0; i < raw_queries; i++) {
                 queries.emplace_back(data[index(generator)] + offset);
             }
-            auto duration = utils::worker::work(
-                utils::worker::query_worker<tree_t, key_type>, tree, data, 0,
-                raw_queries, conf.num_threads, offset);
+            std::chrono::nanoseconds duration;
+            if (conf.multi_get_batch > 0) {
+                const size_t batch = conf.multi_get_batch;
+                duration = utils::worker::work(
+                    [batch](tree_t &tree, const std::vector<key_type> &data,
+                            utils::worker::Ticket &line,
+                            const key_type &offset) {
+                        utils::worker::multi_query_worker(tree, data, line,
+                                                          offset, batch);
+                    },
+                    tree, data, 0, raw_queries, conf.num_threads, offset);
+            } else {
+                duration = utils::worker::work(
+                    utils::worker::query_worker<tree_t, key_type>, tree, data,
+                    0, raw_queries, conf.num_threads, offset);
+            }
             results << ", " << duration.count();
             timer.raw_reads = duration.count();
         }
@@ -151,15 +211,30 @@ class Workload {
         }
     }
 
+    // erases the num_deletes oldest keys, as a retention job would
+    void run_deletes(const std::vector<key_type> &data, size_t num_deletes) {
+        if (num_deletes > 0) {
+            log.trace("Deletes ({})", num_deletes);
+            auto duration = utils::worker::work(
+                utils::worker::erase_worker<tree_t, key_type>, tree, data, 0,
+                num_deletes, conf.num_threads, offset);
+            results << ", " << duration.count();
+            timer.deletes = duration.count();
+        }
+    }
+
     void run_range(const std::vector<key_type> &data, size_t num_inserts,
                    size_t range, size_t size, RANGE_QUERY_TYPE type) {
         if (range > 0) {
             // std::cout << "Range (" << range << ")\n";
             log.trace("Range ({})", range);
+            size_t checksum = 0;
             auto start = std::chrono::high_resolution_clock::now();
-            size_t leaf_accesses = range_queries(tree, data, num_inserts, range,
-                                                 offset, size, generator);
+            size_t leaf_accesses =
+                range_queries(tree, data, num_inserts, range, offset, size,
+                              generator, checksum);
             auto duration = std::chrono::high_resolution_clock::now() - start;
+            log.trace("Range checksum {}", checksum);
             auto accesses = (leaf_accesses + range - 1) / range;  // ceil
             results << ", " << duration.count() << ", " << accesses;
             switch (type) {
@@ -183,6 +258,7 @@ class Workload {
         log.info("Raw Reads: {}", timer.raw_reads);
         log.info("Mixed: {}", timer.mixed);
         log.info("Updates: {}", timer.updates);
+        log.info("Deletes: {}", timer.deletes);
         log.info("Short Range: {}", timer.short_range);
         log.info("Mid Range: {}", timer.mid_range);
         log.info("Long Range: {}", timer.long_range);
@@ -196,6 +272,51 @@ class Workload {
         }
     }
 
+    /*
+        Inserts the keys that are left once more, with a new value, and
+        checks that each reads it back; a second time in reverse, where most
+        of them miss the fast-paths and take the tree. Then erases the most
+        recent of them, which the fast-path leaves hold, and checks that no
+        copy survives before inserting them back.
+    */
+    void validate_reinserts(const std::vector<key_type> &data,
+                            size_t num_deletes) {
+        using value_type = decltype(tree.get(key_type{}))::value_type;
+        const auto kept = data | std::views::drop(num_deletes);
+        const auto reinsert = [&](auto keys, value_type delta) {
+            for (const auto &item : keys) {
+                tree.insert(item, static_cast<value_type>(item + delta));
+            }
+            size_t stale = 0;
+            for (const auto &item : kept) {
+                stale +=
+                    tree.get(item) != static_cast<value_type>(item + delta);
+            }
+            if (stale) {
+                log.error("Error: {} inserted again keys with a stale value",
+                          stale);
+            }
+        };
+        reinsert(kept, 0);
+        reinsert(kept | std::views::reverse, 1);
+        const auto recent = kept | std::views::reverse |
+                            std::views::take(reinserts_erased);
+        for (const auto &item : recent) {
+            tree.erase(item);
+        }
+        size_t found = 0;
+        for (const auto &item : recent) {
+            found += tree.contains(item);
+        }
+        if (found) {
+            log.error("Error: {} inserted again keys found after erase",
+                      found);
+        }
+        for (const auto &item : recent) {
+            tree.insert(item, {});
+        }
+    }
+
     void run(const char *name, const std::vector<key_type> &data) {
         const size_t num_inserts = data.size();
         const size_t raw_writes = conf.raw_write_perc / 100.0 * num_inserts;
@@ -206,6 +327,8 @@ class Workload {
         const size_t raw_queries = conf.raw_read_perc / 100.0 * num_inserts;
         const size_t mixed_reads = conf.mixed_reads_perc / 100.0 * num_inserts;
         const size_t num_updates = conf.updates_perc / 100.0 * num_inserts;
+        const size_t num_deletes = conf.deletes_perc / 100.0 * num_inserts;
+        assert(num_inserts >= num_deletes);
 
         // tree.reset_ctr();
 
@@ -214,6 +337,7 @@ class Workload {
                 << file.filename().c_str() << ", " << offset;
 
         run_preload(data, 0, num_load);
+        empty = false;
         run_writes(data, num_load, raw_writes);
         run_mixed(data, num_load + raw_writes, mixed_writes, mixed_reads);
         run_reads(data, num_inserts, raw_queries);
@@ -224,10 +348,18 @@ class Workload {
                   RANGE_QUERY_TYPE::MID);
         run_range(data, num_inserts, conf.long_range, 10,
                   RANGE_QUERY_TYPE::LONG);
+        run_deletes(data, num_deletes);
 
         if (conf.validate) {
             size_t count = 0;
-            for (const auto &item : data) {
+            size_t deleted = 0;
+            for (size_t i = 0; i < num_deletes; ++i) {
+                deleted += tree.contains(data[i]);
+            }
+            if (deleted) {
+                log.error("Error: {} deleted keys found", deleted);
+            }
+            for (const auto &item : data | std::views::drop(num_deletes)) {
                 if (!tree.contains(item)) {
                     count++;
 #ifdef DEBUG
@@ -244,6 +376,16 @@ class Workload {
                 // std::cerr << "All good\n";
                 log.info("All good");
             }
+            if constexpr (requires { tree.rank(data[0]); }) {
+                size_t misplaced = 0;
+                for (const auto &item : data | std::views::drop(num_deletes)) {
+                    const auto entry = tree.at(tree.rank(item));
+                    misplaced += !entry || entry->first != item;
+                }
+                if (misplaced) {
+                    log.error("Error: {} keys not at their rank", misplaced);
+                }
+            }
         }
 
         results << ", ";
@@ -251,6 +393,11 @@ class Workload {
         print_timers();
         auto stats = tree.get_stats();
         print_stats("Tree Stats", stats);
+
+        // reinserting changes the tree, so it runs after its stats are out
+        if (conf.validate) {
+            validate_reinserts(data, num_deletes);
+        }
     }
 };
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
@@ -6,6 +7,7 @@
 #include <fstream>
 #include <iostream>
 #include <random>
+#include <span>
 #include <thread>
 #include <vector>
 
@@ -23,6 +25,12 @@ struct Ticket {
         return idx < _size ? idx : _size;
     }
 
+    // claims the next n indexes, returns the first of them
+    size_t get(size_t n) {
+        size_t idx = _idx.fetch_add(n);
+        return idx < _size ? idx : _size;
+    }
+
     Ticket(size_t begin, size_t end) : _idx(begin), _size(end) {}
 };
 
@@ -38,6 +46,23 @@ void insert_worker(tree_t &tree, const std::vector<key_type> &data,
     }
 }
 
+template <typename tree_t, typename key_type>
+void batch_insert_worker(tree_t &tree, const std::vector<key_type> &data,
+                         Ticket &line, const key_type &offset, size_t batch) {
+    using value_type = decltype(tree.get(key_type{}))::value_type;
+    std::vector<std::pair<key_type, value_type>> entries(batch);
+    size_t idx = line.get(batch);
+    const auto &size = line._size;
+    while (idx < size) {
+        const size_t n = std::min(batch, size - idx);
+        for (size_t i = 0; i < n; ++i) {
+            entries[i] = {data[idx + i] + offset, {}};
+        }
+        tree.insert_batch(std::span(entries.data(), n));
+        idx = line.get(batch);
+    }
+}
+
 template <typename tree_t, typename key_type>
 void update_worker(tree_t &tree, const std::vector<key_type> &data,
                    Ticket &line, const key_type &offset) {
@@ -50,6 +75,18 @@ void update_worker(tree_t &tree, const std::vector<key_type> &data,
     }
 }
 
+template <typename tree_t, typename key_type>
+void erase_worker(tree_t &tree, const std::vector<key_type> &data,
+                  Ticket &line, const key_type &offset) {
+    auto idx = line.get();
+    const auto &size = line._size;
+    while (idx < size) {
+        const key_type &key = data[idx] + offset;
+        tree.erase(key);
+        idx = line.get();
+    }
+}
+
 template <typename tree_t, typename key_type>
 void query_worker(tree_t &tree, const std::vector<key_type> &data, Ticket &line,
                   const key_type &offset) {
@@ -62,6 +99,25 @@ void query_worker(tree_t &tree, const std::vector<key_type> &data, Ticket &line,
     }
 }
 
+template <typename tree_t, typename key_type>
+void multi_query_worker(tree_t &tree, const std::vector<key_type> &data,
+                        Ticket &line, const key_type &offset, size_t batch) {
+    using result_t = decltype(tree.get(key_type{}));
+    std::vector<key_type> keys(batch);
+    std::vector<result_t> results(batch);
+    size_t idx = line.get(batch);
+    const auto &size = line._size;
+    while (idx < size) {
+        const size_t n = std::min(batch, size - idx);
+        for (size_t i = 0; i < n; ++i) {
+            keys[i] = data[idx + i] + offset;
+        }
+        tree.multi_get(std::span<const key_type>(keys.data(), n),
+                       std::span<result_t>(results.data(), n));
+        idx = line.get(batch);
+    }
+}
+
 template <typename WorkerFunc, typename tree_t, typename key_type>
 auto work(WorkerFunc worker_func, tree_t &tree,
           const std::vector<key_type> &data, size_t begin, size_t end,
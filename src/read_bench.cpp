@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "trees.hpp"
+
+// Measures lookup throughput of the concurrent trees for 1..max_threads
+// reader threads, once on a static tree and once while a writer inserts
+// near-sorted keys. Built three times: read_bench latches with shared lock
+// crabbing, read_bench_olc with optimistic lock coupling (OPTIMISTIC_READS)
+// and read_bench_embedded crabs on latches kept in the node headers
+// (EMBEDDED_LATCHES). ConcurrentBLinkBTree latches one node at a time in all
+// builds.
+// Usage: ./read_bench [max_threads] [keys] [millis]
+
+#ifdef OPTIMISTIC_READS
+static constexpr const char *latching = "olc";
+#elif defined(EMBEDDED_LATCHES)
+static constexpr const char *latching = "embedded";
+#else
+static constexpr const char *latching = "crabbing";
+#endif
+
+using key_type = uint32_t;
+using value_type = uint32_t;
+
+template <typename tree_t>
+void bench(size_t max_threads, size_t keys, size_t millis) {
+    for (bool writer : {false, true}) {
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            // even keys are preloaded and looked up, the writer adds odd ones
+            typename tree_t::BlockManager manager(
+                8 * keys / tree_t::node_t::leaf_capacity + 1024);
+            tree_t tree(manager);
+            std::vector<key_type> data(keys);
+            for (size_t i = 0; i < keys; ++i) {
+                data[i] = 2 * i;
+            }
+            std::shuffle(data.begin(), data.end(), std::mt19937(1234));
+            for (const auto &key : data) {
+                tree.insert(key, key);
+            }
+
+            std::atomic<bool> stop{false};
+            std::atomic<uint64_t> lookups{0};
+            std::atomic<uint64_t> misses{0};
+            uint64_t inserts = 0;
+            {
+                std::vector<std::jthread> readers;
+                for (size_t t = 0; t < threads; ++t) {
+                    readers.emplace_back([&, t] {
+                        std::mt19937_64 generator(t);
+                        uint64_t done = 0;
+                        uint64_t missed = 0;
+                        while (!stop.load(std::memory_order_relaxed)) {
+                            const key_type key = 2 * (generator() % keys);
+                            missed += !tree.contains(key);
+                            ++done;
+                        }
+                        lookups += done;
+                        misses += missed;
+                    });
+                }
+                std::jthread inserter;
+                if (writer) {
+                    inserter = std::jthread([&] {
+                        for (size_t i = 0;
+                             i < keys && !stop.load(std::memory_order_relaxed);
+                             ++i) {
+                            tree.insert(2 * i + 1, i);
+                            ++inserts;
+                        }
+                    });
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+                stop = true;
+            }
+            if (misses) {
+                std::cerr << "Error: " << misses << " lookups failed"
+                          << std::endl;
+            }
+            std::cout << tree_t::name << ", " << latching << ", " << threads
+                      << ", " << writer << ", "
+                      << lookups * 1e-3 / millis << ", "
+                      << inserts * 1e-3 / millis << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t max_threads =
+        argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    size_t keys = argc > 2 ? std::stoul(argv[2]) : 1000000;
+    size_t millis = argc > 3 ? std::stoul(argv[3]) : 1000;
+    std::cout << "tree, latching, readers, writer, lookups_mops, inserts_mops"
+              << std::endl;
+    bench<ConcurrentSimpleBTree::BTree<key_type, value_type>>(max_threads,
+                                                               keys, millis);
+    bench<ConcurrentBLinkBTree::BTree<key_type, value_type>>(max_threads, keys,
+                                                             millis);
+    bench<ConcurrentQuITBTree::BTree<key_type, value_type>>(max_threads, keys,
+                                                            millis);
+    bench<ConcurrentQuITBTreeAtomic::BTree<key_type, value_type, true>>(
+        max_threads, keys, millis);
+    return 0;
+}
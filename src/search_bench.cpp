@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "BTreeNode.hpp"
+#include "MemoryBlockManager.hpp"
+#include "search.hpp"
+
+// Compares the in-node search kernels against std::lower_bound over a full
+// leaf worth of sorted keys, and the tag probe of unordered keys against a
+// linear scan. Usage: ./search_bench [lookups]
+
+template <typename key_type, typename F>
+void run(const char *label, const std::vector<key_type> &keys,
+         const std::vector<key_type> &queries, F search) {
+    uint64_t checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto &q : queries) {
+        checksum += search(keys.data(), keys.size(), q);
+    }
+    auto duration = std::chrono::high_resolution_clock::now() - start;
+    double ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    std::cout << label << ", " << sizeof(key_type) * 8 << ", " << keys.size()
+              << ", " << ns / queries.size() << ", " << checksum << std::endl;
+}
+
+template <typename key_type>
+void bench(size_t lookups) {
+    using node_t = BTreeNode<uint32_t, key_type, key_type,
+                             InMemoryBlockManager<uint32_t>::block_size>;
+    std::mt19937_64 generator(1234);
+    std::vector<key_type> keys(node_t::leaf_capacity);
+    for (auto &key : keys) {
+        key = generator() >> 1;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<key_type> queries(lookups);
+    std::uniform_int_distribution<size_t> index(0, keys.size() - 1);
+    for (auto &query : queries) {
+        // half of the lookups hit, half fall between two keys
+        query = keys[index(generator)] + (generator() & 1);
+    }
+
+    for (const auto &q : queries) {
+        uint16_t expected =
+            std::lower_bound(keys.begin(), keys.end(), q) - keys.begin();
+        if (utils::search::lower_bound(keys.data(), keys.size(), q) !=
+                expected ||
+            utils::search::bound_scalar<false>(keys.data(), keys.size(), q) !=
+                expected) {
+            std::cerr << "Error: lower_bound mismatch for " << q << std::endl;
+            return;
+        }
+        expected = std::upper_bound(keys.begin(), keys.end(), q) - keys.begin();
+        if (utils::search::upper_bound(keys.data(), keys.size(), q) !=
+                expected ||
+            utils::search::bound_scalar<true>(keys.data(), keys.size(), q) !=
+                expected) {
+            std::cerr << "Error: upper_bound mismatch for " << q << std::endl;
+            return;
+        }
+    }
+
+    run("std::lower_bound", keys, queries,
+        [](const key_type *k, uint16_t n, const key_type &q) {
+            return std::lower_bound(k, k + n, q) - k;
+        });
+    run("scalar", keys, queries,
+        [](const key_type *k, uint16_t n, const key_type &q) {
+            return utils::search::bound_scalar<false>(k, n, q);
+        });
+    run(utils::search::kernel, keys, queries,
+        [](const key_type *k, uint16_t n, const key_type &q) {
+            return utils::search::lower_bound(k, n, q);
+        });
+
+    // the same keys unordered, as appended to a fast-path leaf
+    std::shuffle(keys.begin(), keys.end(), generator);
+    std::vector<uint8_t> tags(keys.size());
+    std::transform(keys.begin(), keys.end(), tags.begin(),
+                   utils::search::tag<key_type>);
+    run("linear scan", keys, queries,
+        [](const key_type *k, uint16_t n, const key_type &q) {
+            return std::find(k, k + n, q) - k;
+        });
+    run("tagged", keys, queries,
+        [&tags](const key_type *k, uint16_t n, const key_type &q) {
+            return utils::search::find_tagged(tags.data(), k, n, q);
+        });
+}
+
+int main(int argc, char **argv) {
+    size_t lookups = argc > 1 ? std::stoul(argv[1]) : 10000000;
+    std::cout << "kernel, key_bits, keys, ns_per_lookup, checksum" << std::endl;
+    bench<uint32_t>(lookups);
+    bench<uint64_t>(lookups);
+    return 0;
+}
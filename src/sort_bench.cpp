@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "BTreeNode.hpp"
+#include "MemoryBlockManager.hpp"
+#include "sort.hpp"
+
+// Compares the leaf sorter against introsort and std::sort over pairs, as
+// sort_leaf and std_sort_leaf of the concurrent QuIT trees use them, on full
+// leaves of sorted keys with a share of them swapped to random positions.
+// Usage: ./sort_bench [leaves]
+
+template <typename key_type, typename F>
+void run(const char *label, double noise,
+         const std::vector<std::vector<key_type>> &leaves, F sort) {
+    std::vector<key_type> keys;
+    std::vector<key_type> values;
+    uint64_t checksum = 0;
+    std::chrono::nanoseconds duration{};
+    for (const auto &leaf : leaves) {
+        keys = leaf;
+        values = leaf;
+        auto start = std::chrono::high_resolution_clock::now();
+        sort(keys.data(), values.data(), keys.size());
+        duration += std::chrono::high_resolution_clock::now() - start;
+        if (!std::is_sorted(keys.begin(), keys.end()) || keys != values) {
+            std::cerr << "Error: " << label << " did not sort" << std::endl;
+            return;
+        }
+        checksum += keys[keys.size() / 2];
+    }
+    std::cout << label << ", " << sizeof(key_type) * 8 << ", " << noise
+              << ", " << double(duration.count()) / leaves.size() << ", "
+              << checksum << std::endl;
+}
+
+template <typename key_type>
+void bench(size_t count) {
+    using node_t = BTreeNode<uint32_t, key_type, key_type,
+                             InMemoryBlockManager<uint32_t>::block_size>;
+    constexpr uint16_t capacity = node_t::leaf_capacity;
+    std::mt19937_64 generator(1234);
+    for (double noise : {0.0, 0.01, 0.05, 0.1, 0.25, 0.5, 1.0}) {
+        std::vector<std::vector<key_type>> leaves(count);
+        for (auto &leaf : leaves) {
+            // consecutive keys of a leaf are a small random step apart
+            leaf.resize(capacity);
+            key_type key = generator() >> 8;
+            for (auto &k : leaf) {
+                k = key += 1 + generator() % 16;
+            }
+            std::uniform_int_distribution<uint16_t> slot(0, capacity - 1);
+            for (size_t i = 0; i < noise * capacity; ++i) {
+                std::swap(leaf[slot(generator)], leaf[slot(generator)]);
+            }
+        }
+
+        run("introsort", noise, leaves,
+            [](key_type *keys, key_type *values, uint16_t n) {
+                utils::sort::introsort(keys, values, 0, n - 1,
+                                       2 * static_cast<int>(std::log2(n)));
+            });
+        run("std::sort", noise, leaves,
+            [](key_type *keys, key_type *values, uint16_t n) {
+                std::vector<std::pair<key_type, key_type>> kvs(n);
+                for (uint16_t i = 0; i < n; i++) {
+                    kvs[i] = {keys[i], values[i]};
+                }
+                std::sort(kvs.begin(), kvs.end(),
+                          [](const auto &a, const auto &b) {
+                              return a.first < b.first;
+                          });
+                for (uint16_t i = 0; i < n; i++) {
+                    keys[i] = kvs[i].first;
+                    values[i] = kvs[i].second;
+                }
+            });
+        run("leaf", noise, leaves,
+            [](key_type *keys, key_type *values, uint16_t n) {
+                utils::sort::leaf<capacity>(keys, values, n);
+            });
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t leaves = argc > 1 ? std::stoul(argv[1]) : 2000;
+    std::cout << "sort, key_bits, noise, ns_per_leaf, checksum" << std::endl;
+    bench<uint32_t>(leaves);
+    bench<uint64_t>(leaves);
+    return 0;
+}
@@ -1,4 +1,7 @@
+#include <sys/resource.h>
+
 #include <cassert>
+#include <chrono>
 #include <iostream>
 #include <vector>
 
@@ -22,6 +25,8 @@ using namespace QuITBTree;
 using namespace ConcurrentSimpleBTree;
 #elif defined(FOR_CONCURRENT_TAIL)
 using namespace ConcurrentTailBTree;
+#elif defined(FOR_CONCURRENT_BLINK)
+using namespace ConcurrentBLinkBTree;
 #elif defined(FOR_CONCURRENT_QUIT)
 using namespace ConcurrentQuITBTree;
 #elif defined(FOR_CONCURRENT_QUIT_APPENDS)
@@ -32,8 +37,17 @@ using namespace ConcurrentQuITBTreeAtomic;
 using namespace SimpleBTree;  // FOR_SIMPLEBTREE or fallback
 #endif
 
+// LATCH selects the node latch of the concurrent trees
 #if defined(FOR_CONCURRENT_QUIT_APPENDS) || defined(FOR_CONCURRENT_QUIT_ATOMIC)
+#ifdef LATCH
+using tree_t = BTree<key_type, value_type, true, LATCH::shared_mutex>;
+#else
 using tree_t = BTree<key_type, value_type, true>;
+#endif
+#elif defined(LATCH) && defined(FOR_CONCURRENT_QUIT)
+using tree_t = BTree<key_type, value_type, false, LATCH::shared_mutex>;
+#elif defined(LATCH)
+using tree_t = BTree<key_type, value_type, LATCH::shared_mutex>;
 #else
 using tree_t = BTree<key_type, value_type>;
 #endif
@@ -53,7 +67,10 @@ int main(int argc, char **argv) {
     utils::infra::config::load_configurations(conf, argc, argv);
     utils::infra::config::print_configurations(conf);
 
+    // startup covers creating the block manager and the first empty tree
+    auto start = std::chrono::high_resolution_clock::now();
     tree_t::BlockManager manager(conf.blocks_in_memory);
+    auto startup = std::chrono::high_resolution_clock::now() - start;
 
     log.info("Writing CSV Results to: {}", conf.results_csv);
 
@@ -63,9 +80,18 @@ int main(int argc, char **argv) {
     log.trace("Running {} with {} threads", tree_t::name, conf.num_threads);
     for (size_t i = 0; i < conf.runs; ++i) {
         manager.reset();
+        start = std::chrono::high_resolution_clock::now();
         tree_t tree(manager);
+        if (i == 0) {
+            startup += std::chrono::high_resolution_clock::now() - start;
+            log.info("Startup: {}", startup.count());
+        }
         utils::executor::Workload<tree_t, key_type> workload(tree, conf);
         workload.run_all(data);
     }
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    log.info("Peak RSS: {}", usage.ru_maxrss);  // KiB
     return 0;
 }